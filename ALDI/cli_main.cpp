@@ -0,0 +1,309 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+import mod_commands;
+import mod_binary_file;
+import mod_hex;
+
+// ---------------------------------------------------------------------------
+// Headless driver: ALDI.Cli [-k] [-j] [-c <command>]... <file> [script | -]
+//
+// Opens <file>, then runs every -c command followed by every line of the
+// script (stdin when it is "-", or when there is neither a script nor a
+// -c). Blank lines and lines starting with '#' are skipped. Output goes
+// to stdout as UTF-8 with LF line endings, failures to stderr. With -j
+// each command writes one JSON object per line instead of text.
+//
+// Read-only commands next to each other in the script (find, dump,
+// disasm, ...) run in parallel; see ExecScript. Output stays in script
+// order.
+//
+// Exit status: 0 when every command succeeded, 1 when one failed (the
+// first failure stops the run unless -k is given), 2 on bad usage or when
+// <file> cannot be opened.
+// ---------------------------------------------------------------------------
+
+namespace
+{
+    // Bytes per hex chunk; dump output is formatted and written this
+    // much at a time, whatever the dump size.
+    constexpr std::size_t kDumpChunk = std::size_t(64) * 1024;
+
+    std::wstring FromUtf8(std::string_view s)
+    {
+        std::wstring out;
+        out.reserve(s.size());
+
+        for (std::size_t i = 0; i < s.size();)
+        {
+            const auto b = static_cast<unsigned char>(s[i]);
+            const int n = b < 0x80 ? 0 : b >= 0xF0 ? 3 : b >= 0xE0 ? 2 : b >= 0xC0 ? 1 : -1;
+
+            if (n < 0 || i + n >= s.size())
+            {
+                out += L'?';
+                ++i;
+                continue;
+            }
+
+            char32_t c = n == 0 ? b : b & (0x3F >> n);
+            for (int k = 1; k <= n; ++k)
+                c = (c << 6) | (static_cast<unsigned char>(s[i + k]) & 0x3F);
+            i += n + 1;
+
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                if (c >= 0x10000)
+                {
+                    c -= 0x10000;
+                    out += static_cast<wchar_t>(0xD800 + (c >> 10));
+                    out += static_cast<wchar_t>(0xDC00 + (c & 0x3FF));
+                    continue;
+                }
+            }
+            out += static_cast<wchar_t>(c);
+        }
+
+        return out;
+    }
+
+    // s as UTF-8; with dropCr, without the CRs of the CRLF the
+    // commands emit.
+    std::string ToUtf8(std::wstring_view s, bool dropCr = false)
+    {
+        std::string buf;
+        buf.reserve(s.size() + s.size() / 8);
+
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            char32_t c = static_cast<char32_t>(s[i]);
+            if (dropCr && c == U'\r')
+                continue;
+
+            if (c >= 0xD800 && c < 0xDC00 && i + 1 < s.size())
+                c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<char32_t>(s[++i]) - 0xDC00);
+
+            if (c < 0x80)
+            {
+                buf += static_cast<char>(c);
+            }
+            else if (c < 0x800)
+            {
+                buf += static_cast<char>(0xC0 | (c >> 6));
+                buf += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                buf += static_cast<char>(0xE0 | (c >> 12));
+                buf += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                buf += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                buf += static_cast<char>(0xF0 | (c >> 18));
+                buf += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+                buf += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                buf += static_cast<char>(0x80 | (c & 0x3F));
+            }
+        }
+
+        return buf;
+    }
+
+    void WriteText(std::FILE* f, std::wstring_view s)
+    {
+        const std::string buf = ToUtf8(s, true);
+        std::fwrite(buf.data(), 1, buf.size(), f);
+    }
+
+    // Scripts are named by wide path like every other file; their
+    // contents are read as UTF-8.
+    std::FILE* OpenScript(const std::wstring& path)
+    {
+#ifdef _WIN32
+        return _wfopen(path.c_str(), L"r");
+#else
+        return std::fopen(ToUtf8(path).c_str(), "r");
+#endif
+    }
+
+    // Hex rows straight from the mapping into a narrow buffer that is
+    // reused for every chunk; nothing is built for the whole range.
+    void WriteRows(std::FILE* f, std::size_t off, std::size_t size)
+    {
+        const auto bytes = CoreBytes();
+        std::string rows;
+
+        for (std::size_t done = 0; done < size; done += kDumpChunk)
+        {
+            rows.clear();
+            HexFormatRows(bytes, off + done, std::min(kDumpChunk, size - done), rows);
+            std::erase(rows, '\r');
+            std::fwrite(rows.data(), 1, rows.size(), f);
+        }
+    }
+
+    // Write one step; false when the command failed.
+    bool Emit(const ScriptStep& step, bool json)
+    {
+        const CommandResult& r = step.result;
+
+        if (r.failed)
+        {
+            std::fprintf(stderr, "%zu: ", step.line);
+            WriteText(stderr, step.command);
+            WriteText(stderr, L": ");
+            WriteText(stderr, r.text.empty() ? std::wstring_view(L"(failed)\n") : r.text);
+        }
+
+        if (json)
+        {
+            std::fwrite(step.json.data(), 1, step.json.size(), stdout);
+            std::fputc('\n', stdout);
+        }
+        else if (!r.failed)
+        {
+            WriteText(stdout, step.text);
+            if (r.kind == CommandResultKind::ShowBytes)
+                WriteRows(stdout, r.offset, r.size);
+        }
+
+        std::fflush(stdout);
+        return !r.failed;
+    }
+
+    bool ReadLine(std::FILE* f, std::string& line)
+    {
+        line.clear();
+
+        char buf[4096];
+        while (std::fgets(buf, sizeof(buf), f))
+        {
+            line += buf;
+            if (!line.empty() && line.back() == '\n')
+                break;
+        }
+
+        if (line.empty())
+            return false;
+
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        return true;
+    }
+
+    int Usage()
+    {
+        std::fputs("usage: ALDI.Cli [-k] [-j] [-c <command>]... <file> [script | -]\n", stderr);
+        return 2;
+    }
+}
+
+static int Run(const std::vector<std::wstring>& args)
+{
+    bool keepGoing = false;
+    bool json = false;
+    std::vector<std::wstring> commands;
+    std::vector<std::wstring> positional;
+
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        const std::wstring& a = args[i];
+
+        if (a == L"-k")
+            keepGoing = true;
+        else if (a == L"-j")
+            json = true;
+        else if (a == L"-c" && i + 1 < args.size())
+            commands.push_back(args[++i]);
+        else if (a.size() > 1 && a[0] == L'-')
+            return Usage();
+        else
+            positional.push_back(a);
+    }
+
+    if (positional.empty() || positional.size() > 2)
+        return Usage();
+
+    if (!open_file(positional[0]))
+    {
+        WriteText(stderr, positional[0]);
+        std::fputs(": cannot open file\n", stderr);
+        return 2;
+    }
+
+    std::FILE* script = nullptr;
+    if (positional.size() == 2 && positional[1] != L"-")
+    {
+        script = OpenScript(positional[1]);
+        if (!script)
+        {
+            WriteText(stderr, positional[1]);
+            std::fputs(": cannot open script\n", stderr);
+            return 2;
+        }
+    }
+    else if (positional.size() == 2 || commands.empty())
+    {
+        script = stdin;
+    }
+
+    // -c commands come first and count as lines 1..n.
+    std::vector<std::wstring> lines = commands;
+
+    if (script)
+    {
+        std::string line;
+        while (ReadLine(script, line))
+            lines.push_back(FromUtf8(line));
+
+        if (script != stdin)
+            std::fclose(script);
+    }
+
+    bool ok = true;
+    ExecScript(lines, json ? ResultFormat::Json : ResultFormat::Text,
+        [&](const ScriptStep& step)
+        {
+            const bool good = Emit(step, json);
+            ok = ok && good;
+            return good || keepGoing;
+        });
+
+    return ok ? 0 : 1;
+}
+
+// Arguments arrive as UTF-16 on Windows, where the narrow argv would be
+// in the ANSI code page, and as UTF-8 everywhere else.
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+{
+    // Text mode would turn every LF written back into CRLF.
+    _setmode(_fileno(stdout), _O_BINARY);
+    _setmode(_fileno(stderr), _O_BINARY);
+
+    return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char** argv)
+{
+    std::vector<std::wstring> args;
+    for (int i = 1; i < argc; ++i)
+        args.push_back(FromUtf8(argv[i]));
+
+    return Run(args);
+}
+#endif
@@ -24,7 +24,7 @@ namespace commands
         ::scroll_pages(delta);
     }
 
-    inline std::wstring render_main_view()
+    inline const std::wstring& render_main_view()
     {
         return ::render_main_view();
     }
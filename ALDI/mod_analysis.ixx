@@ -0,0 +1,973 @@
+export module mod_analysis;
+
+import mod_pe_utils;
+import mod_disasm;
+import mod_threadpool;
+
+import <string>;
+import <vector>;
+import <span>;
+import <cstddef>;
+import <cstdint>;
+import <algorithm>;
+import <map>;
+import <sstream>;
+import <chrono>;
+
+// Zydis include via vcpkg
+import "Zycore/Types.h";
+import "Zydis/Zydis.h";
+
+// ---------------------------------------------------------------------------
+// Control flow of one instruction, as far as the explorer cares.
+// ---------------------------------------------------------------------------
+export enum class FlowKind : std::uint8_t
+{
+    Normal,     // falls through
+    Call,       // falls through, target is a code start
+    CondJump,   // falls through and may branch
+    Jump,       // unconditional, no fall-through
+    Return,
+    Stop        // int3 / ud2 / hlt: no fall-through, no target
+};
+
+// ---------------------------------------------------------------------------
+// InstructionCache: decoded instructions as a structure of arrays,
+// sorted by RVA. 12 bytes per instruction, binary-searchable, and
+// nothing Zydis-sized is kept around.
+// ---------------------------------------------------------------------------
+export class InstructionCache
+{
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    // Target of calls/jumps with a static destination; kNoTarget otherwise.
+    static constexpr std::uint32_t kNoTarget = 0xFFFFFFFF;
+
+    struct Entry
+    {
+        std::uint32_t rva{};
+        std::uint8_t  length{};
+        std::uint16_t mnemonic{};
+        FlowKind      flow{};
+        std::uint32_t target{ kNoTarget };
+    };
+
+    [[nodiscard]] std::size_t size() const noexcept { return m_rva.size(); }
+    [[nodiscard]] bool empty() const noexcept { return m_rva.empty(); }
+
+    [[nodiscard]] std::uint32_t rva(std::size_t i) const noexcept { return m_rva[i]; }
+    [[nodiscard]] std::uint8_t length(std::size_t i) const noexcept { return m_length[i]; }
+    [[nodiscard]] std::uint16_t mnemonic(std::size_t i) const noexcept { return m_mnemonic[i]; }
+    [[nodiscard]] FlowKind flow(std::size_t i) const noexcept { return m_flow[i]; }
+    [[nodiscard]] std::uint32_t target(std::size_t i) const noexcept { return m_target[i]; }
+
+    [[nodiscard]] std::span<const std::uint32_t> rvas() const noexcept { return m_rva; }
+
+    // The arrays themselves, for saving and restoring a cache whole.
+    struct Columns
+    {
+        std::span<const std::uint32_t> rva;
+        std::span<const std::uint8_t>  length;
+        std::span<const std::uint16_t> mnemonic;
+        std::span<const FlowKind>      flow;
+        std::span<const std::uint32_t> target;
+    };
+
+    [[nodiscard]] Columns columns() const noexcept
+    {
+        return { m_rva, m_length, m_mnemonic, m_flow, m_target };
+    }
+
+    // Replace the contents; all columns must have the same length.
+    void assign(const Columns& c)
+    {
+        m_rva.assign(c.rva.begin(), c.rva.end());
+        m_length.assign(c.length.begin(), c.length.end());
+        m_mnemonic.assign(c.mnemonic.begin(), c.mnemonic.end());
+        m_flow.assign(c.flow.begin(), c.flow.end());
+        m_target.assign(c.target.begin(), c.target.end());
+    }
+
+    // First instruction starting at or after rva.
+    [[nodiscard]] std::size_t lower_bound(std::uint32_t rva) const noexcept
+    {
+        return static_cast<std::size_t>(
+            std::lower_bound(m_rva.begin(), m_rva.end(), rva) - m_rva.begin());
+    }
+
+    // Instruction starting exactly at rva, or npos.
+    [[nodiscard]] std::size_t find(std::uint32_t rva) const noexcept
+    {
+        const std::size_t i = lower_bound(rva);
+        return (i < m_rva.size() && m_rva[i] == rva) ? i : npos;
+    }
+
+    // Merge a batch of new instructions (any order) into the arrays.
+    void merge(std::vector<Entry>& batch)
+    {
+        if (batch.empty())
+            return;
+
+        std::sort(batch.begin(), batch.end(),
+            [](const Entry& a, const Entry& b) { return a.rva < b.rva; });
+
+        const std::size_t n = m_rva.size();
+        std::vector<std::uint32_t> rva;      rva.reserve(n + batch.size());
+        std::vector<std::uint8_t>  len;      len.reserve(n + batch.size());
+        std::vector<std::uint16_t> mnem;     mnem.reserve(n + batch.size());
+        std::vector<FlowKind>      flow;     flow.reserve(n + batch.size());
+        std::vector<std::uint32_t> target;   target.reserve(n + batch.size());
+
+        auto pushOld = [&](std::size_t i)
+            {
+                rva.push_back(m_rva[i]);
+                len.push_back(m_length[i]);
+                mnem.push_back(m_mnemonic[i]);
+                flow.push_back(m_flow[i]);
+                target.push_back(m_target[i]);
+            };
+
+        auto pushNew = [&](const Entry& e)
+            {
+                rva.push_back(e.rva);
+                len.push_back(e.length);
+                mnem.push_back(e.mnemonic);
+                flow.push_back(e.flow);
+                target.push_back(e.target);
+            };
+
+        std::size_t i = 0, j = 0;
+        while (i < n || j < batch.size())
+        {
+            if (j == batch.size() || (i < n && m_rva[i] < batch[j].rva))
+            {
+                pushOld(i++);
+            }
+            else if (i < n && m_rva[i] == batch[j].rva)
+            {
+                pushOld(i++);
+                ++j;
+            }
+            else
+            {
+                // Skip duplicates inside the batch as well.
+                if (rva.empty() || rva.back() != batch[j].rva)
+                    pushNew(batch[j]);
+                ++j;
+            }
+        }
+
+        m_rva = std::move(rva);
+        m_length = std::move(len);
+        m_mnemonic = std::move(mnem);
+        m_flow = std::move(flow);
+        m_target = std::move(target);
+    }
+
+    void reserve(std::size_t n)
+    {
+        m_rva.reserve(n);
+        m_length.reserve(n);
+        m_mnemonic.reserve(n);
+        m_flow.reserve(n);
+        m_target.reserve(n);
+    }
+
+    // Append one instruction; e.rva must be past the last one.
+    void push_back(const Entry& e)
+    {
+        m_rva.push_back(e.rva);
+        m_length.push_back(e.length);
+        m_mnemonic.push_back(e.mnemonic);
+        m_flow.push_back(e.flow);
+        m_target.push_back(e.target);
+    }
+
+    // Append instructions [from, other.size()) of other, which must
+    // all sort after ours.
+    void append(const InstructionCache& other, std::size_t from = 0)
+    {
+        auto tail = [from](auto& dst, const auto& src)
+            {
+                dst.insert(dst.end(), src.begin() + from, src.end());
+            };
+        tail(m_rva, other.m_rva);
+        tail(m_length, other.m_length);
+        tail(m_mnemonic, other.m_mnemonic);
+        tail(m_flow, other.m_flow);
+        tail(m_target, other.m_target);
+    }
+
+    // Replace instructions [first, last) with all of repl, which must
+    // fit between the neighbours.
+    void splice(std::size_t first, std::size_t last, const InstructionCache& repl)
+    {
+        auto put = [first, last](auto& dst, const auto& src)
+            {
+                dst.erase(dst.begin() + first, dst.begin() + last);
+                dst.insert(dst.begin() + first, src.begin(), src.end());
+            };
+        put(m_rva, repl.m_rva);
+        put(m_length, repl.m_length);
+        put(m_mnemonic, repl.m_mnemonic);
+        put(m_flow, repl.m_flow);
+        put(m_target, repl.m_target);
+    }
+
+    // Drop every instruction that overlaps [lo, hi).
+    void erase_range(std::uint32_t lo, std::uint32_t hi)
+    {
+        // Instructions are at most 15 bytes long.
+        std::size_t a = lower_bound(lo > 15 ? lo - 15 : 0);
+        while (a < m_rva.size() && m_rva[a] + m_length[a] <= lo)
+            ++a;
+
+        std::size_t b = lower_bound(hi);
+        if (a >= b)
+            return;
+
+        auto cut = [&](auto& v) { v.erase(v.begin() + a, v.begin() + b); };
+        cut(m_rva);
+        cut(m_length);
+        cut(m_mnemonic);
+        cut(m_flow);
+        cut(m_target);
+    }
+
+    void clear() noexcept
+    {
+        m_rva.clear();
+        m_length.clear();
+        m_mnemonic.clear();
+        m_flow.clear();
+        m_target.clear();
+    }
+
+private:
+    std::vector<std::uint32_t> m_rva;
+    std::vector<std::uint8_t>  m_length;
+    std::vector<std::uint16_t> m_mnemonic;
+    std::vector<FlowKind>      m_flow;
+    std::vector<std::uint32_t> m_target;
+};
+
+// ---------------------------------------------------------------------------
+// Flow classification shared by every decoder loop.
+// ---------------------------------------------------------------------------
+export FlowKind ClassifyFlow(const ZydisDecodedInstruction& inst) noexcept
+{
+    switch (inst.meta.category)
+    {
+    case ZYDIS_CATEGORY_CALL:       return FlowKind::Call;
+    case ZYDIS_CATEGORY_COND_BR:    return FlowKind::CondJump;
+    case ZYDIS_CATEGORY_UNCOND_BR:  return FlowKind::Jump;
+    case ZYDIS_CATEGORY_RET:        return FlowKind::Return;
+    default: break;
+    }
+
+    switch (inst.mnemonic)
+    {
+    case ZYDIS_MNEMONIC_INT3:
+    case ZYDIS_MNEMONIC_UD2:
+    case ZYDIS_MNEMONIC_HLT:
+        return FlowKind::Stop;
+    default:
+        return FlowKind::Normal;
+    }
+}
+
+// Absolute destination of a direct call/jump, if it has one.
+export bool BranchTarget(const ZydisDecodedInstruction& inst,
+    const ZydisDecodedOperand* ops,
+    std::uint64_t runtime,
+    std::uint64_t& out) noexcept
+{
+    if (inst.operand_count_visible == 0)
+        return false;
+
+    const ZydisDecodedOperand& op = ops[0];
+    if (op.type != ZYDIS_OPERAND_TYPE_IMMEDIATE || !op.imm.is_relative)
+        return false;
+
+    ZyanU64 abs{};
+    if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&inst, &op, runtime, &abs)))
+        return false;
+
+    out = abs;
+    return true;
+}
+
+// Same, from the raw immediate only: for decoders that skip operands.
+export bool RawBranchTarget(const ZydisDecodedInstruction& inst,
+    std::uint32_t rva,
+    std::uint32_t& out) noexcept
+{
+    if (!inst.raw.imm[0].is_relative)
+        return false;
+
+    const std::int64_t t = std::int64_t(rva) + inst.length + inst.raw.imm[0].value.s;
+    if (t < 0 || t >= 0xFFFFFFFF)
+        return false;
+
+    out = static_cast<std::uint32_t>(t);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Linear sweep of a whole code section.
+//
+// The section is cut into segments that are decoded in parallel,
+// each with its own decoder. A segment starts decoding at its first
+// byte, which may be the middle of an instruction; stitching walks
+// the segments in order and continues each one from the address
+// where the previous one ran off its end. x86 resynchronizes within
+// a few instructions, so that address is almost always a start the
+// segment already has; when it is not, that segment alone is decoded
+// again from there.
+// ---------------------------------------------------------------------------
+export struct SweepStats
+{
+    std::string   section;          // empty for raw blobs
+    std::uint32_t rva{};
+    std::size_t   bytes{};
+    std::size_t   instructions{};
+    std::size_t   undecodable{};    // bytes skipped one at a time
+    std::size_t   segments{};
+    std::size_t   resyncs{};        // segments decoded a second time
+    unsigned      threads{};
+    double        seconds{};
+
+    [[nodiscard]] double per_second() const noexcept
+    {
+        return seconds > 0 ? static_cast<double>(instructions) / seconds : 0.0;
+    }
+};
+
+export constexpr std::size_t kSweepSegment = std::size_t(1) << 20;
+
+// Decode from rva until an instruction starts at or past end. code
+// holds the region's bytes, code[0] being regionRva. Returns the
+// address decoding stopped at.
+static std::uint32_t SweepSegment(const ZydisDecoder& decoder,
+    std::span<const std::byte> code,
+    std::uint32_t regionRva,
+    std::uint32_t rva,
+    std::uint32_t end,
+    InstructionCache& out)
+{
+    ZydisDecoderContext ctx{};
+
+    while (rva < end)
+    {
+        const std::size_t at = rva - regionRva;
+
+        ZydisDecodedInstruction inst{};
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, &ctx,
+            code.data() + at, code.size() - at, &inst)))
+        {
+            ++rva;
+            continue;
+        }
+
+        InstructionCache::Entry e{};
+        e.rva = rva;
+        e.length = inst.length;
+        e.mnemonic = static_cast<std::uint16_t>(inst.mnemonic);
+        e.flow = ClassifyFlow(inst);
+
+        std::uint32_t target{};
+        if (e.flow != FlowKind::Normal && RawBranchTarget(inst, rva, target))
+            e.target = target;
+
+        out.push_back(e);
+        rva += inst.length;
+    }
+
+    return rva;
+}
+
+// The code section of data: .text, else the first executable section;
+// the whole file when it is not a PE. Empty if there is none. rva
+// receives the RVA of its first byte, name the section name.
+export std::span<const std::byte> CodeRegion(std::span<const std::byte> data,
+    const pe::Layout& layout,
+    std::uint32_t& rva,
+    std::string* name = nullptr)
+{
+    rva = 0;
+    std::span<const std::byte> code;
+
+    if (layout.valid)
+    {
+        const pe::Section* sec = layout.text();
+        if (!sec || !sec->executable())
+        {
+            sec = nullptr;
+            for (const auto& s : layout.sections)
+            {
+                if (s.executable())
+                {
+                    sec = &s;
+                    break;
+                }
+            }
+        }
+
+        if (!sec || sec->rawOffset >= data.size())
+            return code;
+
+        std::size_t n = std::min<std::size_t>(sec->rawSize, data.size() - sec->rawOffset);
+        if (sec->virtualSize)
+            n = std::min<std::size_t>(n, sec->virtualSize);
+
+        code = data.subspan(sec->rawOffset, n);
+        rva = sec->virtualAddress;
+        if (name)
+            *name = sec->name;
+    }
+    else
+    {
+        code = data.first(std::min<std::size_t>(data.size(), 0xFFFFFFFFu));
+    }
+
+    return code;
+}
+
+// Sweep the code section of data into index.
+export SweepStats LinearSweep(std::span<const std::byte> data,
+    const pe::Layout& layout,
+    InstructionCache& index)
+{
+    SweepStats st{};
+    const auto code = CodeRegion(data, layout, st.rva, &st.section);
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    auto& pool = GlobalPool();
+    const std::size_t segments = (code.size() + kSweepSegment - 1) / kSweepSegment;
+    const std::uint32_t regionEnd = st.rva + static_cast<std::uint32_t>(code.size());
+
+    auto segBegin = [&](std::size_t k) { return st.rva + static_cast<std::uint32_t>(k * kSweepSegment); };
+    auto segEnd = [&](std::size_t k) { return std::min(segBegin(k + 1), regionEnd); };
+
+    std::vector<InstructionCache> parts(segments);
+    std::vector<std::uint32_t>    exits(segments);
+
+    pool.parallel_for(segments, [&](std::size_t k)
+        {
+            JobCheckpoint();
+
+            ZydisDecoder decoder{};
+            InitDecoder(decoder, layout);
+
+            // About one instruction per four bytes of x86 code.
+            parts[k].reserve((segEnd(k) - segBegin(k)) / 4);
+            exits[k] = SweepSegment(decoder, code, st.rva, segBegin(k), segEnd(k), parts[k]);
+
+            JobBytes(segEnd(k) - segBegin(k));
+            JobInstructions(parts[k].size());
+        });
+
+    std::size_t total = 0;
+    for (const auto& p : parts)
+        total += p.size();
+
+    index.clear();
+    index.reserve(total);
+
+    ZydisDecoder decoder{};
+    InitDecoder(decoder, layout);
+
+    std::uint32_t expected = st.rva;
+    std::size_t covered = 0;
+
+    for (std::size_t k = 0; k < segments; ++k)
+    {
+        // The previous segment's last instruction ran over this one.
+        if (expected >= segEnd(k))
+        {
+            parts[k] = {};
+            continue;
+        }
+
+        std::size_t from = parts[k].find(expected);
+        if (from == InstructionCache::npos)
+        {
+            parts[k].clear();
+            exits[k] = SweepSegment(decoder, code, st.rva, expected, segEnd(k), parts[k]);
+            from = 0;
+            ++st.resyncs;
+        }
+
+        for (std::size_t i = from; i < parts[k].size(); ++i)
+            covered += parts[k].length(i);
+
+        index.append(parts[k], from);
+        expected = exits[k];
+        parts[k] = {};
+    }
+
+    const auto t1 = std::chrono::steady_clock::now();
+
+    st.bytes = code.size();
+    st.instructions = index.size();
+    st.undecodable = covered < code.size() ? code.size() - covered : 0;
+    st.segments = segments;
+    st.threads = pool.size();
+    st.seconds = std::chrono::duration<double>(t1 - t0).count();
+    return st;
+}
+
+// Bring a sweep index up to date after the bytes at RVAs [lo, hi)
+// changed. Decoding restarts where the old sweep stood before the
+// first touched instruction and runs until, past hi, it lands on a
+// start the old index has; only that stretch is replaced. The
+// replaced RVA range is returned in [outLo, outHi).
+export bool ResweepRange(std::span<const std::byte> data,
+    const pe::Layout& layout,
+    InstructionCache& index,
+    std::uint32_t lo,
+    std::uint32_t hi,
+    std::uint32_t& outLo,
+    std::uint32_t& outHi)
+{
+    std::uint32_t regionRva{};
+    const auto code = CodeRegion(data, layout, regionRva);
+    const std::uint32_t regionEnd = regionRva + static_cast<std::uint32_t>(code.size());
+
+    lo = std::max(lo, regionRva);
+    hi = std::min(hi, regionEnd);
+    if (code.empty() || lo >= hi)
+        return false;
+
+    // First old instruction that ends past lo; decoding stood at the
+    // end of the one before it.
+    std::size_t first = index.lower_bound(lo > 15 ? lo - 15 : 0);
+    while (first < index.size() && index.rva(first) + index.length(first) <= lo)
+        ++first;
+
+    std::uint32_t rva = first ? index.rva(first - 1) + index.length(first - 1) : regionRva;
+    const std::uint32_t start = rva;
+
+    ZydisDecoder decoder{};
+    InitDecoder(decoder, layout);
+
+    InstructionCache fresh;
+    while (rva < regionEnd && (rva < hi || index.find(rva) == InstructionCache::npos))
+    {
+        // One instruction at a time so the sync check sees every start.
+        const std::uint32_t next = SweepSegment(decoder, code, regionRva, rva, rva + 1, fresh);
+        rva = next;
+    }
+
+    index.splice(index.lower_bound(start), index.lower_bound(rva), fresh);
+
+    outLo = start;
+    outHi = rva;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// CodeAnalysis: recursive-descent explorer over one image.
+//
+// Starting from the entry point (and any other code start it is
+// given), it decodes forward, queues call and branch targets, and
+// stops at returns, unconditional jumps and traps. Everything it
+// decodes lands in the InstructionCache; formatted text is made on
+// first view and kept, so showing the same function again is a
+// lookup rather than a decode.
+// ---------------------------------------------------------------------------
+export class CodeAnalysis
+{
+public:
+    // Bind to an image. Drops all cached instructions and text.
+    // symbols, when given, names operands in formatted text and must
+    // outlive this binding.
+    void reset(std::span<const std::byte> data,
+        const pe::Layout& layout,
+        const pe::DataDirectories* symbols = nullptr)
+    {
+        m_data = data;
+        m_layout = layout;
+        m_symbols = symbols;
+        m_cache.clear();
+        m_text.clear();
+        m_seeded = false;
+
+        InitDecoder(m_decoder, layout);
+        ZydisFormatterInit(&m_formatter, ZYDIS_FORMATTER_STYLE_INTEL);
+        SymbolizeFormatter(m_formatter);
+    }
+
+    [[nodiscard]] const InstructionCache& cache() const noexcept
+    {
+        return m_cache;
+    }
+
+    // With following off, explore decodes only the straight-line run
+    // from each start. Listings come out the same; a short-lived
+    // analysis then does not walk the whole call graph behind them.
+    void follow_targets(bool on) noexcept
+    {
+        m_follow = on;
+    }
+
+    [[nodiscard]] const pe::Layout& layout() const noexcept
+    {
+        return m_layout;
+    }
+
+    // Image base for VAs; zero for raw blobs, where RVA == file offset.
+    [[nodiscard]] std::uint64_t image_base() const noexcept
+    {
+        return m_layout.valid ? m_layout.imageBase : 0;
+    }
+
+    [[nodiscard]] bool rva_to_file(std::uint32_t rva, std::size_t& out) const
+    {
+        if (!m_layout.valid)
+        {
+            out = rva;
+            return rva < m_data.size();
+        }
+        return pe::rva_to_file(m_layout, rva, out);
+    }
+
+    [[nodiscard]] bool file_to_rva(std::size_t off, std::uint32_t& out) const
+    {
+        if (!m_layout.valid)
+        {
+            out = static_cast<std::uint32_t>(off);
+            return off < m_data.size();
+        }
+        return pe::file_to_rva(m_layout, off, out);
+    }
+
+    // Take over instructions explored earlier for the same bytes
+    // (a saved project) instead of exploring from the entry point.
+    void restore(InstructionCache&& explored)
+    {
+        m_cache = std::move(explored);
+        m_seeded = true;
+    }
+
+    // Explore from the entry point once per image.
+    void seed()
+    {
+        if (m_seeded)
+            return;
+
+        m_seeded = true;
+        if (m_layout.valid && m_layout.entryRVA)
+        {
+            const std::uint32_t entry = m_layout.entryRVA;
+            explore({ &entry, 1 });
+        }
+    }
+
+    // Instructions between progress reports / cancellation checks.
+    static constexpr std::size_t kExploreStep = 4096;
+
+    // Recursive descent from every start; already-decoded code is
+    // not decoded again.
+    void explore(std::span<const std::uint32_t> starts)
+    {
+        std::vector<std::uint32_t> work(starts.begin(), starts.end());
+        std::vector<InstructionCache::Entry> batch;
+
+        // Instructions decoded by this call are marked in m_decoded and
+        // merged into the cache once at the end, so a large image costs
+        // one merge rather than one per function. The bitmap is sized
+        // once per image and only the bits of this call are cleared
+        // again, so exploring a small gap costs nothing per image byte.
+        const std::uint32_t limit = image_extent();
+        if (m_follow && m_decoded.size() != limit)
+            m_decoded.assign(limit, false);
+
+        auto known = [&](std::uint32_t rva)
+            {
+                return rva >= limit || (m_follow && m_decoded[rva]) ||
+                    m_cache.find(rva) != InstructionCache::npos;
+            };
+
+        auto release = [&]
+            {
+                if (m_follow)
+                {
+                    for (const auto& e : batch)
+                        m_decoded[e.rva] = false;
+                }
+            };
+
+        while (!work.empty())
+        {
+            std::uint32_t rva = work.back();
+            work.pop_back();
+
+            while (!known(rva))
+            {
+                InstructionCache::Entry e{};
+                if (!decode_at(rva, e))
+                    break;
+
+                if (m_follow && e.target != InstructionCache::kNoTarget && is_code(e.target))
+                    work.push_back(e.target);
+
+                batch.push_back(e);
+                if (m_follow)
+                    m_decoded[rva] = true;
+
+                // What was decoded so far is kept when cancelled.
+                if ((batch.size() & (kExploreStep - 1)) == 0)
+                {
+                    JobInstructions(kExploreStep);
+                    if (JobStopRequested())
+                    {
+                        release();
+                        m_cache.merge(batch);
+                        JobCheckpoint();
+                    }
+                }
+
+                if (e.flow == FlowKind::Jump || e.flow == FlowKind::Return || e.flow == FlowKind::Stop)
+                    break;
+
+                rva += e.length;
+            }
+        }
+
+        release();
+        m_cache.merge(batch);
+    }
+
+    // Branch targets are only followed into executable sections.
+    [[nodiscard]] bool is_code(std::uint32_t rva) const noexcept
+    {
+        if (!m_layout.valid)
+            return rva < m_data.size();
+
+        for (const auto& s : m_layout.sections)
+        {
+            const std::uint32_t span = s.virtualSize ? s.virtualSize : s.rawSize;
+            if (rva >= s.virtualAddress && rva - s.virtualAddress < span)
+                return s.executable();
+        }
+        return false;
+    }
+
+    // One past the highest RVA backed by the image.
+    [[nodiscard]] std::uint32_t image_extent() const noexcept
+    {
+        if (!m_layout.valid)
+            return static_cast<std::uint32_t>(std::min<std::size_t>(m_data.size(), 0xFFFFFFFFu));
+
+        std::uint64_t end = 0;
+        for (const auto& s : m_layout.sections)
+        {
+            const std::uint64_t span = std::max(s.virtualSize, s.rawSize);
+            end = std::max<std::uint64_t>(end, std::uint64_t(s.virtualAddress) + span);
+        }
+        return static_cast<std::uint32_t>(std::min<std::uint64_t>(end, 0xFFFFFFFFu));
+    }
+
+    // Formatted text of instruction i ("mov rax, [rip+0x10]").
+    // Decoded and formatted once, then served from the cache.
+    const std::wstring& text(std::size_t i)
+    {
+        return text_at(m_cache.rva(i));
+    }
+
+    // Same for any instruction start, explored or not.
+    const std::wstring& text_at(std::uint32_t rva)
+    {
+        auto it = m_text.find(rva);
+        if (it != m_text.end())
+            return it->second;
+
+        std::wstring ws = L"(bad)";
+
+        std::size_t off{};
+        ZydisDecodedInstruction inst{};
+        ZydisDecodedOperand     ops[ZYDIS_MAX_OPERAND_COUNT]{};
+
+        if (rva_to_file(rva, off) &&
+            ZYAN_SUCCESS(ZydisDecoderDecodeFull(&m_decoder,
+                m_data.data() + off, m_data.size() - off, &inst, ops)))
+        {
+            char buf[256]{};
+            ZydisFormatterFormatInstruction(&m_formatter, &inst, ops,
+                inst.operand_count_visible, buf, sizeof(buf),
+                image_base() + rva, const_cast<pe::DataDirectories*>(m_symbols));
+
+            const std::string_view sv(buf);
+            ws.assign(sv.begin(), sv.end());
+        }
+
+        return m_text.emplace(rva, std::move(ws)).first->second;
+    }
+
+    // Forget everything decoded from file bytes [off, off + len).
+    void invalidate(std::size_t off, std::size_t len)
+    {
+        std::uint32_t lo{}, hi{};
+        if (!file_to_rva(off, lo))
+            return;
+        if (!file_to_rva(off + len - 1, hi))
+            hi = lo + static_cast<std::uint32_t>(len - 1);
+
+        m_text.erase(m_text.lower_bound(lo > 15 ? lo - 15 : 0), m_text.upper_bound(hi));
+
+        m_cache.erase_range(lo, hi + 1);
+    }
+
+    // Decode the code at [fileOffset, fileOffset + size) into the
+    // cache and give back its RVA range for for_each. False when the
+    // range is empty or not in an executable section.
+    bool decode(std::size_t fileOffset, std::size_t size, std::uint32_t& rva, std::uint32_t& end)
+    {
+        const std::size_t max = std::min(fileOffset + size, m_data.size());
+        if (fileOffset >= m_data.size() || max <= fileOffset)
+            return false;
+
+        if (!file_to_rva(fileOffset, rva) || !is_code(rva))
+            return false;
+
+        end = rva + static_cast<std::uint32_t>(max - fileOffset);
+
+        // The gaps of the range are decoded straight through into one
+        // batch and merged once, however many there are; what they
+        // branch to is explored after that, again in one go.
+        std::vector<InstructionCache::Entry> batch;
+        std::vector<std::uint32_t> targets;
+
+        for (std::uint32_t at = rva; at < end;)
+        {
+            if (const std::size_t i = m_cache.find(at); i != InstructionCache::npos)
+            {
+                at += m_cache.length(i);
+                continue;
+            }
+
+            InstructionCache::Entry e{};
+            if (!decode_at(at, e))
+                break;
+
+            if (m_follow && e.target != InstructionCache::kNoTarget && is_code(e.target))
+                targets.push_back(e.target);
+
+            batch.push_back(e);
+            at += e.length;
+
+            if ((batch.size() & (kExploreStep - 1)) == 0)
+            {
+                JobInstructions(kExploreStep);
+                if (JobStopRequested())
+                {
+                    m_cache.merge(batch);
+                    JobCheckpoint();
+                }
+            }
+        }
+
+        m_cache.merge(batch);
+        if (!targets.empty())
+            explore(targets);
+
+        return true;
+    }
+
+    // Call fn(i) for each cached instruction of [rva, end) in listing
+    // order, stopping at the first gap. Decodes nothing.
+    template<typename Fn>
+    void for_each(std::uint32_t rva, std::uint32_t end, Fn&& fn) const
+    {
+        while (rva < end)
+        {
+            const std::size_t i = m_cache.find(rva);
+            if (i == InstructionCache::npos)
+                return;
+
+            fn(i);
+            rva += m_cache.length(i);
+        }
+    }
+
+    // Disassembly listing of [fileOffset, fileOffset + size), in the
+    // same shape DisasmRegion produces, served from the cache.
+    std::wstring listing(std::size_t fileOffset, std::size_t size)
+    {
+        const std::size_t max = std::min(fileOffset + size, m_data.size());
+        if (fileOffset >= m_data.size() || max <= fileOffset)
+            return L"(empty)\r\n";
+
+        std::wstringstream out;
+
+        if (!m_layout.valid)
+            out << L"(Not a PE or ELF file — linear disasm)\r\n\r\n";
+
+        std::uint32_t rva{}, end{};
+        if (!decode(fileOffset, size, rva, end))
+        {
+            out << L"(Offset 0x" << std::hex << fileOffset
+                << L" is not in an executable section)\r\n";
+            return out.str();
+        }
+
+        for_each(rva, end, [&](std::size_t i)
+            {
+                out << L"0x" << std::hex << (image_base() + m_cache.rva(i)) << L"  " << text(i) << L"\r\n";
+            });
+
+        return out.str();
+    }
+
+private:
+    // Decode the one instruction at rva, with its branch target
+    // when it has one inside the image's 4 GB.
+    bool decode_at(std::uint32_t rva, InstructionCache::Entry& e) const
+    {
+        std::size_t off{};
+        if (!rva_to_file(rva, off) || off >= m_data.size())
+            return false;
+
+        ZydisDecodedInstruction inst{};
+        ZydisDecodedOperand     ops[ZYDIS_MAX_OPERAND_COUNT]{};
+
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&m_decoder,
+            m_data.data() + off, m_data.size() - off, &inst, ops)))
+        {
+            return false;
+        }
+
+        e.rva = rva;
+        e.length = inst.length;
+        e.mnemonic = static_cast<std::uint16_t>(inst.mnemonic);
+        e.flow = ClassifyFlow(inst);
+
+        const std::uint64_t base = image_base();
+        std::uint64_t abs{};
+        if ((e.flow == FlowKind::Call || e.flow == FlowKind::Jump || e.flow == FlowKind::CondJump) &&
+            BranchTarget(inst, ops, base + rva, abs) &&
+            abs >= base && abs - base < 0xFFFFFFFFull)
+        {
+            e.target = static_cast<std::uint32_t>(abs - base);
+        }
+        return true;
+    }
+
+    std::span<const std::byte> m_data{};
+    pe::Layout                 m_layout{};
+    const pe::DataDirectories* m_symbols{};
+    bool                       m_seeded{};
+    bool                       m_follow{ true };
+
+    ZydisDecoder   m_decoder{};
+    ZydisFormatter m_formatter{};
+
+    InstructionCache                             m_cache;
+    std::map<std::uint32_t, std::wstring>        m_text;
+
+    // Scratch for explore(): one bit per RVA, all clear between calls.
+    std::vector<bool>                            m_decoded;
+};
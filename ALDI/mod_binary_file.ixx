@@ -1,4 +1,17 @@
-﻿export module mod_binary_file;
+﻿module;
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module mod_binary_file;
 
 import <string>;
 import <vector>;
@@ -7,74 +20,512 @@ import <cstddef>;
 import <cstdint>;
 import <fstream>;
 import <cstring>;
+import <utility>;
+import <map>;
+import <algorithm>;
+import <cstdio>;
+import <functional>;
+import <memory>;
+import <mutex>;
+import <filesystem>;
+import <system_error>;
 
-export class BinaryFile
+#ifndef _WIN32
+// Wide path → UTF-8, which is what POSIX file APIs take.
+static std::string Utf8Path(const std::wstring& path)
+{
+    std::string utf8;
+    for (std::size_t i = 0; i < path.size(); ++i)
+    {
+        char32_t c = static_cast<char32_t>(path[i]);
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < path.size())
+            c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<char32_t>(path[++i]) - 0xDC00);
+
+        if (c < 0x80)
+            utf8 += static_cast<char>(c);
+        else if (c < 0x800)
+            utf8 += { static_cast<char>(0xC0 | (c >> 6)), static_cast<char>(0x80 | (c & 0x3F)) };
+        else if (c < 0x10000)
+            utf8 += { static_cast<char>(0xE0 | (c >> 12)), static_cast<char>(0x80 | ((c >> 6) & 0x3F)),
+                static_cast<char>(0x80 | (c & 0x3F)) };
+        else
+            utf8 += { static_cast<char>(0xF0 | (c >> 18)), static_cast<char>(0x80 | ((c >> 12) & 0x3F)),
+                static_cast<char>(0x80 | ((c >> 6) & 0x3F)), static_cast<char>(0x80 | (c & 0x3F)) };
+    }
+    return utf8;
+}
+#endif
+
+// Streams, removal and renames by wide path, on every platform.
+export std::fstream OpenFileStream(const std::wstring& path, std::ios::openmode mode)
+{
+#ifdef _WIN32
+    return std::fstream(path, mode);
+#else
+    return std::fstream(Utf8Path(path), mode);
+#endif
+}
+
+export bool RemoveFile(const std::wstring& path)
+{
+#ifdef _WIN32
+    return _wremove(path.c_str()) == 0;
+#else
+    return std::remove(Utf8Path(path).c_str()) == 0;
+#endif
+}
+
+// Move from over to, replacing it; false when to was left as it was.
+export bool RenameFile(const std::wstring& from, const std::wstring& to)
+{
+#ifdef _WIN32
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(Utf8Path(from).c_str(), Utf8Path(to).c_str()) == 0;
+#endif
+}
+
+// ------------------------------------------------------------
+// FileSection: the OS mapping object of one file (a section on
+// Windows, the open descriptor elsewhere), shared by every view
+// of that file.
+//
+// Sections are reference counted and looked up by path, so
+// opening a file that is already open maps one more view of the
+// same section: no second open, nothing read again, and the
+// views share physical pages until one of them is written.
+// ------------------------------------------------------------
+
+class FileSection
 {
 public:
-    BinaryFile() = default;
+    FileSection() = default;
 
-    bool load(const std::wstring& path)
+    ~FileSection()
     {
-        clear();
+#ifdef _WIN32
+        if (m_mapping)
+            CloseHandle(m_mapping);
+#else
+        if (m_fd >= 0)
+            ::close(m_fd);
+#endif
+    }
+
+    FileSection(const FileSection&) = delete;
+    FileSection& operator=(const FileSection&) = delete;
+
+    // The section of path, shared with every view already open on it.
+    static std::shared_ptr<FileSection> open(const std::wstring& path)
+    {
+        std::error_code ec;
+        auto key = std::filesystem::weakly_canonical(path, ec).wstring();
+        if (ec)
+            key = path;
+
+        std::lock_guard lk(s_mutex);
+
+        if (auto it = s_sections.find(key); it != s_sections.end())
+        {
+            if (auto s = it->second.lock())
+                return s;
+            s_sections.erase(it);
+        }
+
+        auto s = std::make_shared<FileSection>();
+        if (!s->create(path))
+            return nullptr;
+
+        s_sections[key] = s;
+        return s;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // A private copy-on-write view of the whole file, or nullptr.
+    [[nodiscard]] std::byte* map_view() const
+    {
+        if (m_size == 0)
+            return nullptr;
 
 #ifdef _WIN32
-        std::ifstream f(path, std::ios::binary);
+        return static_cast<std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0));
 #else
-        // Convert UTF-16 → UTF-8 on non-Win platforms
-        std::string utf8(path.begin(), path.end());
-        std::ifstream f(utf8, std::ios::binary);
+        void* view = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+        return view == MAP_FAILED ? nullptr : static_cast<std::byte*>(view);
 #endif
+    }
 
-        if (!f)
+    void unmap_view(std::byte* view) const noexcept
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(view);
+#else
+        ::munmap(view, m_size);
+#endif
+    }
+
+private:
+    bool create(const std::wstring& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(path.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        if (file == INVALID_HANDLE_VALUE)
             return false;
 
-        f.seekg(0, std::ios::end);
-        auto pos = f.tellg();
-        if (pos < 0)
+        LARGE_INTEGER sz{};
+        if (!GetFileSizeEx(file, &sz))
+        {
+            CloseHandle(file);
             return false;
+        }
 
-        m_size = static_cast<std::size_t>(pos);
-        m_buffer.resize(m_size);
+        // Empty files cannot be mapped; they are simply empty views.
+        if (sz.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return true;
+        }
 
-        f.seekg(0, std::ios::beg);
-        if (!f.read(reinterpret_cast<char*>(m_buffer.data()),
-            static_cast<std::streamsize>(m_size)))
+        // The section keeps the file referenced after the handle is closed.
+        m_mapping = CreateFileMappingW(file, nullptr,
+            PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+
+        if (!m_mapping)
+            return false;
+
+        m_size = static_cast<std::size_t>(sz.QuadPart);
+#else
+        const std::string utf8 = Utf8Path(path);
+
+        int fd = ::open(utf8.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st{};
+        if (::fstat(fd, &st) != 0)
         {
-            clear();
+            ::close(fd);
             return false;
         }
 
+        m_fd = fd;
+        m_size = static_cast<std::size_t>(st.st_size);
+#endif
+        return true;
+    }
+
+#ifdef _WIN32
+    HANDLE      m_mapping{};
+#else
+    int         m_fd{ -1 };
+#endif
+    std::size_t m_size{};
+
+    static inline std::mutex                                         s_mutex;
+    static inline std::map<std::wstring, std::weak_ptr<FileSection>> s_sections;
+};
+
+// ------------------------------------------------------------
+// MappedFile: private copy-on-write view of a file on disk.
+//
+// Opening costs the same for 4 KB and 4 GB; pages are faulted
+// in only when something reads them. Writes through data()
+// land in private pages and never reach the file, nor any
+// other view of the same section.
+// ------------------------------------------------------------
+
+export class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { unmap(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& o) noexcept
+        : m_section(std::move(o.m_section))
+        , m_data(std::exchange(o.m_data, nullptr))
+        , m_size(std::exchange(o.m_size, 0))
+    {
+    }
+
+    MappedFile& operator=(MappedFile&& o) noexcept
+    {
+        if (this != &o)
+        {
+            unmap();
+            m_section = std::move(o.m_section);
+            m_data = std::exchange(o.m_data, nullptr);
+            m_size = std::exchange(o.m_size, 0);
+        }
+        return *this;
+    }
+
+    bool map(const std::wstring& path)
+    {
+        unmap();
+
+        auto section = FileSection::open(path);
+        if (!section)
+            return false;
+
+        if (section->size() != 0)
+        {
+            m_data = section->map_view();
+            if (!m_data)
+                return false;
+        }
+
+        m_size = section->size();
+        m_section = std::move(section);
+        return true;
+    }
+
+    void unmap() noexcept
+    {
+        if (m_data)
+            m_section->unmap_view(m_data);
+
+        m_section.reset();
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    [[nodiscard]] std::byte* data() const noexcept
+    {
+        return m_data;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // Views of this file's section, this one included.
+    [[nodiscard]] std::size_t views() const noexcept
+    {
+        return m_section ? static_cast<std::size_t>(m_section.use_count()) : 0;
+    }
+
+private:
+    std::shared_ptr<FileSection> m_section;
+    std::byte*                   m_data{};
+    std::size_t                  m_size{};
+};
+
+// How a commit ended. Only Written and Unchanged leave nothing
+// behind; the other two leave "<path>.journal" next to the file.
+export enum class CommitResult
+{
+    Written,        // staged bytes are on disk
+    Unchanged,      // nothing was written; the overlay stays for a retry
+    RollbackFailed, // partly written and not undone; the next load does that
+    JournalLeft,    // written, but the journal could not be retired
+};
+
+export class BinaryFile
+{
+public:
+    // Called with the byte range whenever staged bytes change
+    // (patch, undo, redo, revert), so derived caches can decide
+    // whether they are affected.
+    using ChangeListener = std::function<void(std::size_t offset, std::size_t length)>;
+
+    BinaryFile() = default;
+
+    bool load(const std::wstring& path)
+    {
+        clear();
+        recover(path);
+
+        if (!m_map.map(path))
+            return false;
+
+        m_size = m_map.size();
         m_path = path;
+        ++m_generation;
         return true;
     }
 
+    // Stage a patch in memory. Nothing reaches the file until commit().
     bool patch(std::size_t offset, const void* data, std::size_t len)
     {
-        if (!data || offset + len > m_size || m_path.empty())
+        if (!data || len == 0 || offset + len > m_size || m_path.empty())
             return false;
 
-        std::memcpy(m_buffer.data() + offset, data, len);
+        Edit e{};
+        e.offset = offset;
+        e.before.assign(m_map.data() + offset, m_map.data() + offset + len);
+        e.after.assign(static_cast<const std::byte*>(data),
+            static_cast<const std::byte*>(data) + len);
 
-#ifdef _WIN32
-        std::fstream f(m_path, std::ios::binary | std::ios::in | std::ios::out);
-#else
-        std::string utf8(m_path.begin(), m_path.end());
-        std::fstream f(utf8, std::ios::binary | std::ios::in | std::ios::out);
-#endif
+        apply(offset, e.after);
 
-        if (!f)
+        m_undo.push_back(std::move(e));
+        m_redo.clear();
+        return true;
+    }
+
+    bool undo()
+    {
+        if (m_undo.empty())
+            return false;
+
+        Edit e = std::move(m_undo.back());
+        m_undo.pop_back();
+
+        apply(e.offset, e.before);
+        m_redo.push_back(std::move(e));
+        return true;
+    }
+
+    bool redo()
+    {
+        if (m_redo.empty())
             return false;
 
-        f.seekp(static_cast<std::streamoff>(offset));
-        f.write(reinterpret_cast<const char*>(data),
-            static_cast<std::streamsize>(len));
+        Edit e = std::move(m_redo.back());
+        m_redo.pop_back();
+
+        apply(e.offset, e.after);
+        m_undo.push_back(std::move(e));
+        return true;
+    }
+
+    // Write every staged range back to disk through a single handle.
+    //
+    // The original bytes of each range go to "<path>.journal" first,
+    // so a failed or interrupted commit can be rolled back; load()
+    // does that when it finds one. On failure we restore the
+    // originals ourselves and keep the overlay, so the caller may
+    // retry.
+    //
+    // Refused while other views of the file are open: every page
+    // they have not written would show the new bytes without their
+    // listeners hearing of it.
+    CommitResult commit()
+    {
+        if (m_dirty.empty())
+            return CommitResult::Written;
+        if (views() > 1)
+            return CommitResult::Unchanged;
+
+        const std::wstring journal = m_path + L".journal";
+
+        if (!write_journal(journal))
+            return CommitResult::Unchanged;
+
+        auto f = OpenFileStream(m_path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!f)
+        {
+            RemoveFile(journal);
+            return CommitResult::Unchanged;
+        }
+
+        for (const auto& [off, orig] : m_dirty)
+        {
+            f.seekp(static_cast<std::streamoff>(off));
+            f.write(reinterpret_cast<const char*>(m_map.data() + off),
+                static_cast<std::streamsize>(orig.size()));
+
+            if (!f)
+                break;
+        }
+
+        f.flush();
+
+        if (!f)
+        {
+            f.clear();
+            for (const auto& [off, orig] : m_dirty)
+            {
+                f.seekp(static_cast<std::streamoff>(off));
+                f.write(reinterpret_cast<const char*>(orig.data()),
+                    static_cast<std::streamsize>(orig.size()));
+            }
+            f.flush();
+
+            // Only drop the journal if the rollback itself succeeded.
+            if (!f)
+                return CommitResult::RollbackFailed;
+            RemoveFile(journal);
+            return CommitResult::Unchanged;
+        }
+
+        f.close();
+        m_dirty.clear();
+
+        // The journal is emptied before it is removed: recover() drops
+        // an empty one untouched, so a journal that cannot be deleted
+        // no longer rolls this commit back on the next load.
+        const bool retired = OpenFileStream(journal, std::ios::binary | std::ios::out | std::ios::trunc).good();
+        if (!RemoveFile(journal) && !retired)
+            return CommitResult::JournalLeft;
+
+        return CommitResult::Written;
+    }
+
+    // Drop all staged ranges and restore the committed bytes.
+    void revert()
+    {
+        for (const auto& [off, orig] : m_dirty)
+        {
+            std::memcpy(m_map.data() + off, orig.data(), orig.size());
+            notify(off, orig.size());
+        }
 
-        return f.good();
+        m_dirty.clear();
+        m_undo.clear();
+        m_redo.clear();
+        ++m_generation;
+    }
+
+    [[nodiscard]] std::size_t pending_ranges() const noexcept
+    {
+        return m_dirty.size();
+    }
+
+    std::size_t subscribe(ChangeListener fn)
+    {
+        m_listeners.push_back({ ++m_nextListener, std::move(fn) });
+        return m_nextListener;
+    }
+
+    void unsubscribe(std::size_t id)
+    {
+        std::erase_if(m_listeners, [id](const auto& l) { return l.first == id; });
+    }
+
+    // Bumped whenever the visible bytes change, so caches built
+    // over bytes() can tell they are stale.
+    [[nodiscard]] std::uint64_t generation() const noexcept
+    {
+        return m_generation;
+    }
+
+    [[nodiscard]] bool can_undo() const noexcept
+    {
+        return !m_undo.empty();
+    }
+
+    [[nodiscard]] bool can_redo() const noexcept
+    {
+        return !m_redo.empty();
     }
 
     [[nodiscard]] std::span<const std::byte> bytes() const noexcept
     {
-        return m_buffer;
+        return { m_map.data(), m_size };
     }
 
     [[nodiscard]] std::size_t size() const noexcept
@@ -87,34 +538,278 @@ public:
         return m_path;
     }
 
+    // Open views of the same file on disk, this one included; they
+    // share pages until written.
+    [[nodiscard]] std::size_t views() const noexcept
+    {
+        return m_map.views();
+    }
+
     void clear() noexcept
     {
         m_path.clear();
-        m_buffer.clear();
-        m_buffer.shrink_to_fit();
+        m_map.unmap();
         m_size = 0;
+        m_dirty.clear();
+        m_undo.clear();
+        m_redo.clear();
+        ++m_generation;
     }
 
 private:
-    std::wstring           m_path{};
-    std::vector<std::byte> m_buffer{};
-    std::size_t            m_size{};
+    struct Edit
+    {
+        std::size_t            offset{};
+        std::vector<std::byte> before;
+        std::vector<std::byte> after;
+    };
+
+    // Write bytes into the view and fold the range into the overlay.
+    // Overlapping and adjacent ranges are coalesced; each range keeps
+    // the bytes that are on disk, whatever was staged on top of them.
+    void apply(std::size_t offset, std::span<const std::byte> bytes)
+    {
+        std::size_t lo = offset;
+        std::size_t hi = offset + bytes.size();
+
+        auto first = m_dirty.upper_bound(lo);
+        if (first != m_dirty.begin())
+        {
+            auto prev = std::prev(first);
+            if (prev->first + prev->second.size() >= lo)
+                first = prev;
+        }
+
+        auto last = first;
+        while (last != m_dirty.end() && last->first <= hi)
+        {
+            lo = (std::min)(lo, last->first);
+            hi = (std::max)(hi, last->first + last->second.size());
+            ++last;
+        }
+
+        std::vector<std::byte> orig(m_map.data() + lo, m_map.data() + hi);
+        for (auto it = first; it != last; ++it)
+        {
+            std::memcpy(orig.data() + (it->first - lo),
+                it->second.data(), it->second.size());
+        }
+
+        m_dirty.erase(first, last);
+        m_dirty.emplace(lo, std::move(orig));
+
+        std::memcpy(m_map.data() + offset, bytes.data(), bytes.size());
+        ++m_generation;
+
+        notify(offset, bytes.size());
+    }
+
+    void notify(std::size_t offset, std::size_t length) const
+    {
+        for (const auto& [id, fn] : m_listeners)
+            fn(offset, length);
+    }
+
+    // A journal left next to the file means a commit was cut short:
+    // write the original bytes back before the file is mapped. One
+    // that is incomplete itself was cut short before the file was
+    // touched, and an empty one belongs to a commit that finished;
+    // both just go. When the file cannot be written, the journal
+    // stays for the next load.
+    static void recover(const std::wstring& path)
+    {
+        const std::wstring journal = path + L".journal";
+
+        auto j = OpenFileStream(journal, std::ios::binary | std::ios::in);
+        if (!j)
+            return;
+
+        auto f = OpenFileStream(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!f)
+            return;
+
+        f.seekg(0, std::ios::end);
+        const auto size = static_cast<std::uint64_t>(f.tellg());
+
+        char magic[8]{};
+        std::uint64_t count{};
+        j.read(magic, sizeof(magic));
+        j.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+        std::vector<std::pair<std::uint64_t, std::vector<char>>> ranges;
+        bool complete = j.good() && std::memcmp(magic, "ALDIJRNL", 8) == 0;
+
+        for (std::uint64_t k = 0; complete && k < count; ++k)
+        {
+            std::uint64_t o{}, n{};
+            j.read(reinterpret_cast<char*>(&o), sizeof(o));
+            j.read(reinterpret_cast<char*>(&n), sizeof(n));
+            if (!j || o > size || n > size - o)
+            {
+                complete = false;
+                break;
+            }
+
+            std::vector<char> orig(static_cast<std::size_t>(n));
+            j.read(orig.data(), static_cast<std::streamsize>(n));
+            complete = j.good();
+            ranges.emplace_back(o, std::move(orig));
+        }
+        j.close();
+
+        if (complete)
+        {
+            for (const auto& [o, orig] : ranges)
+            {
+                f.seekp(static_cast<std::streamoff>(o));
+                f.write(orig.data(), static_cast<std::streamsize>(orig.size()));
+            }
+            f.flush();
+            if (!f)
+                return;
+        }
+
+        f.close();
+        RemoveFile(journal);
+    }
+
+    bool write_journal(const std::wstring& journal) const
+    {
+        auto j = OpenFileStream(journal, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!j)
+            return false;
+
+        const std::uint64_t count = m_dirty.size();
+        j.write("ALDIJRNL", 8);
+        j.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for (const auto& [off, orig] : m_dirty)
+        {
+            const std::uint64_t o = off;
+            const std::uint64_t n = orig.size();
+            j.write(reinterpret_cast<const char*>(&o), sizeof(o));
+            j.write(reinterpret_cast<const char*>(&n), sizeof(n));
+            j.write(reinterpret_cast<const char*>(orig.data()),
+                static_cast<std::streamsize>(n));
+        }
+
+        j.flush();
+        return j.good();
+    }
+
+    std::wstring  m_path{};
+    MappedFile    m_map{};
+    std::size_t   m_size{};
+    std::uint64_t m_generation{};
+
+    // Staged ranges: start offset → original on-disk bytes.
+    std::map<std::size_t, std::vector<std::byte>> m_dirty{};
+
+    std::vector<Edit> m_undo{};
+    std::vector<Edit> m_redo{};
+
+    std::vector<std::pair<std::size_t, ChangeListener>> m_listeners{};
+    std::size_t                                         m_nextListener{};
 };
 
 // ------------------------------------------------------------
-// Global instance + exports
+// Workspace: every open file, addressed by a handle that stays
+// the same until the file is closed. One of them is current, and
+// the Core* functions below work on that one.
 // ------------------------------------------------------------
 
-static BinaryFile g_file;
+export struct OpenFileInfo
+{
+    std::uint32_t handle{};
+    std::wstring  path;
+    std::size_t   size{};
+    std::size_t   pending{};    // staged ranges
+    std::size_t   views{};      // views of the same file, this one included
+};
+
+struct OpenFile
+{
+    std::uint32_t               handle{};
+    std::unique_ptr<BinaryFile> file;
+};
+
+static std::vector<OpenFile> g_files;
+static std::uint32_t         g_current = 0;     // 0: nothing open
+static std::uint32_t         g_lastHandle = 0;
+static BinaryFile            g_none;            // current when nothing is open
+
+static BinaryFile* FindFile(std::uint32_t handle)
+{
+    for (auto& f : g_files)
+    {
+        if (f.handle == handle)
+            return f.file.get();
+    }
+    return nullptr;
+}
+
+static BinaryFile& CurrentFile()
+{
+    BinaryFile* f = FindFile(g_current);
+    return f ? *f : g_none;
+}
 
 export BinaryFile& GetBinaryFile()
 {
-    return g_file;
+    return CurrentFile();
+}
+
+// Open path next to the files already open; the current file stays
+// current. 0 when the file cannot be mapped.
+export std::uint32_t CoreOpenFile(const std::wstring& path)
+{
+    auto file = std::make_unique<BinaryFile>();
+    if (!file->load(path))
+        return 0;
+
+    g_files.push_back({ ++g_lastHandle, std::move(file) });
+    return g_lastHandle;
+}
+
+export bool CoreSelectFile(std::uint32_t handle)
+{
+    if (!FindFile(handle))
+        return false;
+
+    g_current = handle;
+    return true;
+}
+
+// Unmap the file and drop its staged patches. Closing the current
+// file leaves nothing current.
+export bool CoreCloseFile(std::uint32_t handle)
+{
+    auto it = std::find_if(g_files.begin(), g_files.end(),
+        [handle](const OpenFile& f) { return f.handle == handle; });
+    if (it == g_files.end())
+        return false;
+
+    g_files.erase(it);
+    if (g_current == handle)
+        g_current = 0;
+    return true;
 }
 
-export bool CoreLoadFile(const std::wstring& path)
+export std::uint32_t CoreCurrentFile() noexcept
 {
-    return g_file.load(path);
+    return g_current;
+}
+
+export std::vector<OpenFileInfo> CoreFiles()
+{
+    std::vector<OpenFileInfo> out;
+    out.reserve(g_files.size());
+    for (const auto& f : g_files)
+    {
+        out.push_back({ f.handle, f.file->path(), f.file->size(),
+            f.file->pending_ranges(), f.file->views() });
+    }
+    return out;
 }
 
 export bool CorePatchFile(std::size_t offset,
@@ -123,20 +818,45 @@ export bool CorePatchFile(std::size_t offset,
     if (bytes.empty())
         return false;
 
-    return g_file.patch(offset, bytes.data(), bytes.size());
+    return CurrentFile().patch(offset, bytes.data(), bytes.size());
+}
+
+export CommitResult CoreCommit()
+{
+    return CurrentFile().commit();
+}
+
+export bool CoreUndo()
+{
+    return CurrentFile().undo();
+}
+
+export bool CoreRedo()
+{
+    return CurrentFile().redo();
+}
+
+export std::size_t CorePendingPatches() noexcept
+{
+    return CurrentFile().pending_ranges();
+}
+
+export std::uint64_t CoreGeneration() noexcept
+{
+    return CurrentFile().generation();
 }
 
 export std::span<const std::byte> CoreBytes() noexcept
 {
-    return g_file.bytes();
+    return CurrentFile().bytes();
 }
 
 export std::size_t CoreSize() noexcept
 {
-    return g_file.size();
+    return CurrentFile().size();
 }
 
 export const std::wstring& CorePath() noexcept
 {
-    return g_file.path();
+    return CurrentFile().path();
 }
@@ -4,6 +4,15 @@ import mod_binary_file;
 import mod_patterns;
 import mod_hex;
 import mod_disasm;
+import mod_pe_utils;
+import mod_analysis;
+import mod_xrefs;
+import mod_threadpool;
+import mod_project;
+import mod_strings;
+import mod_pattern_index;
+import mod_signature;
+import mod_diff;
 
 import <string>;
 import <vector>;
@@ -12,8 +21,20 @@ import <cstdint>;
 import <cstddef>;
 import <cwctype>;
 import <sstream>;
+import <iomanip>;
+import <fstream>;
 import <stdexcept>;
+import <cstring>;
 import <span>;
+import <memory>;
+import <functional>;
+import <string_view>;
+import <type_traits>;
+import <iterator>;
+import <cwchar>;
+import <regex>;
+import <chrono>;
+import <map>;
 
 // ============================================================
 // INTERNAL STATE (NOT EXPORTED)
@@ -21,18 +42,11 @@ import <span>;
 
 namespace state
 {
-    inline std::size_t page_offset = 0;
-
-    inline bool         have_last_find = false;
-    inline std::size_t  last_find_offset = 0;
-    export std::vector<unsigned char> last_pattern;
-
     struct Bookmark
     {
         std::size_t  offset{};
         std::wstring label{};
     };
-    export std::vector<Bookmark> bookmarks;
 
     struct Template
     {
@@ -40,7 +54,113 @@ namespace state
         std::size_t             offset{};
         std::vector<unsigned char> bytes;
     };
-    export std::vector<Template> templates;
+
+    // Everything known about one open file. Each file keeps its own
+    // session for as long as it is open, so switching files rebuilds
+    // and re-reads nothing.
+    struct Session
+    {
+        std::size_t page_offset = 0;
+
+        // PE model of the file: parsed once in open_file and again
+        // only after a patch lands inside the headers.
+        pe::Layout layout;
+        bool       layout_stale = true;
+
+        // Imports, exports, relocations and TLS of the PE; each
+        // table is parsed the first time something asks for it.
+        std::unique_ptr<pe::DataDirectories> dirs;
+
+        // Decoded code of the file. Built on first disasm, kept
+        // across commands, and trimmed by the patch listener.
+        CodeAnalysis analysis;
+        bool         analysis_stale = true;
+
+        // Last linear sweep of the code section: a binary index of every
+        // instruction in it. Empty when the file has no code section, so
+        // whether it was made at all is kept apart.
+        InstructionCache sweep;
+        SweepStats       sweep_stats;
+        bool             sweep_ready = false;
+
+        // Function table: .pdata when the file has one, otherwise guessed
+        // from prologues in the code section.
+        std::vector<pe::Function> functions;
+        bool                      functions_stale = true;
+        bool                      functions_guessed = false;
+
+        // References found in sweep; built on the first xrefs and kept in
+        // step with patches from then on.
+        XrefIndex xrefs;
+        bool      xrefs_ready = false;
+
+        bool         have_last_find = false;
+        std::size_t  last_find_offset = 0;
+        Pattern      last_pattern;
+
+        // Hits of last_pattern, a window of at most kFindWindow at a
+        // time: find_base hits come before it, and find_more says the
+        // scan stopped at the cap. Valid while the bytes are at
+        // find_generation; findnext walks this instead of rescanning.
+        std::vector<std::size_t> find_hits;
+        std::size_t              find_base = 0;
+        bool                     find_more = false;
+        std::uint64_t            find_generation = 0;
+
+        // Byte range the last find was limited to ([begin, end)).
+        std::size_t  find_begin = 0;
+        std::size_t  find_end = SIZE_MAX;
+        std::wstring find_scope;
+
+        // Trigram index over the file's bytes, built in the background
+        // by the index command; find and findnext ask it first.
+        PatternIndex pattern_index;
+
+        std::vector<Bookmark> bookmarks;
+        std::vector<Template> templates;
+
+        // Last findall: signature names by pattern id and the hit table.
+        std::vector<std::wstring> sig_names;
+        std::vector<PatternHit>   sig_hits;
+
+        // String table of the file, built on the first strings
+        // command and rebuilt after patches; the last query's matches.
+        StringTable            strings;
+        bool                   strings_stale = true;
+        double                 strings_seconds = 0;
+        std::vector<StringRef> string_matches;
+
+        // Project database of the file ("<file>.aldi"). Labels and
+        // templates are read from it on open; its caches are read when
+        // first needed, and only while project_current says the bytes
+        // still hash to what they were saved for.
+        std::unique_ptr<ProjectFile> project;
+        bool                         project_current = false;
+
+        // Newer build of the file for diff: mapped next to it with
+        // its own layout and function table, and the last diff of the two.
+        // A patch to the file drops the diff, not the image.
+        std::unique_ptr<BinaryFile>  diff_file;
+        pe::Layout                   diff_layout;
+        std::vector<pe::Function>    diff_functions;
+        std::unique_ptr<DiffResult>  diff;
+    };
+
+    // Sessions by workspace handle; handle 0 is the blank session used
+    // while no file is open. Sessions never move once created, so file
+    // can point at the current one.
+    inline std::map<std::uint32_t, Session> sessions;
+    inline Session*                         file = &sessions[0];
+
+    // Set on script workers (see ExecScript): their own decoder cache,
+    // and the state changes of their commands, kept to be applied in
+    // script order instead of as they happen.
+    struct WorkerContext
+    {
+        CodeAnalysis*                       analysis{};
+        std::vector<std::function<void()>>  effects;
+    };
+    inline thread_local WorkerContext* worker = nullptr;
 }
 
 // ============================================================
@@ -51,24 +171,96 @@ export enum class CommandResultKind
 {
     None,
     RefreshView,
-    ReplaceTextW
+    ReplaceTextW,
+
+    // Hex view over [offset, offset + size) of CoreBytes(); text is
+    // a caption. Rows are formatted by the viewer, not up front.
+    ShowBytes,
+
+    // Typed results: text is a caption and the payload fields below
+    // say what to show. FormatResult / FormatResultJson render them.
+    Instructions,   // codeBegin..codeEnd, from the code cache
+    Hits,           // hits (signature hits of the last findall)
+    Xrefs,          // xrefsTo / xrefsFrom of the RVA in offset
+    VTable,         // size slots at file offset offset
+    Strings         // strings (matches of the last strings query)
 };
 
 export struct CommandResult
 {
     CommandResultKind kind{ CommandResultKind::None };
     std::wstring      text{};
+    std::size_t       offset{};
+    std::size_t       size{};
+
+    // The command did not do what was asked (bad arguments, nothing
+    // found, I/O error); text says why. Scripts stop on it.
+    bool              failed{};
+
+    // Payloads of the typed kinds. They point into the current file's
+    // state and stay valid until the next command.
+    std::uint32_t               codeBegin{};
+    std::uint32_t               codeEnd{};
+    std::span<const PatternHit> hits{};
+    std::span<const Xref>       xrefsTo{};
+    std::span<const Xref>       xrefsFrom{};
+    std::span<const StringRef>  strings{};
 };
 
-export std::wstring render_main_view();
+export const std::wstring& render_main_view();
+export std::wstring render_status();
 export void         scroll_pages(int delta);
+export std::size_t  view_offset();
+export void         set_view_offset(std::size_t off);
 export bool         open_file(const std::wstring& path);
+export bool         switch_file(std::uint32_t handle);
+export bool         close_file(std::uint32_t handle);
 export CommandResult ExecCommand(const std::wstring& raw);
 
+// Commands that patch the current file's bytes, or map, switch or
+// close files. Anything that reads CoreBytes() on another thread
+// must not run alongside them.
+export bool ChangesFile(const std::wstring& raw);
+
+// Sinks call flush with the text so far whenever it grows past
+// kFormatChunk, then carry on with an empty buffer.
+export constexpr std::size_t kFormatChunk = std::size_t(64) * 1024;
+
+export void FormatResult(const CommandResult& r, std::wstring& out,
+    const std::function<void(std::wstring&)>& flush = {});
+export void FormatResultJson(const CommandResult& r, std::string& out,
+    const std::function<void(std::string&)>& flush = {});
+
+export enum class ResultFormat
+{
+    Text,   // FormatResult
+    Json    // FormatResultJson
+};
+
+// One command of a script and its rendered output.
+export struct ScriptStep
+{
+    std::size_t   line{};       // 1-based line number in the script
+    std::wstring  command;
+    CommandResult result;       // typed payloads are already rendered below
+    std::wstring  text;         // ResultFormat::Text
+    std::string   json;         // ResultFormat::Json
+};
+
+// Run a whole script. Steps are emitted in script order; emit returns
+// false to stop. Returns true when every command succeeded.
+export bool ExecScript(std::span<const std::wstring> lines, ResultFormat format,
+    const std::function<bool(const ScriptStep&)>& emit);
+
 // ============================================================
 // INTERNAL HELPERS
 // ============================================================
 
+static CommandResult Failure(std::wstring text)
+{
+    return { CommandResultKind::ReplaceTextW, std::move(text), 0, 0, true };
+}
+
 static std::wstring Trim(const std::wstring& s)
 {
     std::size_t a = 0, b = s.size();
@@ -113,7 +305,7 @@ static std::size_t ParseOffset(const std::wstring& s)
     if (t[0] == L'+' || t[0] == L'-')
     {
         long long d = std::stoll(t, nullptr, 0);
-        long long base = static_cast<long long>(state::page_offset);
+        long long base = static_cast<long long>(state::file->page_offset);
         long long v = base + d;
         if (v < 0) v = 0;
         return static_cast<std::size_t>(v);
@@ -122,313 +314,2345 @@ static std::size_t ParseOffset(const std::wstring& s)
     return static_cast<std::size_t>(std::stoull(t, nullptr, 0));
 }
 
-static std::wstring RenderFullPage()
+// Sections of the project database.
+static constexpr std::uint32_t kTagLabels = ProjectTag("LABL");
+static constexpr std::uint32_t kTagTemplates = ProjectTag("TMPL");
+static constexpr std::uint32_t kTagFunctions = ProjectTag("FUNC");
+static constexpr std::uint32_t kTagExplored = ProjectTag("CODE");
+static constexpr std::uint32_t kTagSweep = ProjectTag("SWEP");
+static constexpr std::uint32_t kTagXrefs = ProjectTag("XREF");
+
+static std::wstring ProjectPath()
 {
-    std::wstringstream o;
+    return CorePath() + L".aldi";
+}
 
-    o << L"File: " << CorePath() << L"\r\n";
-    o << L"Size: " << CoreSize() << L" bytes\r\n";
+// A saved cache, or an empty reader when there is none for these bytes.
+static SectionReader SavedCache(std::uint32_t tag)
+{
+    if (!state::file->project || !state::file->project_current)
+        return {};
+    return state::file->project->section(tag);
+}
 
-    constexpr std::size_t PAGE = 4096;
+static const pe::Layout& CurrentLayout()
+{
+    if (state::file->layout_stale)
+    {
+        state::file->layout = pe::analyze(CoreBytes());
+        state::file->layout_stale = false;
+    }
+    return state::file->layout;
+}
 
-    auto start = state::page_offset;
-    auto end = std::min(start + PAGE, CoreSize());
+// Data directories of the current PE, or nullptr for other files.
+static const pe::DataDirectories* CurrentDirectories()
+{
+    const auto& L = CurrentLayout();
+    if (!state::file->dirs && L.valid)
+        state::file->dirs = std::make_unique<pe::DataDirectories>(CoreBytes(), L);
+    return state::file->dirs.get();
+}
 
-    o << L"Page: " << start << L" - " << (end ? end - 1 : 0) << L"\r\n";
+// The explorer bound to the current bytes and layout; rebuilt only
+// after a reopen or a header patch.
+static CodeAnalysis& CurrentAnalysis()
+{
+    if (state::worker)
+        return *state::worker->analysis;
 
-    if (!state::bookmarks.empty())
+    const auto& L = CurrentLayout();
+    if (state::file->analysis_stale)
     {
-        o << L"\r\n[Bookmarks]\r\n";
-        for (const auto& b : state::bookmarks)
-            o << L"0x" << std::hex << b.offset << L"  " << b.label << L"\r\n";
-        o << L"\r\n";
-    }
+        state::file->analysis.reset(CoreBytes(), L, CurrentDirectories());
 
-    o << L"[Hex]\r\n";
-    o << HexPage(CoreBytes(), start, PAGE);
+        InstructionCache explored;
+        auto saved = SavedCache(kTagExplored);
+        if (!saved.empty() && GetInstructions(saved, explored))
+            state::file->analysis.restore(std::move(explored));
+        else
+            state::file->analysis.seed();
 
-    return o.str();
+        state::file->analysis_stale = false;
+    }
+    return state::file->analysis;
 }
 
-// ============================================================
-// PUBLIC API IMPLEMENTATION
-// ============================================================
-
-export std::wstring render_main_view()
+static std::span<const pe::Function> CurrentFunctions()
 {
-    return RenderFullPage();
+    if (state::file->functions_stale)
+    {
+        const auto bytes = CoreBytes();
+        const auto& L = CurrentLayout();
+
+        auto saved = SavedCache(kTagFunctions);
+        std::uint8_t guessed{};
+        if (!saved.empty() && saved.get(guessed) && GetFunctions(saved, state::file->functions))
+        {
+            state::file->functions_guessed = guessed != 0;
+            state::file->functions_stale = false;
+            return state::file->functions;
+        }
+
+        state::file->functions = pe::load_functions(bytes, L);
+        state::file->functions_guessed = state::file->functions.empty();
+
+        if (state::file->functions_guessed)
+        {
+            std::uint32_t rva{};
+            const auto code = CodeRegion(bytes, L, rva);
+            state::file->functions = pe::guess_functions(code, rva);
+        }
+
+        state::file->functions_stale = false;
+    }
+    return state::file->functions;
 }
 
-export void scroll_pages(int delta)
+// Sweep and xref index for the current bytes, built on first use.
+// Script workers only read them: ExecScript builds both before a
+// batch with xrefs in it starts.
+static const XrefIndex& CurrentXrefs()
 {
-    constexpr std::size_t PAGE = 4096;
+    if (!state::file->sweep_ready)
+    {
+        auto saved = SavedCache(kTagSweep);
+        if (saved.empty() || !GetSweepStats(saved, state::file->sweep_stats) ||
+            !GetInstructions(saved, state::file->sweep))
+        {
+            state::file->sweep_stats = LinearSweep(CoreBytes(), CurrentLayout(), state::file->sweep);
+        }
+        state::file->sweep_ready = true;
+        state::file->xrefs_ready = false;
+    }
 
-    if (delta > 0)
+    if (!state::file->xrefs_ready)
     {
-        state::page_offset =
-            std::min(state::page_offset + PAGE, CoreSize());
+        auto saved = SavedCache(kTagXrefs);
+        if (saved.empty() || !GetXrefs(saved, state::file->xrefs))
+            state::file->xrefs.build(CoreBytes(), CurrentLayout(), state::file->sweep);
+        state::file->xrefs_ready = true;
     }
-    else if (delta < 0)
+
+    return state::file->xrefs;
+}
+
+// String table of the current bytes, built on first use.
+static const StringTable& CurrentStrings()
+{
+    if (state::file->strings_stale)
     {
-        if (state::page_offset >= PAGE)
-            state::page_offset -= PAGE;
-        else
-            state::page_offset = 0;
+        const auto t0 = std::chrono::steady_clock::now();
+        state::file->strings.build(CoreBytes(), CurrentLayout());
+        state::file->strings_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        state::file->strings_stale = false;
     }
+    return state::file->strings;
 }
 
-export bool open_file(const std::wstring& path)
+// Patched bytes [off, off + len): re-sweep just the instructions they
+// touch and re-index the references of those.
+static void UpdateCodeIndexes(std::size_t off, std::size_t len)
 {
-    if (!CoreLoadFile(path))
-        return false;
+    if (!state::file->sweep_ready || state::file->sweep.empty())
+        return;
 
-    state::page_offset = 0;
-    state::have_last_find = false;
-    state::last_pattern.clear();
-    state::bookmarks.clear();
-    state::templates.clear();
-    return true;
-}
+    const auto& L = CurrentLayout();
 
-// ============================================================
-// COMMAND EXECUTION
-// ============================================================
+    // A raw blob is swept only up to 4 GB (see CodeRegion): a patch
+    // past that touches nothing indexed, one across it only its part
+    // below. The end is worked out in 64 bits for the same reason.
+    if (!L.valid && off >= 0xFFFFFFFFull)
+        return;
 
-export CommandResult ExecCommand(const std::wstring& raw)
+    std::uint32_t lo = static_cast<std::uint32_t>(off);
+    if (L.valid && !pe::file_to_rva(L, off, lo))
+        return;
+
+    const auto hi = static_cast<std::uint32_t>((std::min)(std::uint64_t(lo) + len, std::uint64_t(0xFFFFFFFF)));
+
+    std::uint32_t a{}, b{};
+    if (!ResweepRange(CoreBytes(), L, state::file->sweep, lo, hi, a, b))
+        return;
+
+    if (state::file->xrefs_ready)
+        state::file->xrefs.update(CoreBytes(), L, state::file->sweep, a, b);
+}
+
+// Labels and templates come back whatever happened to the file
+// since they were saved; the caches only when it is the same bytes.
+static void LoadProject()
 {
-    std::wstring line = Trim(raw);
-    if (line.empty())
-        return {};
+    auto project = std::make_unique<ProjectFile>();
+    if (!project->open(ProjectPath()))
+        return;
 
-    auto tok = SplitWS(line);
-    if (tok.empty())
-        return {};
+    state::file->project_current = project->file_size() == CoreSize() &&
+        project->file_hash() == ContentHash(CoreBytes());
 
-    std::wstring cmd = tok[0];
-    std::transform(cmd.begin(), cmd.end(), cmd.begin(),
-        [](wchar_t c) { return std::towlower(c); });
+    auto labels = project->section(kTagLabels);
+    std::uint64_t count{};
+    labels.get(count);
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+        std::uint64_t off{};
+        std::wstring  label;
+        if (!labels.get(off) || !labels.get_string(label))
+            break;
+        state::file->bookmarks.push_back({ static_cast<std::size_t>(off), std::move(label) });
+    }
 
-    try
+    auto templates = project->section(kTagTemplates);
+    count = 0;
+    templates.get(count);
+    for (std::uint64_t i = 0; i < count; ++i)
     {
-        // -----------------------------------------------------
-        // Navigation: prev / next / scroll
-        // -----------------------------------------------------
-        if (cmd == L"prev")
-        {
-            scroll_pages(-1);
-            return { CommandResultKind::RefreshView, {} };
-        }
+        state::Template t;
+        std::uint64_t   off{};
+        if (!templates.get_string(t.name) || !templates.get(off) || !templates.get_array(t.bytes))
+            break;
+        t.offset = static_cast<std::size_t>(off);
+        state::file->templates.push_back(std::move(t));
+    }
 
-        if (cmd == L"next")
-        {
-            scroll_pages(+1);
-            return { CommandResultKind::RefreshView, {} };
-        }
+    state::file->project = std::move(project);
+}
 
-        if (cmd == L"scroll")
+// Write everything known about the file to its project database.
+// Caches still waiting in the old database are read in first, as it
+// is about to be replaced.
+static bool SaveProject()
+{
+    if (state::file->project_current)
+    {
+        if (state::file->project->has(kTagFunctions))
+            CurrentFunctions();
+        if (state::file->project->has(kTagExplored))
+            CurrentAnalysis();
+        if (state::file->project->has(kTagXrefs))
+            CurrentXrefs();
+        else if (state::file->project->has(kTagSweep) && !state::file->sweep_ready)
         {
-            if (tok.size() < 2) return {};
-            scroll_pages(tok[1] == L"+" ? +1 : -1);
-            return { CommandResultKind::RefreshView, {} };
+            auto saved = SavedCache(kTagSweep);
+            if (GetSweepStats(saved, state::file->sweep_stats) && GetInstructions(saved, state::file->sweep))
+                state::file->sweep_ready = true;
+            else
+                state::file->sweep.clear();
         }
+    }
 
-        // -----------------------------------------------------
-        // goto
-        // -----------------------------------------------------
-        if (cmd == L"goto")
-        {
-            if (tok.size() < 2) return {};
-            auto off = ParseOffset(tok[1]);
+    const std::uint64_t hash = state::file->project_current
+        ? state::file->project->file_hash()
+        : ContentHash(CoreBytes());
+    state::file->project.reset();
 
-            constexpr std::size_t PAGE = 4096;
-            state::page_offset = (off / PAGE) * PAGE;
+    ProjectWriter w;
+    if (!w.open(ProjectPath(), CoreSize(), hash))
+        return false;
 
-            return { CommandResultKind::RefreshView, {} };
-        }
+    w.begin(kTagLabels);
+    w.put(std::uint64_t(state::file->bookmarks.size()));
+    for (const auto& b : state::file->bookmarks)
+    {
+        w.put(std::uint64_t(b.offset));
+        w.put_string(b.label);
+    }
 
-        // -----------------------------------------------------
-        // dump
-        // -----------------------------------------------------
-        if (cmd == L"dump")
-        {
-            if (tok.size() < 3) return {};
+    w.begin(kTagTemplates);
+    w.put(std::uint64_t(state::file->templates.size()));
+    for (const auto& t : state::file->templates)
+    {
+        w.put_string(t.name);
+        w.put(std::uint64_t(t.offset));
+        w.put_array<unsigned char>(t.bytes);
+    }
 
-            auto off = ParseOffset(tok[1]);
-            auto sz = std::stoull(tok[2], nullptr, 0);
+    if (!state::file->functions_stale)
+    {
+        w.begin(kTagFunctions);
+        w.put(std::uint8_t(state::file->functions_guessed));
+        w.put_array<pe::Function>(state::file->functions);
+    }
 
-            auto txt = HexDumpRegion(CoreBytes(), off, sz);
-            return { CommandResultKind::ReplaceTextW, txt };
-        }
+    if (!state::file->analysis_stale && !state::file->analysis.cache().empty())
+    {
+        w.begin(kTagExplored);
+        PutInstructions(w, state::file->analysis.cache());
+    }
 
-        // -----------------------------------------------------
-        // disasm
-        // -----------------------------------------------------
-        if (cmd == L"disasm")
-        {
-            if (tok.size() < 3) return {};
+    if (!state::file->sweep.empty())
+    {
+        w.begin(kTagSweep);
+        PutSweepStats(w, state::file->sweep_stats);
+        PutInstructions(w, state::file->sweep);
+    }
 
-            auto off = ParseOffset(tok[1]);
-            auto sz = std::stoull(tok[2], nullptr, 0);
+    if (state::file->xrefs_ready)
+    {
+        w.begin(kTagXrefs);
+        PutXrefs(w, state::file->xrefs);
+    }
 
-            auto txt = DisasmRegion(CoreBytes(), off, sz, 0);
-            return { CommandResultKind::ReplaceTextW, txt };
-        }
+    // A failed save leaves the old database; keep using it.
+    const bool saved = w.finish();
 
-        // -----------------------------------------------------
-        // vft
-        // -----------------------------------------------------
-        if (cmd == L"vft")
-        {
-            if (tok.size() < 3) return {};
+    auto project = std::make_unique<ProjectFile>();
+    if (project->open(ProjectPath()))
+    {
+        state::file->project = std::move(project);
+        state::file->project_current = saved ||
+            (state::file->project->file_size() == CoreSize() && state::file->project->file_hash() == hash);
+    }
+    return saved;
+}
 
-            auto off = ParseOffset(tok[1]);
-            auto cnt = std::stoull(tok[2], nullptr, 0);
+// An address as typed: a VA when it is at or above the image base,
+// otherwise a file offset.
+static bool ParseAddressRva(const std::wstring& s, std::uint32_t& rva)
+{
+    const auto v = ParseOffset(s);
+    const auto& L = CurrentLayout();
 
-            auto txt = DisasmVFT(CoreBytes(), off, cnt, 0);
-            return { CommandResultKind::ReplaceTextW, txt };
-        }
+    // RVAs are 32-bit; anything further out is no address in the image.
+    if (!L.valid)
+    {
+        if (v >= CoreSize() || v > 0xFFFFFFFFull)
+            return false;
+        rva = static_cast<std::uint32_t>(v);
+        return true;
+    }
 
-        // -----------------------------------------------------
-        // find
-        // -----------------------------------------------------
-        if (cmd == L"find")
-        {
-            if (tok.size() < 2) return {};
+    if (v >= L.imageBase)
+    {
+        if (v - L.imageBase > 0xFFFFFFFFull)
+            return false;
+        rva = static_cast<std::uint32_t>(v - L.imageBase);
+        return true;
+    }
 
-            auto pos = line.find(tok[1]);
-            auto hex = line.substr(pos);
-            auto pat = ParseHexBytes(hex);
+    return pe::file_to_rva(L, v, rva);
+}
 
-            auto hit = FindPattern(CoreBytes(), pat, 0);
+// Scope for find, given as its first token:
+//   @.text            one section (PE only)
+//   @0x1000:0x8000    file offsets [begin, end)
+static bool ParseFindScope(const std::wstring& t,
+    std::size_t& begin,
+    std::size_t& end)
+{
+    if (t.size() < 2 || t[0] != L'@')
+        return false;
 
-            if (hit != SIZE_MAX)
-            {
-                state::last_pattern = pat;
-                state::last_find_offset = hit;
-                state::have_last_find = true;
+    auto spec = t.substr(1);
 
-                constexpr std::size_t PAGE = 4096;
-                state::page_offset = (hit / PAGE) * PAGE;
+    auto colon = spec.find(L':');
+    if (colon != std::wstring::npos)
+    {
+        begin = ParseOffset(spec.substr(0, colon));
+        end = ParseOffset(spec.substr(colon + 1));
+        return begin < end;
+    }
 
-                return { CommandResultKind::RefreshView, {} };
-            }
+    const auto& L = CurrentLayout();
+    const auto* sec = pe::find_section(L, std::string(spec.begin(), spec.end()));
+    if (!sec)
+        return false;
 
-            return { CommandResultKind::ReplaceTextW, L"(not found)\r\n" };
-        }
+    begin = sec->rawOffset;
+    end = static_cast<std::size_t>(sec->rawOffset) + sec->rawSize;
+    return true;
+}
 
-        // -----------------------------------------------------
-        // findnext
-        // -----------------------------------------------------
-        if (cmd == L"findnext")
-        {
-            if (!state::have_last_find) return {};
+// Signature file: one signature per line, "name = pattern" or just
+// "pattern" (named by line number). '#' and ';' start comments.
+static bool LoadSignatures(const std::wstring& path,
+    PatternSet& set,
+    std::vector<std::wstring>& names)
+{
+    auto f = OpenFileStream(path, std::ios::in);
+    if (!f)
+        return false;
 
-            auto hit = FindPattern(
-                CoreBytes(),
-                state::last_pattern,
-                state::last_find_offset + 1
-            );
+    std::string raw;
+    std::size_t lineNo = 0;
 
-            if (hit != SIZE_MAX)
-            {
-                state::last_find_offset = hit;
+    while (std::getline(f, raw))
+    {
+        ++lineNo;
 
-                constexpr std::size_t PAGE = 4096;
-                state::page_offset = (hit / PAGE) * PAGE;
+        std::wstring line = Trim(std::wstring(raw.begin(), raw.end()));
+        if (line.empty() || line[0] == L'#' || line[0] == L';')
+            continue;
 
-                return { CommandResultKind::RefreshView, {} };
-            }
+        std::wstring name = L"line " + std::to_wstring(lineNo);
+        std::wstring body = line;
 
-            return { CommandResultKind::ReplaceTextW, L"(not found)\r\n" };
+        auto sep = line.find_first_of(L"=:");
+        if (sep != std::wstring::npos)
+        {
+            name = Trim(line.substr(0, sep));
+            body = line.substr(sep + 1);
         }
 
-        // -----------------------------------------------------
-        // patch
-        // -----------------------------------------------------
-        if (cmd == L"patch")
-        {
-            if (tok.size() < 3) return {};
+        auto pat = ParsePattern(body);
+        if (pat.empty())
+            continue;
 
-            auto off = ParseOffset(tok[1]);
-            auto pos = line.find(tok[2]);
-            auto hex = line.substr(pos);
-            auto bytes = ParseHexBytes(hex);
+        set.add(std::move(pat));
+        names.push_back(std::move(name));
+    }
 
-            CorePatchFile(off, bytes);
-            return { CommandResultKind::RefreshView, {} };
-        }
+    return true;
+}
 
-        // -----------------------------------------------------
-        // savetpl
-        // -----------------------------------------------------
-        if (cmd == L"savetpl")
-        {
-            if (tok.size() < 4) return {};
+static std::wstring RenderHitPage(std::size_t page)
+{
+    constexpr std::size_t ROWS = 256;
 
-            const auto& name = tok[1];
-            auto        off = ParseOffset(tok[2]);
+    const auto& hits = state::file->sig_hits;
+    const std::size_t pages = (hits.size() + ROWS - 1) / ROWS;
 
-            auto pos = line.find(tok[3]);
-            auto hex = line.substr(pos);
-            auto bytes = ParseHexBytes(hex);
+    std::wstringstream o;
+    o << L"[Hits] " << hits.size() << L" total, page "
+        << page << L"/" << (pages ? pages - 1 : 0) << L"\r\n\r\n";
 
-            auto it = std::find_if(
-                state::templates.begin(),
-                state::templates.end(),
-                [&](const state::Template& t) { return t.name == name; }
-            );
+    const std::size_t a = page * ROWS;
+    const std::size_t b = (std::min)(a + ROWS, hits.size());
 
-            if (it != state::templates.end())
-            {
-                it->offset = off;
-                it->bytes = bytes;
-            }
-            else
-            {
-                state::templates.push_back({ name, off, bytes });
-            }
+    for (std::size_t i = a; i < b; ++i)
+    {
+        o << L"0x" << std::hex << hits[i].offset << std::dec
+            << L"  " << state::file->sig_names[hits[i].pattern] << L"\r\n";
+    }
 
-            return {};
-        }
+    return o.str();
+}
 
-        // -----------------------------------------------------
-        // applytpl
-        // -----------------------------------------------------
-        if (cmd == L"applytpl")
-        {
-            if (tok.size() < 2) return {};
+// Jumps land on the hex row holding the target, not on a 4 KB page.
+static std::size_t RowAlign(std::size_t off)
+{
+    return off - off % kHexRowBytes;
+}
 
-            const auto& name = tok[1];
+// find keeps this many hits at a time, so a pattern that matches all
+// over a large file does not hold one offset per match.
+static constexpr std::size_t kFindWindow = std::size_t(1) << 16;
 
-            auto it = std::find_if(
-                state::templates.begin(),
-                state::templates.end(),
+// The next window of the last find's hits: those from offset from on,
+// base of them before it.
+static void LoadFindWindow(std::size_t from, std::size_t base)
+{
+    auto& F = *state::file;
+    const auto bytes = CoreBytes();
+    const std::size_t end = (std::min)(F.find_end, bytes.size());
+
+    F.find_hits = FindPatternAll(bytes.first(end), F.last_pattern, from, F.pattern_index, kFindWindow);
+    F.find_base = base;
+    F.find_more = F.find_hits.size() == kFindWindow;
+    F.find_generation = CoreGeneration();
+}
+
+// One line on the pattern index: how far the build got and what
+// it costs.
+static std::wstring DescribeIndex(const PatternIndex::Stats& s)
+{
+    std::wstringstream o;
+    o << std::fixed << std::setprecision(1);
+
+    switch (s.status)
+    {
+    case PatternIndex::Status::Off:
+        o << L"off";
+        break;
+    case PatternIndex::Status::Building:
+        o << L"building (budget " << (s.budget >> 20) << L" MB)";
+        break;
+    case PatternIndex::Status::Unavailable:
+        o << L"unavailable (file size or budget out of range)";
+        break;
+    case PatternIndex::Status::Ready:
+        o << L"ready, " << s.memory / 1048576.0 << L" MB, " << s.buckets << L" buckets";
+        if (s.droppedBuckets)
+            o << L" (" << s.droppedBuckets << L" left out, " << s.droppedPositions << L" positions)";
+        o << L", built in " << s.seconds * 1000.0 << L" ms";
+        if (s.patches)
+            o << L"; " << s.patches << L" patched range(s) scanned linearly";
+        break;
+    }
+
+    return o.str();
+}
+
+// Report of the last diff: totals, the functions that changed, and
+// where each template lands in the newer build.
+static std::wstring DescribeDiff()
+{
+    constexpr std::size_t kChangedRows = 32;
+
+    const auto& d = *state::file->diff;
+    const auto& L = CurrentLayout();
+    const auto& N = state::file->diff_layout;
+    auto count = [&](DiffStatus s) { return d.count[static_cast<std::size_t>(s)]; };
+
+    std::wstringstream o;
+    o << L"[Diff] " << CorePath() << L" -> " << state::file->diff_file->path() << L"\r\n";
+    o << L"Functions: " << count(DiffStatus::Unchanged) << L" unchanged, "
+        << count(DiffStatus::Moved) << L" moved, "
+        << count(DiffStatus::Changed) << L" changed, "
+        << count(DiffStatus::Removed) << L" removed, "
+        << count(DiffStatus::Added) << L" added\r\n";
+    o << L"Bytes:     " << d.unchangedBytes << L" in place, "
+        << d.movedBytes << L" moved in " << d.movedRanges << L" range(s), "
+        << d.oldChangedBytes << L" old / " << d.newChangedBytes << L" new changed\r\n";
+    o << std::fixed << std::setprecision(1)
+        << L"Time:      " << d.seconds * 1000.0 << L" ms on " << d.threads << L" threads\r\n";
+
+    if (count(DiffStatus::Changed))
+    {
+        o << L"\r\nChanged functions:\r\n" << std::hex;
+
+        std::size_t shown = 0;
+        for (const auto& m : d.functions)
+        {
+            if (m.status != DiffStatus::Changed)
+                continue;
+            if (shown++ == kChangedRows)
+            {
+                o << L"  ...\r\n";
+                break;
+            }
+
+            o << L"  0x" << (L.imageBase + m.oldRva) << L" -> 0x" << (N.imageBase + m.newRva)
+                << std::dec << L"  " << m.oldSize << L" -> " << m.newSize << L" bytes\r\n" << std::hex;
+        }
+        o << std::dec;
+    }
+
+    if (!state::file->templates.empty())
+    {
+        o << L"\r\nTemplates:\r\n";
+        for (const auto& t : state::file->templates)
+        {
+            o << L"  " << t.name << L"  0x" << std::hex << t.offset << L" -> ";
+
+            const auto r = RemapOffset(d, L, N, t.offset);
+            if (!r)
+            {
+                o << L"(lost)" << std::dec << L"\r\n";
+                continue;
+            }
+
+            o << L"0x" << r->offset << std::dec << L"  " << DiffStatusName(r->status)
+                << (r->aligned ? L", same bytes" : L", placed by function; check before applying")
+                << L"\r\n";
+        }
+    }
+
+    return o.str();
+}
+
+// Everything above the hex rows: file, page, find, bookmarks.
+static std::wstring RenderStatus()
+{
+    std::wstringstream o;
+
+    o << L"File: " << CorePath();
+    if (const auto files = CoreFiles(); files.size() > 1)
+        o << L" (file " << CoreCurrentFile() << L", " << files.size() << L" open)";
+    o << L"\r\n";
+    o << L"Size: " << CoreSize() << L" bytes\r\n";
+    o << L"Format: " << pe::format_name(CurrentLayout()) << L"\r\n";
+
+    constexpr std::size_t PAGE = 4096;
+
+    auto start = state::file->page_offset;
+    auto end = std::min(start + PAGE, CoreSize());
+
+    o << L"Page: " << start << L" - " << (end ? end - 1 : 0) << L"\r\n";
+
+    if (state::file->have_last_find)
+    {
+        auto it = std::lower_bound(state::file->find_hits.begin(),
+            state::file->find_hits.end(), state::file->last_find_offset);
+
+        o << L"Find: hit " << state::file->find_base + (it - state::file->find_hits.begin()) + 1
+            << L" of " << state::file->find_base + state::file->find_hits.size()
+            << (state::file->find_more ? L"+" : L"")
+            << L" @ 0x" << std::hex << state::file->last_find_offset;
+
+        const auto& L = CurrentLayout();
+        std::uint32_t rva{};
+        if (pe::file_to_rva(L, state::file->last_find_offset, rva))
+            o << L" (VA 0x" << (L.imageBase + rva) << L")";
+
+        o << std::dec;
+        if (!state::file->find_scope.empty())
+            o << L" in " << state::file->find_scope;
+        o << L"\r\n";
+    }
+
+    if (auto pending = CorePendingPatches())
+        o << L"Pending: " << pending << L" patched range(s), not committed\r\n";
+
+    if (const auto index = state::file->pattern_index.stats(); index.status != PatternIndex::Status::Off)
+        o << L"Index: " << DescribeIndex(index) << L"\r\n";
+
+    if (state::file->project)
+    {
+        o << L"Project: " << ProjectPath();
+        if (!state::file->project_current)
+            o << L" (file changed, saved analysis not used)";
+        o << L"\r\n";
+    }
+
+    if (!state::file->bookmarks.empty())
+    {
+        o << L"\r\n[Bookmarks]\r\n";
+        for (const auto& b : state::file->bookmarks)
+            o << L"0x" << std::hex << b.offset << L"  " << b.label << L"\r\n";
+        o << L"\r\n";
+    }
+
+    return o.str();
+}
+
+// The returned buffer is reused on every call: the hex rows are
+// formatted straight into it, so scrolling does not allocate once
+// it has grown to a page.
+static const std::wstring& RenderFullPage()
+{
+    static std::wstring page;
+
+    constexpr std::size_t PAGE = 4096;
+
+    page.clear();
+    page += RenderStatus();
+    page += L"[Hex]\r\n";
+    HexFormatRows(CoreBytes(), state::file->page_offset, PAGE, page);
+
+    return page;
+}
+
+// ============================================================
+// PUBLIC API IMPLEMENTATION
+// ============================================================
+
+export const std::wstring& render_main_view()
+{
+    return RenderFullPage();
+}
+
+export std::wstring render_status()
+{
+    return RenderStatus();
+}
+
+// The offset the view starts at. Line-granular viewers move it by
+// rows; relative offsets ("+0x20") are taken from here.
+export std::size_t view_offset()
+{
+    return state::file->page_offset;
+}
+
+export void set_view_offset(std::size_t off)
+{
+    state::file->page_offset = (std::min)(off, CoreSize());
+}
+
+export void scroll_pages(int delta)
+{
+    constexpr std::size_t PAGE = 4096;
+
+    if (delta > 0)
+    {
+        state::file->page_offset =
+            std::min(state::file->page_offset + PAGE, CoreSize());
+    }
+    else if (delta < 0)
+    {
+        if (state::file->page_offset >= PAGE)
+            state::file->page_offset -= PAGE;
+        else
+            state::file->page_offset = 0;
+    }
+}
+
+// Patch listener of every open file. Patches only ever land in the
+// current file, so its session is *state::file. Anything before
+// the end of the headers can move sections or the image base;
+// without a valid layout, assume the first page.
+static void OnBytesChanged(std::size_t off, std::size_t len)
+{
+    // Saved caches describe the bytes as they were; the
+    // string table is cheap enough to rebuild whole.
+    state::file->project_current = false;
+    state::file->strings_stale = true;
+    state::file->pattern_index.invalidate(off, len);
+    state::file->diff.reset();
+
+    const std::size_t hdr = state::file->layout.valid ? state::file->layout.headerSize : 0x1000;
+    // Guessed functions follow the code bytes; .pdata ones
+    // only change with the exception directory.
+    if (!state::file->functions_stale)
+    {
+        const auto& dir = state::file->layout.directories[pe::DirException];
+        std::uint32_t rva{};
+        state::file->functions_stale = state::file->functions_guessed || off < hdr ||
+            (pe::file_to_rva(state::file->layout, off, rva) &&
+                rva + len > dir.rva && rva < dir.rva + dir.size);
+    }
+
+    // Parsed tables read the directories' bytes; the
+    // explorer's text holds names taken from them.
+    if (state::file->dirs)
+    {
+        std::uint32_t rva{};
+        bool hit = off < hdr;
+        if (!hit && pe::file_to_rva(state::file->layout, off, rva))
+        {
+            for (const auto& d : state::file->layout.directories)
+                hit = hit || (d.size && rva + len > d.rva && rva < d.rva + d.size);
+        }
+
+        if (hit)
+        {
+            state::file->analysis_stale = true;
+            state::file->dirs.reset();
+        }
+    }
+
+    if (off < hdr)
+    {
+        state::file->layout_stale = true;
+        state::file->analysis_stale = true;
+        state::file->sweep.clear();
+        state::file->sweep_ready = false;
+        state::file->xrefs.clear();
+        state::file->xrefs_ready = false;
+        return;
+    }
+
+    if (!state::file->analysis_stale)
+        state::file->analysis.invalidate(off, len);
+
+    UpdateCodeIndexes(off, len);
+}
+
+// Make handle's file current. Nothing is re-read: every open file
+// stays mapped and keeps its session.
+export bool switch_file(std::uint32_t handle)
+{
+    if (!CoreSelectFile(handle))
+        return false;
+
+    state::file = &state::sessions[handle];
+    return true;
+}
+
+// Close handle with everything built for it. When that was the
+// current file, the most recently opened one left takes its place.
+export bool close_file(std::uint32_t handle)
+{
+    auto it = state::sessions.find(handle);
+    if (!handle || it == state::sessions.end())
+        return false;
+
+    // The session goes first, so that the index stops before the
+    // bytes under it are unmapped.
+    if (state::file == &it->second)
+        state::file = &state::sessions[0];
+    state::sessions.erase(it);
+
+    if (!CoreCloseFile(handle))
+        return false;
+
+    if (const auto files = CoreFiles(); !files.empty())
+        switch_file(files.back().handle);
+    else
+    {
+        // Start the next file from a blank slate.
+        state::sessions.erase(0);
+        state::file = &state::sessions[0];
+    }
+    return true;
+}
+
+// Open path as one more file of the workspace and make it current;
+// the file that was current keeps its session for when it comes back.
+export bool open_file(const std::wstring& path)
+{
+    const std::uint32_t handle = CoreOpenFile(path);
+    if (!handle)
+        return false;
+
+    switch_file(handle);
+    GetBinaryFile().subscribe(OnBytesChanged);
+
+    state::file->layout = pe::analyze(CoreBytes());
+    state::file->layout_stale = false;
+
+    LoadProject();
+    return true;
+}
+
+// Run command against handle's file, then go back to the current one.
+// The result is rendered to text before that: typed payloads and hex
+// rows point into the other file's session, which is no longer the
+// current one by the time the caller formats anything.
+static CommandResult ExecOnFile(std::uint32_t handle, const std::wstring& command)
+{
+    const std::uint32_t back = CoreCurrentFile();
+    if (!switch_file(handle))
+        return Failure(L"(no such file)\r\n");
+
+    CommandResult r = ExecCommand(command);
+
+    switch (r.kind)
+    {
+    case CommandResultKind::None:
+    case CommandResultKind::RefreshView:
+    case CommandResultKind::ReplaceTextW:
+        break;
+
+    case CommandResultKind::ShowBytes:
+    {
+        std::wstring text = std::move(r.text);
+        text += L"\r\n";
+        HexFormatRows(CoreBytes(), r.offset, r.size, text);
+        r = { CommandResultKind::ReplaceTextW, std::move(text), 0, 0, r.failed };
+        break;
+    }
+
+    default:
+    {
+        std::wstring text;
+        FormatResult(r, text);
+        r = { CommandResultKind::ReplaceTextW, std::move(text), 0, 0, r.failed };
+        break;
+    }
+    }
+
+    // The command may have closed either file; then there is nothing
+    // to go back to and the current file stays as it left it.
+    switch_file(back);
+    return r;
+}
+
+// ============================================================
+// COMMAND EXECUTION
+// ============================================================
+
+export CommandResult ExecCommand(const std::wstring& raw)
+{
+    std::wstring line = Trim(raw);
+    if (line.empty())
+        return {};
+
+    auto tok = SplitWS(line);
+    if (tok.empty())
+        return {};
+
+    static const CommandResult kMissingArgument = Failure(L"(missing argument)\r\n");
+
+    std::wstring cmd = tok[0];
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(),
+        [](wchar_t c) { return std::towlower(c); });
+
+    try
+    {
+        // -----------------------------------------------------
+        // Navigation: prev / next / scroll
+        // -----------------------------------------------------
+        if (cmd == L"prev")
+        {
+            scroll_pages(-1);
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        if (cmd == L"next")
+        {
+            scroll_pages(+1);
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        if (cmd == L"scroll")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+            scroll_pages(tok[1] == L"+" ? +1 : -1);
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // goto
+        // -----------------------------------------------------
+        if (cmd == L"goto")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+            auto off = ParseOffset(tok[1]);
+
+            state::file->page_offset = RowAlign(off);
+
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // dump
+        // -----------------------------------------------------
+        if (cmd == L"dump")
+        {
+            if (tok.size() < 3) return kMissingArgument;
+
+            auto off = ParseOffset(tok[1]);
+            auto sz = std::stoull(tok[2], nullptr, 0);
+
+            const auto bytes = CoreBytes();
+            const std::size_t end = (std::min)(static_cast<std::size_t>(off + sz), bytes.size());
+            const std::size_t n = end > off ? end - off : 0;
+
+            std::wstringstream o;
+            o << std::uppercase << L"Dump @ 0x" << std::hex << off
+                << L", size " << std::dec << n << L"\r\n";
+
+            return { CommandResultKind::ShowBytes, o.str(), off, n };
+        }
+
+        // -----------------------------------------------------
+        // disasm
+        // -----------------------------------------------------
+        if (cmd == L"disasm")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            auto off = ParseOffset(tok[1]);
+
+            if (tok.size() >= 3)
+            {
+                auto sz = std::stoull(tok[2], nullptr, 0);
+
+                auto& A = CurrentAnalysis();
+
+                CommandResult r{ CommandResultKind::Instructions };
+                if (!A.decode(off, sz, r.codeBegin, r.codeEnd))
+                    return { CommandResultKind::ReplaceTextW, A.listing(off, sz) };
+
+                if (!CurrentLayout().valid)
+                    r.text = L"(Not a PE or ELF file — linear disasm)\r\n\r\n";
+                return r;
+            }
+
+            // No size: exactly the function containing off.
+            auto& A = CurrentAnalysis();
+
+            std::uint32_t rva{};
+            const pe::Function* fn = nullptr;
+            if (A.file_to_rva(off, rva))
+                fn = pe::find_function(CurrentFunctions(), rva);
+
+            std::size_t begin{};
+            if (!fn || !A.rva_to_file(fn->begin, begin))
+            {
+                std::wstringstream o;
+                o << L"(no function at 0x" << std::hex << off << L")\r\n";
+                return Failure(o.str());
+            }
+
+            std::wstringstream o;
+            o << L"Function 0x" << std::hex << (A.image_base() + fn->begin)
+                << L" - 0x" << (A.image_base() + fn->end) << std::dec
+                << L" (" << (fn->end - fn->begin) << L" bytes"
+                << (state::file->functions_guessed ? L", guessed" : L"") << L")\r\n\r\n";
+
+            CommandResult r{ CommandResultKind::Instructions, o.str() };
+            if (!A.decode(begin, fn->end - fn->begin, r.codeBegin, r.codeEnd))
+                return { CommandResultKind::ReplaceTextW, r.text + A.listing(begin, fn->end - fn->begin) };
+            return r;
+        }
+
+        // -----------------------------------------------------
+        // sweep: linear-decode the whole code section in parallel
+        // -----------------------------------------------------
+        if (cmd == L"sweep")
+        {
+            state::file->sweep_stats = LinearSweep(CoreBytes(), CurrentLayout(), state::file->sweep);
+            state::file->sweep_ready = true;
+            state::file->xrefs_ready = false;
+
+            const auto& st = state::file->sweep_stats;
+            if (st.bytes == 0)
+                return Failure(L"(no code section)\r\n");
+
+            const auto& L = CurrentLayout();
+            const std::uint64_t va = (L.valid ? L.imageBase : 0) + st.rva;
+
+            std::wstringstream o;
+            o << L"[Sweep] " << (st.section.empty() ? std::wstring(L"(file)")
+                : std::wstring(st.section.begin(), st.section.end()))
+                << L" @ 0x" << std::hex << va << std::dec
+                << L", " << st.bytes << L" bytes\r\n";
+            o << L"Instructions: " << st.instructions << L"\r\n";
+            o << L"Undecodable:  " << st.undecodable << L" bytes\r\n";
+            o << L"Segments:     " << st.segments << L" on " << st.threads
+                << L" threads, " << st.resyncs << L" resynced\r\n";
+            o << std::fixed << std::setprecision(1)
+                << L"Time:         " << st.seconds * 1000.0 << L" ms, "
+                << std::setprecision(0) << st.per_second() << L" instr/s\r\n";
+
+            return { CommandResultKind::ReplaceTextW, o.str() };
+        }
+
+        // -----------------------------------------------------
+        // xrefs <addr>: who references addr, and what it references
+        // -----------------------------------------------------
+        if (cmd == L"xrefs")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            std::uint32_t rva{};
+            if (!ParseAddressRva(tok[1], rva))
+                return Failure(L"(address not in image)\r\n");
+
+            const auto& X = CurrentXrefs();
+
+            CommandResult r{ CommandResultKind::Xrefs };
+            r.offset = rva;
+            r.xrefsTo = X.to(rva);
+            r.xrefsFrom = X.from(rva);
+            return r;
+        }
+
+        // -----------------------------------------------------
+        // vft
+        // -----------------------------------------------------
+        if (cmd == L"vft")
+        {
+            if (tok.size() < 3) return kMissingArgument;
+
+            auto off = ParseOffset(tok[1]);
+            auto cnt = std::stoull(tok[2], nullptr, 0);
+
+            return { CommandResultKind::VTable, {}, off, cnt };
+        }
+
+        // -----------------------------------------------------
+        // imports / exports / relocs [page] / tls
+        // -----------------------------------------------------
+        if (cmd == L"imports" || cmd == L"exports" || cmd == L"relocs" || cmd == L"tls")
+        {
+            const auto* D = CurrentDirectories();
+            if (!D)
+                return Failure(L"(not a PE file)\r\n");
+
+            const std::uint64_t base = D->image_base();
+            auto name = [](const char* s) { return std::wstring(s, s + std::strlen(s)); };
+
+            std::wstringstream o;
+
+            if (cmd == L"imports")
+            {
+                const auto imp = D->imports();
+                o << L"[Imports] " << imp.size() << L"\r\n\r\n" << std::hex;
+                for (const auto& i : imp)
+                    o << L"0x" << (base + i.slot) << L"  " << name(D->import_name(i)) << L"\r\n";
+            }
+            else if (cmd == L"exports")
+            {
+                const auto exp = D->exports();
+                o << L"[Exports] " << exp.size() << L"\r\n\r\n";
+                for (const auto& e : exp)
+                {
+                    o << L"0x" << std::hex << (base + e.rva) << std::dec
+                        << L"  @" << e.ordinal << L"  " << name(D->export_name(e))
+                        << (e.forwarded ? L"  (forwarded)" : L"") << L"\r\n";
+                }
+            }
+            else if (cmd == L"relocs")
+            {
+                constexpr std::size_t ROWS = 256;
+
+                const auto rel = D->relocations();
+                const std::size_t page = tok.size() >= 2 ? std::stoull(tok[1], nullptr, 0) : 0;
+                const std::size_t pages = (rel.size() + ROWS - 1) / ROWS;
+
+                o << L"[Relocations] " << rel.size() << L" total, page "
+                    << page << L"/" << (pages ? pages - 1 : 0) << L"\r\n\r\n";
+
+                const std::size_t a = (std::min)(page * ROWS, rel.size());
+                const std::size_t b = (std::min)(a + ROWS, rel.size());
+                for (std::size_t i = a; i < b; ++i)
+                {
+                    o << L"0x" << std::hex << (base + rel[i].rva) << L"  "
+                        << (rel[i].type == 10 ? L"DIR64" : rel[i].type == 3 ? L"HIGHLOW" : L"type ")
+                        << std::dec;
+                    if (rel[i].type != 10 && rel[i].type != 3)
+                        o << rel[i].type;
+                    o << L"\r\n";
+                }
+            }
+            else
+            {
+                const auto tls = D->tls_callbacks();
+                o << L"[TLS callbacks] " << tls.size() << L"\r\n\r\n" << std::hex;
+                for (const auto cb : tls)
+                    o << L"0x" << (base + cb) << L"\r\n";
+            }
+
+            return { CommandResultKind::ReplaceTextW, o.str() };
+        }
+
+        // -----------------------------------------------------
+        // find
+        // -----------------------------------------------------
+        if (cmd == L"find")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            std::size_t begin = 0;
+            std::size_t end = CoreSize();
+            std::wstring scope;
+            std::size_t patTok = 1;
+
+            if (tok[1][0] == L'@')
+            {
+                if (tok.size() < 3 || !ParseFindScope(tok[1], begin, end))
+                    return Failure(L"(bad find scope)\r\n");
+
+                scope = tok[1].substr(1);
+                patTok = 2;
+            }
+
+            // The pattern starts after the scope, whose digits could
+            // otherwise pass for pattern bytes.
+            std::size_t from = tok[0].size();
+            if (patTok == 2)
+                from = line.find(tok[1], from) + tok[1].size();
+
+            auto pos = line.find(tok[patTok], from);
+            auto hex = line.substr(pos);
+            auto pat = ParsePattern(hex);
+
+            // One parallel pass collects the first window of hits.
+            auto bytes = CoreBytes();
+            end = (std::min)(end, bytes.size());
+            auto hits = FindPatternAll(bytes.first(end), pat, begin, state::file->pattern_index, kFindWindow);
+
+            if (!hits.empty())
+            {
+                auto apply = [=, pat = std::move(pat), hits = std::move(hits)]() mutable
+                    {
+                        const auto hit = hits.front();
+
+                        state::file->last_pattern = std::move(pat);
+                        state::file->find_more = hits.size() == kFindWindow;
+                        state::file->find_hits = std::move(hits);
+                        state::file->find_base = 0;
+                        state::file->find_generation = CoreGeneration();
+                        state::file->find_begin = begin;
+                        state::file->find_end = end;
+                        state::file->find_scope = scope;
+                        state::file->last_find_offset = hit;
+                        state::file->have_last_find = true;
+
+                        state::file->page_offset = RowAlign(hit);
+                    };
+
+                if (state::worker)
+                    state::worker->effects.push_back(std::move(apply));
+                else
+                    apply();
+
+                return { CommandResultKind::RefreshView, {} };
+            }
+
+            return Failure(L"(not found)\r\n");
+        }
+
+        // -----------------------------------------------------
+        // findnext
+        // -----------------------------------------------------
+        if (cmd == L"findnext")
+        {
+            if (!state::file->have_last_find) return Failure(L"(no previous find)\r\n");
+
+            // Patches since the last find make the list stale.
+            if (state::file->find_generation != CoreGeneration())
+                LoadFindWindow(state::file->find_begin, 0);
+
+            // Past the end of the window: scan on for the next one.
+            while (state::file->find_more && state::file->find_hits.back() <= state::file->last_find_offset)
+            {
+                LoadFindWindow(state::file->find_hits.back() + 1,
+                    state::file->find_base + state::file->find_hits.size());
+            }
+
+            auto it = std::upper_bound(state::file->find_hits.begin(),
+                state::file->find_hits.end(), state::file->last_find_offset);
+
+            if (it != state::file->find_hits.end())
+            {
+                const auto hit = *it;
+                state::file->last_find_offset = hit;
+
+                state::file->page_offset = RowAlign(hit);
+
+                return { CommandResultKind::RefreshView, {} };
+            }
+
+            return Failure(L"(not found)\r\n");
+        }
+
+        // -----------------------------------------------------
+        // index [off | <budget MB>]: build the pattern index in
+        // the background, or show how far it got
+        // -----------------------------------------------------
+        if (cmd == L"index")
+        {
+            if (tok.size() >= 2 && tok[1] == L"off")
+            {
+                state::file->pattern_index.stop();
+                return { CommandResultKind::ReplaceTextW, L"[Pattern index] off\r\n" };
+            }
+
+            if (CorePath().empty())
+                return Failure(L"(no file)\r\n");
+
+            // A budget rebuilds; a bare index starts one only when
+            // there is nothing built or building yet.
+            if (tok.size() >= 2 || state::file->pattern_index.stats().status == PatternIndex::Status::Off)
+            {
+                const std::size_t budget = tok.size() >= 2
+                    ? std::stoull(tok[1], nullptr, 0) << 20
+                    : PatternIndex::kDefaultBudget;
+
+                state::file->pattern_index.build(CoreBytes(), budget);
+            }
+
+            return { CommandResultKind::ReplaceTextW,
+                L"[Pattern index] " + DescribeIndex(state::file->pattern_index.stats()) + L"\r\n" };
+        }
+
+        // -----------------------------------------------------
+        // makesig <off> [max bytes]: shortest signature that
+        // finds off and nothing else in .text
+        // -----------------------------------------------------
+        if (cmd == L"makesig")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            constexpr std::size_t kDefaultSigBytes = 128;
+
+            const auto off = ParseOffset(tok[1]);
+            const std::size_t maxBytes = tok.size() >= 3 ? std::stoull(tok[2], nullptr, 0) : kDefaultSigBytes;
+
+            const auto& L = CurrentLayout();
+            const auto sig = MakeSignature(CoreBytes(), L, CurrentDirectories(), off, maxBytes,
+                state::file->pattern_index);
+
+            std::wstringstream o;
+            if (!sig)
+            {
+                o << L"(0x" << std::hex << off << L" is not code in "
+                    << (L.valid ? L".text" : L"the file") << L")\r\n";
+                return Failure(o.str());
+            }
+
+            if (sig->pattern.empty())
+            {
+                o << L"(no unique signature in " << sig->decoded << L" bytes; "
+                    << sig->matches << L" hit(s))\r\n";
+                return Failure(o.str());
+            }
+
+            std::uint32_t rva{};
+            const bool mapped = L.valid && pe::file_to_rva(L, off, rva);
+
+            o << L"[Signature] 0x" << std::hex << off;
+            if (mapped)
+                o << L" (VA 0x" << (L.imageBase + rva) << L")";
+            o << std::dec << L", " << sig->pattern.size() << L" bytes, "
+                << sig->instructions << L" instruction(s), unique in "
+                << (L.valid ? L".text" : L"the file")
+                << (sig->indexed ? L" (indexed)" : L"") << L"\r\n"
+                << FormatPattern(sig->pattern) << L"\r\n";
+
+            return { CommandResultKind::ReplaceTextW, o.str() };
+        }
+
+        // -----------------------------------------------------
+        // diff <path> | migrate | off: compare the current file with
+        // a newer build, then carry templates and labels over to it
+        // -----------------------------------------------------
+        if (cmd == L"diff")
+        {
+            const std::wstring arg = tok.size() >= 2 ? tok[1] : std::wstring{};
+
+            if (arg == L"off")
+            {
+                state::file->diff.reset();
+                state::file->diff_file.reset();
+                state::file->diff_functions.clear();
+                return { CommandResultKind::ReplaceTextW, L"[Diff] off\r\n" };
+            }
+
+            if (CorePath().empty())
+                return Failure(L"(no file)\r\n");
+
+            if (arg == L"migrate")
+            {
+                if (!state::file->diff)
+                    return Failure(L"(no diff)\r\n");
+
+                const auto& L = CurrentLayout();
+
+                std::vector<state::Template> templates;
+                for (const auto& t : state::file->templates)
+                {
+                    if (const auto r = RemapOffset(*state::file->diff, L, state::file->diff_layout, t.offset))
+                        templates.push_back({ t.name, r->offset, t.bytes });
+                }
+
+                std::vector<state::Bookmark> bookmarks;
+                for (const auto& b : state::file->bookmarks)
+                {
+                    if (const auto r = RemapOffset(*state::file->diff, L, state::file->diff_layout, b.offset))
+                        bookmarks.push_back({ r->offset, b.label });
+                }
+
+                const std::size_t lost = state::file->templates.size() - templates.size() +
+                    state::file->bookmarks.size() - bookmarks.size();
+
+                // The diff's mapping of the newer build is let go first:
+                // a second view of the file would keep it from ever
+                // being committed. The newer build's own project wins
+                // where both name the same thing.
+                const std::wstring path = state::file->diff_file->path();
+                state::file->diff.reset();
+                state::file->diff_file.reset();
+                state::file->diff_layout = {};
+                state::file->diff_functions.clear();
+                if (!open_file(path))
+                    return Failure(L"(cannot open file)\r\n");
+
+                for (auto& t : templates)
+                {
+                    if (std::none_of(state::file->templates.begin(), state::file->templates.end(),
+                        [&](const state::Template& x) { return x.name == t.name; }))
+                    {
+                        state::file->templates.push_back(std::move(t));
+                    }
+                }
+
+                for (auto& b : bookmarks)
+                {
+                    auto it = std::lower_bound(state::file->bookmarks.begin(), state::file->bookmarks.end(), b.offset,
+                        [](const state::Bookmark& x, std::size_t v) { return x.offset < v; });
+                    if (it == state::file->bookmarks.end() || it->offset != b.offset)
+                        state::file->bookmarks.insert(it, std::move(b));
+                }
+
+                std::wstringstream o;
+                o << L"[Diff] migrated to " << path << L": " << templates.size() << L" template(s), "
+                    << bookmarks.size() << L" label(s), " << lost << L" lost\r\n";
+                return { CommandResultKind::ReplaceTextW, o.str() };
+            }
+
+            if (!arg.empty())
+            {
+                auto path = Trim(line.substr(tok[0].size()));
+                if (path.size() >= 2 && path.front() == L'"' && path.back() == L'"')
+                    path = path.substr(1, path.size() - 2);
+
+                state::file->diff.reset();
+                auto file = std::make_unique<BinaryFile>();
+                if (!file->load(path))
+                    return Failure(L"(cannot open file)\r\n");
+
+                state::file->diff_file = std::move(file);
+                state::file->diff_layout = pe::analyze(state::file->diff_file->bytes());
+                state::file->diff_functions = ImageFunctions(state::file->diff_file->bytes(), state::file->diff_layout);
+            }
+
+            if (!state::file->diff_file)
+                return Failure(L"(no file to diff against)\r\n");
+
+            if (!state::file->diff)
+            {
+                const DiffImage older{ CoreBytes(), &CurrentLayout(), CurrentFunctions() };
+                const DiffImage newer{ state::file->diff_file->bytes(), &state::file->diff_layout,
+                    state::file->diff_functions };
+                state::file->diff = std::make_unique<DiffResult>(DiffImages(older, newer));
+            }
+
+            return { CommandResultKind::ReplaceTextW, DescribeDiff() };
+        }
+
+        // -----------------------------------------------------
+        // findall <sigfile>: resolve a signature database in one pass
+        // -----------------------------------------------------
+        if (cmd == L"findall")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            auto path = Trim(line.substr(tok[0].size()));
+            if (path.size() >= 2 && path.front() == L'"' && path.back() == L'"')
+                path = path.substr(1, path.size() - 2);
+
+            PatternSet set;
+            std::vector<std::wstring> names;
+            if (!LoadSignatures(path, set, names))
+                return Failure(L"(cannot read signature file)\r\n");
+
+            state::file->sig_hits = FindAll(CoreBytes(), set);
+            state::file->sig_names = std::move(names);
+
+            std::vector<bool> seen(set.size());
+            for (const auto& h : state::file->sig_hits)
+                seen[h.pattern] = true;
+
+            const auto matched = std::count(seen.begin(), seen.end(), true);
+
+            std::wstringstream o;
+            o << matched << L" of " << set.size() << L" signatures matched\r\n";
+
+            CommandResult r{ CommandResultKind::Hits, o.str() };
+            r.hits = state::file->sig_hits;
+            return r;
+        }
+
+        // -----------------------------------------------------
+        // hits [page]: page through the last findall table
+        // -----------------------------------------------------
+        if (cmd == L"hits")
+        {
+            std::size_t page = 0;
+            if (tok.size() >= 2)
+                page = std::stoull(tok[1], nullptr, 0);
+
+            return { CommandResultKind::ReplaceTextW, RenderHitPage(page) };
+        }
+
+        // -----------------------------------------------------
+        // strings [-n <len>] [text | /regex/]: the string table,
+        // or the strings holding text / matching regex
+        // -----------------------------------------------------
+        if (cmd == L"strings")
+        {
+            std::size_t minLength = 0;
+            std::size_t pos = tok[0].size();
+            if (tok.size() >= 3 && tok[1] == L"-n")
+            {
+                minLength = std::stoull(tok[2], nullptr, 0);
+                pos = line.find(tok[2], line.find(tok[1]) + tok[1].size()) + tok[2].size();
+            }
+
+            const auto& S = CurrentStrings();
+            const auto query = Trim(line.substr(pos));
+
+            if (query.empty())
+            {
+                const auto utf16 = std::count_if(S.all().begin(), S.all().end(),
+                    [](const StringRef& r) { return r.encoding == StringEncoding::Utf16; });
+
+                std::wstringstream o;
+                o << L"[Strings] " << S.size() << L" strings (" << S.size() - utf16 << L" ASCII, "
+                    << utf16 << L" UTF-16), " << S.distinct() << L" distinct, at least "
+                    << StringTable::kMinLength << L" characters\r\n";
+                o << std::fixed << std::setprecision(1)
+                    << L"Index built in " << state::file->strings_seconds * 1000.0 << L" ms\r\n";
+                return { CommandResultKind::ReplaceTextW, o.str() };
+            }
+
+            // The table only holds printable ASCII.
+            const bool ascii = std::all_of(query.begin(), query.end(),
+                [](wchar_t c) { return c < 0x80; });
+            const std::string q(query.begin(), query.end());
+
+            state::file->string_matches.clear();
+            if (q.size() >= 2 && q.front() == '/' && q.back() == '/')
+            {
+                const std::string pattern = q.substr(1, q.size() - 2);
+                std::regex re;
+                try
+                {
+                    re.assign(pattern, std::regex::ECMAScript | std::regex::optimize);
+                }
+                catch (const std::regex_error&)
+                {
+                    return Failure(L"(bad regex)\r\n");
+                }
+
+                if (ascii)
+                    state::file->string_matches = S.match(re, RequiredLiteral(pattern), minLength);
+            }
+            else if (ascii)
+            {
+                state::file->string_matches = S.find(q, minLength);
+            }
+
+            std::wstringstream o;
+            o << L"[Strings] " << state::file->string_matches.size() << L" of " << S.size()
+                << L" strings match\r\n\r\n";
+
+            CommandResult r{ CommandResultKind::Strings, o.str() };
+            r.strings = state::file->string_matches;
+            return r;
+        }
+
+        // -----------------------------------------------------
+        // patch
+        // -----------------------------------------------------
+        if (cmd == L"patch")
+        {
+            if (tok.size() < 3) return kMissingArgument;
+
+            auto off = ParseOffset(tok[1]);
+            auto pos = line.find(tok[2]);
+            auto hex = line.substr(pos);
+            auto bytes = ParseHexBytes(hex);
+
+            if (!CorePatchFile(off, bytes))
+                return Failure(L"(patch outside the file)\r\n");
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // label <off> [name]: bookmark an offset; without a name,
+        // drop the bookmark there
+        // -----------------------------------------------------
+        if (cmd == L"label")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            const auto off = ParseOffset(tok[1]);
+            auto it = std::lower_bound(state::file->bookmarks.begin(), state::file->bookmarks.end(), off,
+                [](const state::Bookmark& b, std::size_t v) { return b.offset < v; });
+            const bool exists = it != state::file->bookmarks.end() && it->offset == off;
+
+            if (tok.size() < 3)
+            {
+                if (!exists)
+                    return Failure(L"(no label there)\r\n");
+                state::file->bookmarks.erase(it);
+                return { CommandResultKind::RefreshView, {} };
+            }
+
+            auto name = Trim(line.substr(line.find(tok[2], line.find(tok[1]) + tok[1].size())));
+            if (exists)
+                it->label = std::move(name);
+            else
+                state::file->bookmarks.insert(it, { off, std::move(name) });
+
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // savetpl
+        // -----------------------------------------------------
+        if (cmd == L"savetpl")
+        {
+            if (tok.size() < 4) return kMissingArgument;
+
+            const auto& name = tok[1];
+            auto        off = ParseOffset(tok[2]);
+
+            auto pos = line.find(tok[3]);
+            auto hex = line.substr(pos);
+            auto bytes = ParseHexBytes(hex);
+
+            auto it = std::find_if(
+                state::file->templates.begin(),
+                state::file->templates.end(),
+                [&](const state::Template& t) { return t.name == name; }
+            );
+
+            if (it != state::file->templates.end())
+            {
+                it->offset = off;
+                it->bytes = bytes;
+            }
+            else
+            {
+                state::file->templates.push_back({ name, off, bytes });
+            }
+
+            return {};
+        }
+
+        // -----------------------------------------------------
+        // applytpl
+        // -----------------------------------------------------
+        if (cmd == L"applytpl")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            const auto& name = tok[1];
+
+            auto it = std::find_if(
+                state::file->templates.begin(),
+                state::file->templates.end(),
                 [&](const state::Template& t) { return t.name == name; }
             );
 
-            if (it == state::templates.end())
-                return {};
+            if (it == state::file->templates.end())
+                return Failure(L"(no such template)\r\n");
 
             auto off = it->offset;
             if (tok.size() >= 3)
                 off = ParseOffset(tok[2]);
 
-            CorePatchFile(off, it->bytes);
+            if (!CorePatchFile(off, it->bytes))
+                return Failure(L"(patch outside the file)\r\n");
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // commit / undo / redo: staged patches
+        // -----------------------------------------------------
+        if (cmd == L"commit")
+        {
+            if (CorePendingPatches() && GetBinaryFile().views() > 1)
+                return Failure(L"(file is open more than once; close the other views to commit)\r\n");
+
+            switch (CoreCommit())
+            {
+            case CommitResult::Written:
+                break;
+            case CommitResult::Unchanged:
+                return Failure(L"(commit failed, file unchanged)\r\n");
+            case CommitResult::RollbackFailed:
+                return Failure(L"(commit failed and could not be undone; the journal restores the file when it is next opened)\r\n");
+            case CommitResult::JournalLeft:
+                return Failure(L"(commit written, but " + CorePath() +
+                    L".journal could not be removed; delete it, or opening the file again rolls the commit back)\r\n");
+            }
+
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        if (cmd == L"undo")
+        {
+            if (!CoreUndo())
+                return Failure(L"(nothing to undo)\r\n");
+
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        if (cmd == L"redo")
+        {
+            if (!CoreRedo())
+                return Failure(L"(nothing to redo)\r\n");
+
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // save: write the project database next to the file
+        // -----------------------------------------------------
+        if (cmd == L"save")
+        {
+            if (CorePath().empty())
+                return Failure(L"(no file)\r\n");
+
+            if (!SaveProject())
+                return Failure(L"(cannot write project)\r\n");
+
+            std::wstringstream o;
+            o << L"Saved " << ProjectPath() << L"\r\n";
+            o << L"Labels:       " << state::file->bookmarks.size() << L"\r\n";
+            o << L"Templates:    " << state::file->templates.size() << L"\r\n";
+            if (!state::file->functions_stale)
+                o << L"Functions:    " << state::file->functions.size() << L"\r\n";
+            if (!state::file->analysis_stale)
+                o << L"Explored:     " << state::file->analysis.cache().size() << L" instructions\r\n";
+            if (!state::file->sweep.empty())
+                o << L"Swept:        " << state::file->sweep.size() << L" instructions\r\n";
+            if (state::file->xrefs_ready)
+                o << L"Xrefs:        " << state::file->xrefs.size() << L"\r\n";
+
+            return { CommandResultKind::ReplaceTextW, o.str() };
+        }
+
+        // -----------------------------------------------------
+        // files: every open file, the current one marked
+        // -----------------------------------------------------
+        if (cmd == L"files")
+        {
+            const auto files = CoreFiles();
+            if (files.empty())
+                return Failure(L"(no file)\r\n");
+
+            const std::uint32_t cur = CoreCurrentFile();
+
+            std::wstringstream o;
+            o << L"[Files] " << files.size() << L" open\r\n";
+            for (const auto& f : files)
+            {
+                o << (f.handle == cur ? L"* " : L"  ") << f.handle << L"  " << f.path
+                    << L"  " << f.size << L" bytes";
+                if (f.pending)
+                    o << L", " << f.pending << L" pending";
+                if (f.views > 1)
+                    o << L", pages shared with " << f.views - 1 << L" other view(s)";
+                o << L"\r\n";
+            }
+            return { CommandResultKind::ReplaceTextW, o.str() };
+        }
+
+        // -----------------------------------------------------
+        // file <n> [command...]: make file n current, or run one
+        // command against it and stay on the current file
+        // -----------------------------------------------------
+        if (cmd == L"file")
+        {
+            if (tok.size() < 2) return kMissingArgument;
+
+            const auto handle = static_cast<std::uint32_t>(std::stoul(tok[1], nullptr, 0));
+
+            if (tok.size() >= 3)
+            {
+                const std::size_t at = line.find(tok[2], line.find(tok[1]) + tok[1].size());
+                return ExecOnFile(handle, line.substr(at));
+            }
+
+            if (!switch_file(handle))
+                return Failure(L"(no such file)\r\n");
+            return { CommandResultKind::RefreshView, {} };
+        }
+
+        // -----------------------------------------------------
+        // close [n]: close file n, the current one by default.
+        // Staged patches of that file are dropped.
+        // -----------------------------------------------------
+        if (cmd == L"close")
+        {
+            const std::uint32_t handle = tok.size() >= 2
+                ? static_cast<std::uint32_t>(std::stoul(tok[1], nullptr, 0))
+                : CoreCurrentFile();
+
+            if (!close_file(handle))
+                return Failure(L"(no such file)\r\n");
             return { CommandResultKind::RefreshView, {} };
         }
 
         // -----------------------------------------------------
-        // open: UI does dialog, we just tell it to refresh
+        // open [path]: without a path the UI does the dialog and
+        // we just tell it to refresh
         // -----------------------------------------------------
         if (cmd == L"open")
         {
+            if (tok.size() >= 2)
+            {
+                auto path = Trim(line.substr(tok[0].size()));
+                if (path.size() >= 2 && path.front() == L'"' && path.back() == L'"')
+                    path = path.substr(1, path.size() - 2);
+
+                if (!open_file(path))
+                    return Failure(L"(cannot open file)\r\n");
+            }
             return { CommandResultKind::RefreshView, {} };
         }
     }
+    catch (const JobCancelled&)
+    {
+        return Failure(L"(cancelled)\r\n");
+    }
     catch (...)
     {
-        return { CommandResultKind::ReplaceTextW, L"(command error)\r\n" };
+        return Failure(L"(command error)\r\n");
+    }
+
+    return Failure(L"(unknown command)\r\n");
+}
+
+// ============================================================
+// RESULT FORMATTING
+// ============================================================
+
+// Hand out to flush once out is past kFormatChunk.
+template<typename Str>
+static void MaybeFlush(Str& out, const std::function<void(Str&)>& flush)
+{
+    if (flush && out.size() >= kFormatChunk)
+    {
+        flush(out);
+        out.clear();
+    }
+}
+
+// The text the output pane shows. For ShowBytes that is only the
+// caption; rows belong to the hex view (or to the caller).
+export void FormatResult(const CommandResult& r, std::wstring& out,
+    const std::function<void(std::wstring&)>& flush)
+{
+    out += r.text;
+
+    switch (r.kind)
+    {
+    case CommandResultKind::Instructions:
+    {
+        auto& A = CurrentAnalysis();
+        const std::uint64_t base = A.image_base();
+
+        wchar_t addr[24];
+        std::size_t n = 0;
+        A.for_each(r.codeBegin, r.codeEnd, [&](std::size_t i)
+            {
+                std::swprintf(addr, std::size(addr), L"0x%llx  ",
+                    static_cast<unsigned long long>(base + A.cache().rva(i)));
+                out += addr;
+                out += A.text(i);
+                out += L"\r\n";
+                MaybeFlush(out, flush);
+
+                if ((++n & 0xFFF) == 0)
+                    JobCheckpoint();
+            });
+        break;
+    }
+
+    case CommandResultKind::Hits:
+        out += RenderHitPage(0);
+        break;
+
+    case CommandResultKind::Xrefs:
+    {
+        auto& A = CurrentAnalysis();
+        const std::uint64_t base = A.image_base();
+
+        std::wstringstream o;
+        o << L"[Xrefs] 0x" << std::hex << (base + r.offset) << L"\r\n\r\n";
+
+        o << L"To (" << std::dec << r.xrefsTo.size() << L"):\r\n" << std::hex;
+        for (const auto& x : r.xrefsTo)
+        {
+            o << L"  0x" << (base + x.from) << L"  " << std::setw(5) << std::left
+                << XrefKindName(x.kind) << std::right << L"  " << A.text_at(x.from) << L"\r\n";
+        }
+
+        if (!r.xrefsFrom.empty())
+        {
+            o << L"\r\nFrom (" << std::dec << r.xrefsFrom.size() << L"):\r\n" << std::hex;
+            for (const auto& x : r.xrefsFrom)
+            {
+                o << L"  0x" << (base + x.to) << L"  " << XrefKindName(x.kind) << L"\r\n";
+            }
+        }
+
+        out += o.str();
+        break;
+    }
+
+    case CommandResultKind::VTable:
+        out += DisasmVFT(CoreBytes(), CurrentLayout(), CurrentFunctions(), r.offset, r.size, 0,
+            CurrentDirectories());
+        break;
+
+    case CommandResultKind::Strings:
+    {
+        const auto& L = CurrentLayout();
+
+        wchar_t head[64];
+        for (const auto& s : r.strings)
+        {
+            const std::string_view section = s.section != StringRef::kNoSection
+                ? std::string_view(L.sections[s.section].name) : std::string_view("-");
+            const std::wstring name(section.begin(), section.end());
+
+            std::swprintf(head, std::size(head), L"0x%08llx  %-8ls  %-5ls  ",
+                static_cast<unsigned long long>(s.offset), name.c_str(),
+                s.encoding == StringEncoding::Utf16 ? L"utf16" : L"ascii");
+            out += head;
+
+            for (const char c : state::file->strings.text(s.text))
+            {
+                if (c == '\t')
+                    out += L"\\t";
+                else
+                    out += static_cast<wchar_t>(c);
+            }
+            out += L"\r\n";
+            MaybeFlush(out, flush);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    MaybeFlush(out, flush);
+}
+
+static const char* FlowKindName(FlowKind k) noexcept
+{
+    switch (k)
+    {
+    case FlowKind::Normal:   return "normal";
+    case FlowKind::Call:     return "call";
+    case FlowKind::CondJump: return "jcc";
+    case FlowKind::Jump:     return "jmp";
+    case FlowKind::Return:   return "ret";
+    case FlowKind::Stop:     return "stop";
+    }
+    return "?";
+}
+
+// JSON string literal; anything outside printable ASCII is escaped
+// as UTF-16 \u units, so the output is plain ASCII.
+template<typename Char>
+static void JsonString(std::string& out, std::basic_string_view<Char> s)
+{
+    static constexpr char kHex[] = "0123456789abcdef";
+
+    auto unit = [&](std::uint32_t u)
+        {
+            out += "\\u";
+            for (int k = 12; k >= 0; k -= 4)
+                out += kHex[(u >> k) & 15];
+        };
+
+    out += '"';
+    for (const Char ch : s)
+    {
+        const auto c = static_cast<std::uint32_t>(
+            static_cast<std::make_unsigned_t<Char>>(ch));
+
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += static_cast<char>(c);
+        }
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\r')
+            out += "\\r";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c >= 0x20 && c < 0x7F)
+            out += static_cast<char>(c);
+        else if (c >= 0x10000)
+        {
+            unit(0xD800 + ((c - 0x10000) >> 10));
+            unit(0xDC00 + ((c - 0x10000) & 0x3FF));
+        }
+        else
+            unit(c);
+    }
+    out += '"';
+}
+
+static void JsonString(std::string& out, const std::wstring& s)
+{
+    JsonString(out, std::wstring_view(s));
+}
+
+static void JsonString(std::string& out, std::string_view s)
+{
+    JsonString<char>(out, s);
+}
+
+// One JSON object per result, no trailing newline:
+//   {"ok":true,"kind":"instructions","text":"...","instructions":[...]}
+// Addresses are VAs (file offsets for raw blobs), as plain numbers.
+export void FormatResultJson(const CommandResult& r, std::string& out,
+    const std::function<void(std::string&)>& flush)
+{
+    auto num = [&](const char* key, std::uint64_t v)
+        {
+            out += '"';
+            out += key;
+            out += "\":";
+            out += std::to_string(v);
+        };
+
+    out += "{\"ok\":";
+    out += r.failed ? "false" : "true";
+    out += ",\"kind\":";
+
+    switch (r.kind)
+    {
+    case CommandResultKind::None:         out += "\"none\""; break;
+    case CommandResultKind::RefreshView:  out += "\"view\""; break;
+    case CommandResultKind::ReplaceTextW: out += "\"text\""; break;
+    case CommandResultKind::ShowBytes:    out += "\"bytes\""; break;
+    case CommandResultKind::Instructions: out += "\"instructions\""; break;
+    case CommandResultKind::Hits:         out += "\"hits\""; break;
+    case CommandResultKind::Xrefs:        out += "\"xrefs\""; break;
+    case CommandResultKind::VTable:       out += "\"vtable\""; break;
+    case CommandResultKind::Strings:      out += "\"strings\""; break;
+    }
+
+    if (!r.text.empty())
+    {
+        out += r.failed ? ",\"error\":" : ",\"text\":";
+        JsonString(out, r.text);
+    }
+
+    switch (r.kind)
+    {
+    case CommandResultKind::RefreshView:
+        out += ',';
+        num("offset", state::file->page_offset);
+        break;
+
+    case CommandResultKind::ShowBytes:
+    {
+        out += ',';
+        num("offset", r.offset);
+        out += ',';
+        num("size", r.size);
+        out += ",\"hex\":\"";
+
+        static constexpr char kHex[] = "0123456789abcdef";
+        const auto data = CoreBytes();
+        const auto bytes = r.offset < data.size()
+            ? data.subspan(r.offset, (std::min)(r.size, data.size() - r.offset))
+            : std::span<const std::byte>{};
+        for (const std::byte b : bytes)
+        {
+            out += kHex[std::to_integer<unsigned>(b) >> 4];
+            out += kHex[std::to_integer<unsigned>(b) & 15];
+            MaybeFlush(out, flush);
+        }
+        out += '"';
+        break;
+    }
+
+    case CommandResultKind::Instructions:
+    {
+        auto& A = CurrentAnalysis();
+        const auto& C = A.cache();
+        const std::uint64_t base = A.image_base();
+
+        out += ",\"instructions\":[";
+        bool first = true;
+        std::size_t n = 0;
+        A.for_each(r.codeBegin, r.codeEnd, [&](std::size_t i)
+            {
+                out += first ? "{" : ",{";
+                first = false;
+
+                num("va", base + C.rva(i));
+                out += ',';
+                num("length", C.length(i));
+                out += ",\"flow\":\"";
+                out += FlowKindName(C.flow(i));
+                out += '"';
+                if (C.target(i) != InstructionCache::kNoTarget)
+                {
+                    out += ',';
+                    num("target", base + C.target(i));
+                }
+                out += ",\"text\":";
+                JsonString(out, A.text(i));
+                out += '}';
+
+                MaybeFlush(out, flush);
+
+                if ((++n & 0xFFF) == 0)
+                    JobCheckpoint();
+            });
+        out += ']';
+        break;
+    }
+
+    case CommandResultKind::Hits:
+    {
+        out += ",\"hits\":[";
+        for (std::size_t i = 0; i < r.hits.size(); ++i)
+        {
+            out += i ? ",{" : "{";
+            num("offset", r.hits[i].offset);
+            out += ",\"name\":";
+            JsonString(out, state::file->sig_names[r.hits[i].pattern]);
+            out += '}';
+            MaybeFlush(out, flush);
+        }
+        out += ']';
+        break;
+    }
+
+    case CommandResultKind::Xrefs:
+    {
+        const std::uint64_t base = CurrentAnalysis().image_base();
+
+        auto list = [&](const char* key, std::span<const Xref> xs, bool byFrom)
+            {
+                out += ",\"";
+                out += key;
+                out += "\":[";
+                for (std::size_t i = 0; i < xs.size(); ++i)
+                {
+                    out += i ? ",{" : "{";
+                    num(byFrom ? "from" : "to", base + (byFrom ? xs[i].from : xs[i].to));
+                    out += ",\"kind\":";
+                    const std::wstring_view k = XrefKindName(xs[i].kind);
+                    JsonString(out, k);
+                    out += '}';
+                }
+                out += ']';
+            };
+
+        out += ',';
+        num("address", base + r.offset);
+        list("to", r.xrefsTo, true);
+        list("from", r.xrefsFrom, false);
+        break;
+    }
+
+    case CommandResultKind::VTable:
+    {
+        const auto& L = CurrentLayout();
+        const auto* D = CurrentDirectories();
+        const auto functions = CurrentFunctions();
+        const auto data = CoreBytes();
+        const std::size_t ptrSize = PointerSize(L);
+
+        out += ',';
+        num("offset", r.offset);
+        out += ",\"slots\":[";
+        for (std::size_t i = 0; i < r.size; ++i)
+        {
+            const std::size_t off = r.offset + i * ptrSize;
+            if (off + ptrSize > data.size())
+                break;
+
+            std::uint64_t va{};
+            std::memcpy(&va, data.data() + off, ptrSize);
+            const auto rva = static_cast<std::uint32_t>(va - L.imageBase);
+
+            out += i ? ",{" : "{";
+            num("va", va);
+            if (D)
+            {
+                const auto name = D->symbol(rva);
+                if (!name.empty())
+                {
+                    out += ",\"symbol\":";
+                    JsonString(out, std::string_view(name));
+                }
+            }
+            if (const auto* fn = pe::find_function(functions, rva))
+            {
+                out += ',';
+                num("begin", L.imageBase + fn->begin);
+                out += ',';
+                num("end", L.imageBase + fn->end);
+            }
+            out += '}';
+        }
+        out += ']';
+        break;
+    }
+
+    case CommandResultKind::Strings:
+    {
+        const auto& L = CurrentLayout();
+
+        out += ",\"strings\":[";
+        for (std::size_t i = 0; i < r.strings.size(); ++i)
+        {
+            const auto& s = r.strings[i];
+
+            out += i ? ",{" : "{";
+            num("offset", s.offset);
+
+            std::uint32_t rva{};
+            if (L.valid && pe::file_to_rva(L, static_cast<std::size_t>(s.offset), rva))
+            {
+                out += ',';
+                num("va", L.imageBase + rva);
+            }
+            if (s.section != StringRef::kNoSection)
+            {
+                out += ",\"section\":";
+                JsonString(out, std::string_view(L.sections[s.section].name));
+            }
+            out += s.encoding == StringEncoding::Utf16 ? ",\"encoding\":\"utf16\"" : ",\"encoding\":\"ascii\"";
+            out += ",\"text\":";
+            JsonString(out, state::file->strings.text(s.text));
+            out += '}';
+            MaybeFlush(out, flush);
+        }
+        out += ']';
+        break;
+    }
+
+    default:
+        break;
+    }
+
+    out += '}';
+    MaybeFlush(out, flush);
+}
+
+// ============================================================
+// SCRIPTS
+// ============================================================
+
+// Commands that only read the file and the indexes built from it, so
+// a script may run them side by side. find is one: its effect on the
+// view and on findnext is deferred and applied in script order.
+// Anything relative to the view ("+0x20", "@+0:+0x1000") waits for
+// the commands before it.
+static std::wstring CommandName(const std::vector<std::wstring>& tok)
+{
+    std::wstring cmd = tok.empty() ? std::wstring() : tok[0];
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(),
+        [](wchar_t c) { return std::towlower(c); });
+    return cmd;
+}
+
+static bool IsConcurrent(const std::vector<std::wstring>& tok)
+{
+    static const wchar_t* const kCommands[] = {
+        L"dump", L"disasm", L"xrefs", L"vft", L"find", L"hits",
+        L"imports", L"exports", L"relocs", L"tls", L"makesig"
+    };
+
+    const std::wstring cmd = CommandName(tok);
+
+    if (std::none_of(std::begin(kCommands), std::end(kCommands),
+        [&](const wchar_t* c) { return cmd == c; }))
+    {
+        return false;
+    }
+
+    // A find scope holds offsets too: "@+0:+0x1000".
+    auto relative = [](const std::wstring& t)
+        {
+            if (t[0] == L'@')
+            {
+                const auto colon = t.find(L':');
+                return t.size() > 1 && (t[1] == L'+' || t[1] == L'-' ||
+                    (colon != std::wstring::npos && colon + 1 < t.size() &&
+                        (t[colon + 1] == L'+' || t[colon + 1] == L'-')));
+            }
+            return t[0] == L'+' || t[0] == L'-';
+        };
+
+    return std::none_of(tok.begin() + 1, tok.end(), relative);
+}
+
+export bool ChangesFile(const std::wstring& raw)
+{
+    static const wchar_t* const kCommands[] = {
+        L"patch", L"applytpl", L"commit", L"undo", L"redo",
+        L"open", L"file", L"close"
+    };
+
+    const auto tok = SplitWS(raw);
+    const std::wstring cmd = CommandName(tok);
+
+    // diff migrate opens the newer build.
+    if (cmd == L"diff")
+        return tok.size() >= 2 && tok[1] == L"migrate";
+
+    return std::any_of(std::begin(kCommands), std::end(kCommands),
+        [&](const wchar_t* c) { return cmd == c; });
+}
+
+static void RenderStep(ScriptStep& step, ResultFormat format)
+{
+    if (format == ResultFormat::Json)
+        FormatResultJson(step.result, step.json);
+    else
+        FormatResult(step.result, step.text);
+}
+
+export bool ExecScript(std::span<const std::wstring> lines, ResultFormat format,
+    const std::function<bool(const ScriptStep&)>& emit)
+{
+    // Commands in flight at once; enough to keep every worker busy
+    // while the first results are already being written.
+    const std::size_t window = std::size_t(4) * GlobalPool().size();
+
+    bool ok = true;
+    std::size_t i = 0;
+
+    while (i < lines.size())
+    {
+        std::vector<ScriptStep> batch;
+        bool concurrent = false;
+
+        for (; i < lines.size() && batch.size() < window; ++i)
+        {
+            const std::wstring line = Trim(lines[i]);
+            if (line.empty() || line[0] == L'#')
+                continue;
+
+            const bool c = IsConcurrent(SplitWS(line));
+            if (!batch.empty() && (!concurrent || !c))
+                break;
+
+            concurrent = c;
+            batch.push_back({ i + 1, line });
+        }
+
+        if (batch.empty())
+            continue;
+
+        std::vector<std::vector<std::function<void()>>> effects(batch.size());
+
+        if (batch.size() == 1)
+        {
+            auto& step = batch.front();
+            step.result = ExecCommand(step.command);
+            RenderStep(step, format);
+        }
+        else
+        {
+            // Build what the workers share before they start.
+            const auto& L = CurrentLayout();
+            const auto* D = CurrentDirectories();
+            CurrentFunctions();
+            if (std::any_of(batch.begin(), batch.end(),
+                [](const ScriptStep& s) { return CommandName(SplitWS(s.command)) == L"xrefs"; }))
+            {
+                CurrentXrefs();
+            }
+
+            GlobalPool().parallel_for(batch.size(), [&](std::size_t k)
+                {
+                    CodeAnalysis analysis;
+                    analysis.reset(CoreBytes(), L, D);
+                    analysis.follow_targets(false);
+
+                    state::WorkerContext ctx{ &analysis };
+                    state::worker = &ctx;
+
+                    try
+                    {
+                        // A view result reports the view offset, which
+                        // is only right once the deferred effects before
+                        // it have been applied; it is rendered below.
+                        batch[k].result = ExecCommand(batch[k].command);
+                        if (batch[k].result.kind != CommandResultKind::RefreshView)
+                            RenderStep(batch[k], format);
+                    }
+                    catch (...)
+                    {
+                        state::worker = nullptr;
+                        throw;
+                    }
+
+                    state::worker = nullptr;
+                    effects[k] = std::move(ctx.effects);
+                });
+        }
+
+        for (std::size_t k = 0; k < batch.size(); ++k)
+        {
+            for (auto& apply : effects[k])
+                apply();
+
+            if (batch.size() > 1 && batch[k].result.kind == CommandResultKind::RefreshView)
+                RenderStep(batch[k], format);
+
+            ok = ok && !batch[k].result.failed;
+            if (!emit(batch[k]))
+                return false;
+        }
     }
 
-    return {};
+    return ok;
 }
@@ -0,0 +1,692 @@
+export module mod_diff;
+
+import mod_pe_utils;
+import mod_disasm;
+import mod_analysis;
+import mod_threadpool;
+
+import <vector>;
+import <span>;
+import <array>;
+import <optional>;
+import <unordered_map>;
+import <chrono>;
+import <bit>;
+import <cstddef>;
+import <cstdint>;
+import <cstring>;
+import <algorithm>;
+import <utility>;
+
+// Zydis include via vcpkg
+import "Zycore/Types.h";
+import "Zydis/Zydis.h";
+
+// ------------------------------------------------------------
+// Diff of two builds of an image
+//
+// Functions are matched by a hash of their instruction stream with
+// every displacement and immediate masked out, so a function that
+// only moved, or whose callees moved, hashes the same. Hashes that
+// are unique on both sides (or occur equally often) pair up; the
+// functions left between two pairs that are in order on both sides
+// pair up as changed when the counts agree.
+//
+// Bytes are aligned rsync style: the old image is cut into blocks,
+// and a rolling hash over the new image looks every position up in
+// the table of block hashes. A hit is verified and grown in both
+// directions, then rolling resumes past it. Both the hashing and
+// the rolling run in slices on the pool.
+// ------------------------------------------------------------
+
+export enum class DiffStatus : std::uint8_t
+{
+    Unchanged,  // same code at the same address
+    Moved,      // same code at another address
+    Changed,    // paired by position, code differs
+    Removed,    // only in the old image
+    Added       // only in the new image
+};
+
+export const wchar_t* DiffStatusName(DiffStatus s) noexcept
+{
+    switch (s)
+    {
+    case DiffStatus::Unchanged: return L"unchanged";
+    case DiffStatus::Moved:     return L"moved";
+    case DiffStatus::Changed:   return L"changed";
+    case DiffStatus::Removed:   return L"removed";
+    case DiffStatus::Added:     return L"added";
+    }
+    return L"?";
+}
+
+export struct DiffImage
+{
+    std::span<const std::byte>  bytes;
+    const pe::Layout*           layout{};
+    std::span<const pe::Function> functions;
+};
+
+// One function of either image; RVAs of the side it is missing from
+// are kNone.
+export struct FunctionMatch
+{
+    static constexpr std::uint32_t kNone = UINT32_MAX;
+
+    std::uint32_t oldRva{ kNone };
+    std::uint32_t oldSize{};
+    std::uint32_t newRva{ kNone };
+    std::uint32_t newSize{};
+    DiffStatus    status{};
+};
+
+// Identical bytes at oldOffset in the old image and newOffset in the
+// new one.
+export struct ByteRange
+{
+    std::uint64_t oldOffset{};
+    std::uint64_t newOffset{};
+    std::uint64_t length{};
+};
+
+export struct DiffResult
+{
+    std::vector<FunctionMatch> functions;   // by old RVA, then the added ones by new RVA
+    std::vector<ByteRange>     ranges;      // by new offset, not overlapping there
+    std::vector<ByteRange>     byOld;       // the same, by old offset
+
+    std::size_t count[5]{};                 // functions per DiffStatus
+
+    std::uint64_t unchangedBytes{};         // in ranges at the same offset
+    std::uint64_t movedBytes{};             // in ranges at another offset
+    std::size_t   movedRanges{};
+    std::uint64_t oldChangedBytes{};        // not in any range
+    std::uint64_t newChangedBytes{};
+
+    double   seconds{};
+    unsigned threads{};
+};
+
+// Function table for an image that is not the loaded one: .pdata, or
+// guessed from prologues, as for the loaded file.
+export std::vector<pe::Function> ImageFunctions(std::span<const std::byte> data, const pe::Layout& L)
+{
+    auto out = pe::load_functions(data, L);
+    if (out.empty())
+    {
+        std::uint32_t rva{};
+        const auto code = CodeRegion(data, L, rva);
+        out = pe::guess_functions(code, rva);
+    }
+    return out;
+}
+
+// ------------------------------------------------------------
+// Function hashes
+// ------------------------------------------------------------
+
+static constexpr std::uint64_t kFnvBasis = 0xCBF29CE484222325ull;
+static constexpr std::uint64_t kFnvPrime = 0x100000001B3ull;
+static constexpr std::size_t   kFunctionSlice = 1024;
+
+static bool RvaToFile(const pe::Layout& L, std::uint32_t rva, std::size_t& off)
+{
+    if (!L.valid)
+    {
+        off = rva;
+        return true;
+    }
+    return pe::rva_to_file(L, rva, off);
+}
+
+static bool FileToRva(const pe::Layout& L, std::size_t off, std::uint32_t& rva)
+{
+    if (!L.valid)
+    {
+        rva = static_cast<std::uint32_t>(off);
+        return true;
+    }
+    return pe::file_to_rva(L, off, rva);
+}
+
+// Instruction bytes with displacements and immediates zeroed, FNV-1a.
+// Bytes that do not decode go in as they are.
+static std::uint64_t ShapeHash(const ZydisDecoder& decoder,
+    const unsigned char* p,
+    std::size_t n)
+{
+    std::uint64_t h = kFnvBasis;
+    unsigned char buf[ZYDIS_MAX_INSTRUCTION_LENGTH];
+
+    std::size_t at = 0;
+    while (at < n)
+    {
+        ZydisDecoderContext     ctx{};
+        ZydisDecodedInstruction inst{};
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeInstruction(&decoder, &ctx, p + at, n - at, &inst)))
+        {
+            h = (h ^ p[at]) * kFnvPrime;
+            ++at;
+            continue;
+        }
+
+        std::memcpy(buf, p + at, inst.length);
+        if (inst.raw.disp.size)
+            std::memset(buf + inst.raw.disp.offset, 0, inst.raw.disp.size / 8);
+        for (const auto& imm : inst.raw.imm)
+        {
+            if (imm.size)
+                std::memset(buf + imm.offset, 0, imm.size / 8);
+        }
+
+        for (std::size_t k = 0; k < inst.length; ++k)
+            h = (h ^ buf[k]) * kFnvPrime;
+
+        at += inst.length;
+    }
+
+    return h;
+}
+
+static std::vector<std::uint64_t> HashFunctions(const DiffImage& img)
+{
+    const auto& L = *img.layout;
+    const auto fns = img.functions;
+    std::vector<std::uint64_t> out(fns.size());
+
+    ZydisDecoder decoder{};
+    if (ZYAN_FAILED(InitDecoder(decoder, L)))
+        return out;
+
+    const std::size_t slices = (fns.size() + kFunctionSlice - 1) / kFunctionSlice;
+    GlobalPool().parallel_for(slices, [&](std::size_t s)
+        {
+            JobCheckpoint();
+
+            std::uint64_t bytes = 0;
+            const std::size_t end = (std::min)(fns.size(), (s + 1) * kFunctionSlice);
+            for (std::size_t i = s * kFunctionSlice; i < end; ++i)
+            {
+                std::size_t off{};
+                if (!RvaToFile(L, fns[i].begin, off) || off >= img.bytes.size())
+                    continue;
+
+                const std::size_t n = (std::min)<std::size_t>(fns[i].end - fns[i].begin, img.bytes.size() - off);
+                out[i] = ShapeHash(decoder, reinterpret_cast<const unsigned char*>(img.bytes.data() + off), n);
+                bytes += n;
+            }
+            JobBytes(bytes);
+        });
+
+    return out;
+}
+
+// Indices into pairs of a longest run that is ascending in new RVA,
+// pairs being sorted by old RVA.
+static std::vector<std::size_t> OrderedAnchors(const std::vector<std::pair<std::size_t, std::size_t>>& pairs,
+    std::span<const pe::Function> newFns)
+{
+    std::vector<std::size_t> tails;                 // pair index ending each run length
+    std::vector<std::size_t> prev(pairs.size(), SIZE_MAX);
+
+    for (std::size_t i = 0; i < pairs.size(); ++i)
+    {
+        const std::uint32_t v = newFns[pairs[i].second].begin;
+        auto it = std::lower_bound(tails.begin(), tails.end(), v,
+            [&](std::size_t t, std::uint32_t x) { return newFns[pairs[t].second].begin < x; });
+
+        if (it != tails.begin())
+            prev[i] = *std::prev(it);
+        if (it == tails.end())
+            tails.push_back(i);
+        else
+            *it = i;
+    }
+
+    std::vector<std::size_t> out;
+    for (std::size_t i = tails.empty() ? SIZE_MAX : tails.back(); i != SIZE_MAX; i = prev[i])
+        out.push_back(i);
+    std::reverse(out.begin(), out.end());
+    return out;
+}
+
+static void MatchFunctions(const DiffImage& a, const DiffImage& b, DiffResult& r)
+{
+    const auto oldFns = a.functions;
+    const auto newFns = b.functions;
+    const auto oldHash = HashFunctions(a);
+    const auto newHash = HashFunctions(b);
+
+    // Hash → indices on each side, in RVA order.
+    std::unordered_map<std::uint64_t, std::pair<std::vector<std::size_t>, std::vector<std::size_t>>> groups;
+    groups.reserve(oldFns.size());
+    for (std::size_t i = 0; i < oldFns.size(); ++i)
+        groups[oldHash[i]].first.push_back(i);
+    for (std::size_t i = 0; i < newFns.size(); ++i)
+    {
+        if (auto it = groups.find(newHash[i]); it != groups.end())
+            it->second.second.push_back(i);
+    }
+
+    std::vector<std::size_t> oldTo(oldFns.size(), SIZE_MAX);
+    std::vector<std::size_t> newTo(newFns.size(), SIZE_MAX);
+    std::vector<std::pair<std::size_t, std::size_t>> same;
+
+    for (const auto& [h, g] : groups)
+    {
+        if (g.first.size() != g.second.size())
+            continue;
+
+        for (std::size_t k = 0; k < g.first.size(); ++k)
+        {
+            oldTo[g.first[k]] = g.second[k];
+            newTo[g.second[k]] = g.first[k];
+            same.push_back({ g.first[k], g.second[k] });
+        }
+    }
+    std::sort(same.begin(), same.end());
+
+    // Between two anchors that are in order on both sides, what is
+    // left over pairs up one to one when the counts agree.
+    const auto anchors = OrderedAnchors(same, newFns);
+    std::vector<std::pair<std::size_t, std::size_t>> changed;
+
+    auto pairGap = [&](std::size_t oldLo, std::size_t oldHi, std::size_t newLo, std::size_t newHi)
+        {
+            std::vector<std::size_t> o, n;
+            for (std::size_t i = oldLo; i < oldHi; ++i)
+            {
+                if (oldTo[i] == SIZE_MAX)
+                    o.push_back(i);
+            }
+            for (std::size_t i = newLo; i < newHi; ++i)
+            {
+                if (newTo[i] == SIZE_MAX)
+                    n.push_back(i);
+            }
+
+            if (o.size() != n.size())
+                return;
+
+            for (std::size_t k = 0; k < o.size(); ++k)
+                changed.push_back({ o[k], n[k] });
+        };
+
+    std::size_t oldLo = 0, newLo = 0;
+    for (const auto i : anchors)
+    {
+        pairGap(oldLo, same[i].first, newLo, same[i].second);
+        oldLo = same[i].first + 1;
+        newLo = same[i].second + 1;
+    }
+    pairGap(oldLo, oldFns.size(), newLo, newFns.size());
+
+    for (const auto& [o, n] : changed)
+    {
+        oldTo[o] = n;
+        newTo[n] = o;
+    }
+
+    r.functions.reserve(oldFns.size() + newFns.size());
+    for (std::size_t i = 0; i < oldFns.size(); ++i)
+    {
+        FunctionMatch m;
+        m.oldRva = oldFns[i].begin;
+        m.oldSize = oldFns[i].end - oldFns[i].begin;
+
+        if (oldTo[i] == SIZE_MAX)
+        {
+            m.status = DiffStatus::Removed;
+        }
+        else
+        {
+            const auto& f = newFns[oldTo[i]];
+            m.newRva = f.begin;
+            m.newSize = f.end - f.begin;
+            m.status = oldHash[i] != newHash[oldTo[i]] ? DiffStatus::Changed
+                : m.oldRva == m.newRva ? DiffStatus::Unchanged
+                : DiffStatus::Moved;
+        }
+        r.functions.push_back(m);
+    }
+
+    for (std::size_t i = 0; i < newFns.size(); ++i)
+    {
+        if (newTo[i] == SIZE_MAX)
+            r.functions.push_back({ FunctionMatch::kNone, 0, newFns[i].begin, newFns[i].end - newFns[i].begin, DiffStatus::Added });
+    }
+
+    for (const auto& m : r.functions)
+        ++r.count[static_cast<std::size_t>(m.status)];
+}
+
+// ------------------------------------------------------------
+// Byte alignment
+// ------------------------------------------------------------
+
+static constexpr std::size_t kBlock = 64;
+static constexpr std::size_t kRollSlice = std::size_t(1) << 20;
+
+// Random values per byte value; spreads the polynomial hash over
+// all 64 bits.
+static constexpr std::array<std::uint64_t, 256> kByteMix = []
+    {
+        std::array<std::uint64_t, 256> t{};
+        std::uint64_t x = 0x9E3779B97F4A7C15ull;
+        for (auto& v : t)
+        {
+            x += 0x9E3779B97F4A7C15ull;
+            std::uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            v = z ^ (z >> 31);
+        }
+        return t;
+    }();
+
+static constexpr std::uint64_t kRollBase = 0x100000001B3ull;
+
+static constexpr std::uint64_t RollOut()
+{
+    std::uint64_t p = 1;
+    for (std::size_t i = 1; i < kBlock; ++i)
+        p *= kRollBase;
+    return p;
+}
+
+// Weight of the byte leaving the window.
+static constexpr std::uint64_t kRollOut = RollOut();
+
+static std::uint64_t BlockHash(const unsigned char* p) noexcept
+{
+    std::uint64_t h = 0;
+    for (std::size_t i = 0; i < kBlock; ++i)
+        h = h * kRollBase + kByteMix[p[i]];
+    return h;
+}
+
+struct BlockTable
+{
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> entries;  // hash → block, unique hashes only
+    std::vector<std::uint64_t>                           filter;   // bit per top-bits bucket
+    unsigned                                             bits{};
+
+    [[nodiscard]] bool maybe(std::uint64_t h) const noexcept
+    {
+        const std::uint64_t k = h >> (64 - bits);
+        return (filter[k >> 6] >> (k & 63)) & 1;
+    }
+
+    [[nodiscard]] std::uint32_t find(std::uint64_t h) const noexcept
+    {
+        auto it = std::lower_bound(entries.begin(), entries.end(), std::pair<std::uint64_t, std::uint32_t>{ h, 0 });
+        return it != entries.end() && it->first == h ? it->second : UINT32_MAX;
+    }
+};
+
+static BlockTable HashBlocks(std::span<const std::byte> data)
+{
+    BlockTable t;
+    const std::size_t blocks = (std::min<std::size_t>)(data.size() / kBlock, UINT32_MAX);
+    const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+
+    t.entries.resize(blocks);
+    const std::size_t per = kRollSlice / kBlock;
+    GlobalPool().parallel_for((blocks + per - 1) / per, [&](std::size_t s)
+        {
+            JobCheckpoint();
+
+            const std::size_t end = (std::min)(blocks, (s + 1) * per);
+            for (std::size_t b = s * per; b < end; ++b)
+                t.entries[b] = { BlockHash(d + b * kBlock), static_cast<std::uint32_t>(b) };
+            JobBytes((end - s * per) * kBlock);
+        });
+
+    // Repeated blocks (padding, tables of zeros) cannot anchor; the
+    // ranges around them grow over them instead.
+    std::sort(t.entries.begin(), t.entries.end());
+    std::size_t w = 0;
+    for (std::size_t i = 0; i < t.entries.size();)
+    {
+        std::size_t j = i + 1;
+        while (j < t.entries.size() && t.entries[j].first == t.entries[i].first)
+            ++j;
+        if (j - i == 1)
+            t.entries[w++] = t.entries[i];
+        i = j;
+    }
+    t.entries.resize(w);
+
+    t.bits = std::clamp<unsigned>(static_cast<unsigned>(std::bit_width(w)) + 3, 16, 28);
+    t.filter.assign((std::size_t(1) << t.bits) / 64, 0);
+    for (const auto& [h, b] : t.entries)
+    {
+        const std::uint64_t k = h >> (64 - t.bits);
+        t.filter[k >> 6] |= std::uint64_t(1) << (k & 63);
+    }
+
+    return t;
+}
+
+// Ranges of newer that also occur in older, for matches found at
+// positions [begin, end) of newer. Ranges stop growing at end and
+// grow back at most a block before begin; the neighbouring slices
+// find the rest, and ranges with the same shift merge afterwards.
+static void RollSlice(std::span<const std::byte> older,
+    std::span<const std::byte> newer,
+    const BlockTable& table,
+    std::size_t begin,
+    std::size_t end,
+    std::vector<ByteRange>& out)
+{
+    const auto* o = reinterpret_cast<const unsigned char*>(older.data());
+    const auto* n = reinterpret_cast<const unsigned char*>(newer.data());
+    const std::size_t on = older.size();
+    const std::size_t nn = newer.size();
+
+    std::size_t floor = begin > kBlock ? begin - kBlock : 0;   // no growing back over earlier matches
+    std::size_t pos = begin;
+    if (pos + kBlock > nn)
+        return;
+
+    std::uint64_t h = BlockHash(n + pos);
+    while (pos < end)
+    {
+        if (table.maybe(h))
+        {
+            const std::uint32_t blk = table.find(h);
+            const std::size_t at = std::size_t(blk) * kBlock;
+            if (blk != UINT32_MAX && std::memcmp(o + at, n + pos, kBlock) == 0)
+            {
+                std::size_t os = at, ns = pos;
+                while (os > 0 && ns > floor && o[os - 1] == n[ns - 1])
+                {
+                    --os;
+                    --ns;
+                }
+
+                std::size_t oe = at + kBlock, ne = pos + kBlock;
+                while (oe < on && ne < end && o[oe] == n[ne])
+                {
+                    ++oe;
+                    ++ne;
+                }
+
+                out.push_back({ os, ns, ne - ns });
+
+                floor = pos = ne;
+                if (pos >= end || pos + kBlock > nn)
+                    break;
+                h = BlockHash(n + pos);
+                continue;
+            }
+        }
+
+        if (pos + kBlock >= nn)
+            break;
+        h = (h - kByteMix[n[pos]] * kRollOut) * kRollBase + kByteMix[n[pos + kBlock]];
+        ++pos;
+    }
+}
+
+static void AlignBytes(std::span<const std::byte> older, std::span<const std::byte> newer, DiffResult& r)
+{
+    const BlockTable table = HashBlocks(older);
+
+    const std::size_t slices = (newer.size() + kRollSlice - 1) / kRollSlice;
+    std::vector<std::vector<ByteRange>> parts(slices);
+
+    if (!table.entries.empty())
+    {
+        GlobalPool().parallel_for(slices, [&](std::size_t s)
+            {
+                JobCheckpoint();
+
+                const std::size_t b = s * kRollSlice;
+                const std::size_t e = (std::min)(newer.size(), b + kRollSlice);
+                RollSlice(older, newer, table, b, e, parts[s]);
+                JobBytes(e - b);
+            });
+    }
+
+    // A range grown past its slice overlaps what the next slice
+    // found; same shift merges, anything else is cut at the end of
+    // the range before it.
+    std::vector<ByteRange> all;
+    for (auto& p : parts)
+        all.insert(all.end(), p.begin(), p.end());
+    std::sort(all.begin(), all.end(),
+        [](const ByteRange& a, const ByteRange& b)
+        {
+            return a.newOffset != b.newOffset ? a.newOffset < b.newOffset : a.length > b.length;
+        });
+
+    auto& ranges = r.ranges;
+    for (auto x : all)
+    {
+        if (!ranges.empty())
+        {
+            auto& last = ranges.back();
+            const std::uint64_t lastEnd = last.newOffset + last.length;
+
+            if (x.newOffset <= lastEnd && x.oldOffset - x.newOffset == last.oldOffset - last.newOffset)
+            {
+                last.length = (std::max)(lastEnd, x.newOffset + x.length) - last.newOffset;
+                continue;
+            }
+
+            if (x.newOffset < lastEnd)
+            {
+                const std::uint64_t cut = lastEnd - x.newOffset;
+                if (cut >= x.length)
+                    continue;
+                x.oldOffset += cut;
+                x.newOffset += cut;
+                x.length -= cut;
+            }
+        }
+        ranges.push_back(x);
+    }
+
+    std::uint64_t covered = 0;
+    for (const auto& x : ranges)
+    {
+        covered += x.length;
+        if (x.oldOffset == x.newOffset)
+        {
+            r.unchangedBytes += x.length;
+        }
+        else
+        {
+            r.movedBytes += x.length;
+            ++r.movedRanges;
+        }
+    }
+    r.newChangedBytes = newer.size() - covered;
+
+    r.byOld = ranges;
+    std::sort(r.byOld.begin(), r.byOld.end(),
+        [](const ByteRange& a, const ByteRange& b) { return a.oldOffset < b.oldOffset; });
+
+    std::uint64_t oldCovered = 0, reach = 0;
+    for (const auto& x : r.byOld)
+    {
+        const std::uint64_t a = (std::max)(reach, x.oldOffset);
+        const std::uint64_t b = x.oldOffset + x.length;
+        if (b > a)
+            oldCovered += b - a;
+        reach = (std::max)(reach, b);
+    }
+    r.oldChangedBytes = older.size() - oldCovered;
+}
+
+// ------------------------------------------------------------
+// Entry points
+// ------------------------------------------------------------
+
+export DiffResult DiffImages(const DiffImage& older, const DiffImage& newer)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+
+    DiffResult r;
+    r.threads = GlobalPool().size();
+
+    MatchFunctions(older, newer, r);
+    AlignBytes(older.bytes, newer.bytes, r);
+
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return r;
+}
+
+export struct Remapped
+{
+    std::size_t offset{};
+    DiffStatus  status{};
+    bool        aligned{};      // inside identical bytes; otherwise placed by function
+};
+
+// Where oldOffset of the old image went in the new one: through the
+// identical bytes around it when there are any, else at the same
+// distance into the function it belongs to. Nullopt when neither
+// tells.
+export std::optional<Remapped> RemapOffset(const DiffResult& d,
+    const pe::Layout& older,
+    const pe::Layout& newer,
+    std::size_t oldOffset)
+{
+    auto it = std::upper_bound(d.byOld.begin(), d.byOld.end(), oldOffset,
+        [](std::size_t v, const ByteRange& x) { return v < x.oldOffset; });
+    if (it != d.byOld.begin())
+    {
+        const auto& x = *std::prev(it);
+        if (oldOffset < x.oldOffset + x.length)
+        {
+            const std::size_t off = static_cast<std::size_t>(x.newOffset + (oldOffset - x.oldOffset));
+            return Remapped{ off, off == oldOffset ? DiffStatus::Unchanged : DiffStatus::Moved, true };
+        }
+    }
+
+    std::uint32_t rva{};
+    if (!FileToRva(older, oldOffset, rva))
+        return std::nullopt;
+
+    // Old functions come first, in RVA order.
+    const auto oldEnd = std::find_if(d.functions.begin(), d.functions.end(),
+        [](const FunctionMatch& m) { return m.oldRva == FunctionMatch::kNone; });
+    auto fn = std::upper_bound(d.functions.begin(), oldEnd, rva,
+        [](std::uint32_t v, const FunctionMatch& m) { return v < m.oldRva; });
+    if (fn == d.functions.begin())
+        return std::nullopt;
+
+    const auto& m = *std::prev(fn);
+    if (rva >= m.oldRva + m.oldSize || m.newRva == FunctionMatch::kNone)
+        return std::nullopt;
+
+    const std::uint32_t into = rva - m.oldRva;
+    std::size_t off{};
+    if (into >= m.newSize || !RvaToFile(newer, m.newRva + into, off))
+        return std::nullopt;
+
+    return Remapped{ off, m.status, false };
+}
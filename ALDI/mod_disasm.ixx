@@ -1,5 +1,7 @@
 export module mod_disasm;
 
+import mod_pe_utils;
+
 import <string>;
 import <sstream>;
 import <iomanip>;
@@ -8,139 +10,92 @@ import <cstdint>;
 import <vector>;
 import <span>;
 import <cstring>;
+import <atomic>;
 
 // Zydis include via vcpkg
 import "Zycore/Types.h";
 import "Zydis/Zydis.h";
 
-// -----------------------------------------------------------------------------
-// Minimal PE Layout helpers
-// -----------------------------------------------------------------------------
-
-struct PELayout
-{
-    bool        valid{};
-    bool        is64{};
-    std::uint64_t imageBase{};
-    std::uint32_t textRVA{};
-    std::uint32_t textRaw{};
-    std::uint32_t textRawSize{};
-};
-
-static bool ReadU16(std::span<const std::byte> d, std::size_t off, std::uint16_t& out)
+// ---------------------------------------------------------------------------
+// Decoder mode follows the image: 32-bit for PE32, long mode for PE32+,
+// ELF64 and raw blobs. Every decoder in ALDI is made here, and pointers
+// in the image are read at the width that mode gives them.
+// ---------------------------------------------------------------------------
+export bool Is64BitCode(const pe::Layout& L) noexcept
 {
-    if (off + 2 > d.size()) return false;
-    auto p = reinterpret_cast<const unsigned char*>(d.data() + off);
-    out = p[0] | (p[1] << 8);
-    return true;
+    return !L.valid || L.is64;
 }
 
-static bool ReadU32(std::span<const std::byte> d, std::size_t off, std::uint32_t& out)
+export std::size_t PointerSize(const pe::Layout& L) noexcept
 {
-    if (off + 4 > d.size()) return false;
-    auto p = reinterpret_cast<const unsigned char*>(d.data() + off);
-    out = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
-    return true;
+    return Is64BitCode(L) ? 8 : 4;
 }
 
-static bool ReadU64(std::span<const std::byte> d, std::size_t off, std::uint64_t& out)
+export ZyanStatus InitDecoder(ZydisDecoder& decoder, const pe::Layout& L)
 {
-    if (off + 8 > d.size()) return false;
-    auto p = reinterpret_cast<const unsigned char*>(d.data() + off);
-    out =
-        (std::uint64_t)p[0] |
-        ((std::uint64_t)p[1] << 8) |
-        ((std::uint64_t)p[2] << 16) |
-        ((std::uint64_t)p[3] << 24) |
-        ((std::uint64_t)p[4] << 32) |
-        ((std::uint64_t)p[5] << 40) |
-        ((std::uint64_t)p[6] << 48) |
-        ((std::uint64_t)p[7] << 56);
-    return true;
+    const bool is64 = Is64BitCode(L);
+    return ZydisDecoderInit(&decoder,
+        is64 ? ZYDIS_MACHINE_MODE_LONG_64 : ZYDIS_MACHINE_MODE_LEGACY_32,
+        is64 ? ZYDIS_STACK_WIDTH_64 : ZYDIS_STACK_WIDTH_32);
 }
 
-static PELayout AnalyzePE(std::span<const std::byte> data)
-{
-    PELayout L{};
-
-    if (data.size() < 0x200) return L;
-
-    // DOS
-    if ((char)data[0] != 'M' || (char)data[1] != 'Z')
-        return L;
-
-    std::uint32_t peoff{};
-    if (!ReadU32(data, 0x3C, peoff)) return L;
-
-    if (peoff + 0xF8 > data.size()) return L;
-    if ((char)data[peoff] != 'P' ||
-        (char)data[peoff + 1] != 'E')
-        return L;
-
-    // FILE HEADER
-    std::uint16_t sections{};
-    std::uint16_t optSize{};
-    ReadU16(data, peoff + 6, sections);
-    ReadU16(data, peoff + 20, optSize);
-
-    // OPTIONAL HEADER
-    std::uint16_t magic{};
-    ReadU16(data, peoff + 24, magic);
-    L.is64 = (magic == 0x20B);
+// ---------------------------------------------------------------------------
+// Symbolized operands: with the hook installed, an address that has a
+// name prints as "[KERNEL32.dll!CreateFileW]" instead of
+// "[0x140003010]". Names come from the pe::DataDirectories passed as
+// the formatter's user data; without one the hook is a no-op.
+// ---------------------------------------------------------------------------
+static std::atomic<ZydisFormatterFunc> g_printAddressAbs{ nullptr };
 
-    if (L.is64)
-        ReadU64(data, peoff + 24 + 24, L.imageBase);
-    else
-    {
-        std::uint32_t ib32{};
-        ReadU32(data, peoff + 24 + 28, ib32);
-        L.imageBase = ib32;
-    }
+static ZyanStatus PrintAddressAbs(const ZydisFormatter* formatter,
+    ZydisFormatterBuffer* buffer,
+    ZydisFormatterContext* context)
+{
+    const auto* dirs = static_cast<const pe::DataDirectories*>(context->user_data);
 
-    // SECTION TABLE
-    std::size_t sect = peoff + 24 + optSize;
-    for (int i = 0; i < sections; i++)
+    ZyanU64 addr{};
+    if (dirs &&
+        ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(context->instruction, context->operand,
+            context->runtime_address, &addr)) &&
+        addr >= dirs->image_base() && addr - dirs->image_base() < 0xFFFFFFFFull)
     {
-        const std::byte* s = data.data() + sect + i * 40;
-
-        char name[9]{};
-        for (int j = 0; j < 8; j++)
-            name[j] = (char)s[j];
-
-        if (std::string_view(name).starts_with(".text"))
+        const auto name = dirs->symbol(static_cast<std::uint32_t>(addr - dirs->image_base()));
+        if (!name.empty())
         {
-            ReadU32(data, sect + i * 40 + 12, L.textRVA);
-            ReadU32(data, sect + i * 40 + 20, L.textRaw);
-            ReadU32(data, sect + i * 40 + 16, L.textRawSize);
-
-            L.valid = true;
-            break;
+            ZyanString* str{};
+            ZYAN_CHECK(ZydisFormatterBufferAppend(buffer, ZYDIS_TOKEN_SYMBOL));
+            ZYAN_CHECK(ZydisFormatterBufferGetString(buffer, &str));
+            return ZyanStringAppendFormat(str, "%s", name.c_str());
         }
     }
 
-    return L;
+    return g_printAddressAbs.load(std::memory_order_relaxed)(formatter, buffer, context);
 }
 
-static bool FileFromRVA(const PELayout& L,
-    std::uint32_t rva,
-    std::size_t& out)
+export void SymbolizeFormatter(ZydisFormatter& fmt)
 {
-    if (!L.valid) return false;
-    if (rva < L.textRVA) return false;
-    std::uint32_t delta = rva - L.textRVA;
-    if (delta >= L.textRawSize) return false;
-    out = L.textRaw + delta;
-    return true;
+    const void* fn = reinterpret_cast<const void*>(&PrintAddressAbs);
+    ZydisFormatterSetHook(&fmt, ZYDIS_FORMATTER_FUNC_PRINT_ADDRESS_ABS, &fn);
+
+    // fn is now the built-in printer, which is the same for every
+    // Intel-style formatter.
+    const auto builtin = reinterpret_cast<ZydisFormatterFunc>(fn);
+    if (builtin != &PrintAddressAbs)
+        g_printAddressAbs.store(builtin, std::memory_order_relaxed);
 }
 
 // ---------------------------------------------------------------------------
-// Disassemble code region using Zydis 4.1.1 with PE-aware addressing
+// Disassemble code region using Zydis 4.1.1 with PE-aware addressing.
+// PE is the caller's cached layout of data; it is not re-parsed here.
+// With symbols, operands that hit a known address are printed by name.
 // ---------------------------------------------------------------------------
 export std::wstring DisasmRegion(
     std::span<const std::byte> data,
+    const pe::Layout& PE,
     std::size_t fileOffset,
     std::size_t size,
-    std::uint64_t baseAddress)
+    std::uint64_t baseAddress,
+    const pe::DataDirectories* symbols = nullptr)
 {
     const std::size_t max = std::min(fileOffset + size, data.size());
     if (fileOffset >= data.size() || max <= fileOffset)
@@ -148,25 +103,25 @@ export std::wstring DisasmRegion(
 
     std::wstringstream out;
 
-    const PELayout PE = AnalyzePE(data);
-
     if (!PE.valid)
     {
-        out << L"(Not a PE file — linear disasm)\r\n\r\n";
+        out << L"(Not a PE or ELF file — linear disasm)\r\n\r\n";
     }
 
     // Map offset→RVA (for real addresses)
     std::uint32_t rva{};
     if (PE.valid)
     {
-        if (fileOffset < PE.textRaw ||
-            fileOffset >= PE.textRaw + PE.textRawSize)
+        const pe::Section* text = PE.text();
+        if (!text ||
+            fileOffset < text->rawOffset ||
+            fileOffset >= static_cast<std::size_t>(text->rawOffset) + text->rawSize)
         {
             out << L"(Offset 0x" << std::hex << fileOffset
                 << L" is not in .text)\r\n";
             return out.str();
         }
-        rva = static_cast<std::uint32_t>(fileOffset - PE.textRaw + PE.textRVA);
+        rva = static_cast<std::uint32_t>(fileOffset - text->rawOffset + text->virtualAddress);
     }
     else
     {
@@ -174,10 +129,7 @@ export std::wstring DisasmRegion(
     }
 
     ZydisDecoder decoder{};
-    if (ZYAN_FAILED(ZydisDecoderInit(
-        &decoder,
-        ZYDIS_MACHINE_MODE_LONG_64,
-        ZYDIS_STACK_WIDTH_64)))
+    if (ZYAN_FAILED(InitDecoder(decoder, PE)))
     {
         return L"Decoder init failed\r\n";
     }
@@ -189,6 +141,7 @@ export std::wstring DisasmRegion(
     {
         return L"Formatter init failed\r\n";
     }
+    SymbolizeFormatter(fmt);
 
     ZyanUSize cur = 0;
     ZyanUSize avail = static_cast<ZyanUSize>(max - fileOffset);
@@ -222,7 +175,7 @@ export std::wstring DisasmRegion(
             buf,
             sizeof(buf),
             runtime,
-            nullptr);
+            const_cast<pe::DataDirectories*>(symbols));
 
         std::wstring ws;
         for (char c : std::string(buf))
@@ -242,17 +195,21 @@ export std::wstring DisasmRegion(
 
 // ---------------------------------------------------------------------------
 // VFT: virtual-function-table style RVA disassembly
+// Each slot decodes the one function it points at, as bounded by
+// functions; slots without an entry fall back to 64 bytes.
 // ---------------------------------------------------------------------------
 export std::wstring DisasmVFT(
     std::span<const std::byte> data,
+    const pe::Layout& PE,
+    std::span<const pe::Function> functions,
     std::size_t offset,
     std::size_t count,
-    std::uint64_t baseAddress)
+    std::uint64_t baseAddress,
+    const pe::DataDirectories* symbols = nullptr)
 {
     std::wstringstream out;
 
-    const PELayout PE = AnalyzePE(data);
-    const std::size_t ptrSize = PE.is64 ? 8 : 4;
+    const std::size_t ptrSize = PointerSize(PE);
 
     out << L"VFT @ 0x" << std::hex << offset << L"\r\n\r\n";
 
@@ -274,19 +231,36 @@ export std::wstring DisasmVFT(
         std::uint64_t va{};
         std::memcpy(&va, data.data() + off, ptrSize);
 
-        out << L"[#" << i << L"] 0x" << std::hex << va << L"\r\n";
-
         // Map VA→RVA→file offset
         std::uint32_t rva = static_cast<std::uint32_t>(va - PE.imageBase);
+
+        out << L"[#" << i << L"] 0x" << std::hex << va;
+        if (symbols)
+        {
+            const auto name = symbols->symbol(rva);
+            if (!name.empty())
+                out << L"  " << std::wstring(name.begin(), name.end());
+        }
+        out << L"\r\n";
         std::size_t codeOff{};
 
-        if (!PE.valid || !FileFromRVA(PE, rva, codeOff))
+        const pe::Section* text = PE.text();
+        if (!PE.valid || !text ||
+            !pe::rva_to_file(PE, rva, codeOff) ||
+            codeOff < text->rawOffset ||
+            codeOff >= static_cast<std::size_t>(text->rawOffset) + text->rawSize)
         {
             out << L"   (not in .text)\r\n\r\n";
             continue;
         }
 
-        out << DisasmRegion(data, codeOff, 64, baseAddress) << L"\r\n";
+        std::size_t size = 64;
+        if (const auto* fn = pe::find_function(functions, rva))
+            size = fn->end - rva;
+        else
+            out << L"   (no function entry, first 64 bytes)\r\n";
+
+        out << DisasmRegion(data, PE, codeOff, size, baseAddress, symbols) << L"\r\n";
     }
 
     return out.str();
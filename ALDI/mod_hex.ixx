@@ -2,79 +2,167 @@ export module mod_hex;
 
 import <string>;
 import <span>;
+import <array>;
 import <cstddef>;
 import <cstdint>;
-import <sstream>;
-import <iomanip>;
 import <algorithm>;
 
 export constexpr std::size_t kPageSize = 4096;
 
+// One rendered row:
+//   "00001000  48 8b 05 ... 90  H..............\r\n"
+// 8+ address digits, two spaces, 16 × "xx ", one space, up to 16
+// ASCII characters, CRLF.
+export constexpr std::size_t kHexRowBytes = 16;
+export constexpr std::size_t kHexRowChars = 8 + 2 + kHexRowBytes * 3 + 1 + kHexRowBytes + 2;
+
 template<typename T>
 static constexpr T mmin(T a, T b) noexcept
 {
     return (std::min)(a, b);
 }
 
-// Render a hex + ASCII view of a slice of bytes.
-export std::wstring HexPage(std::span<const std::byte> data,
+// ------------------------------------------------------------
+// Lookup tables: byte → two hex digits, byte → ASCII column.
+// ------------------------------------------------------------
+
+static constexpr char kDigits[] = "0123456789abcdef";
+
+static constexpr std::array<std::array<char, 2>, 256> kHexPairs = []
+    {
+        std::array<std::array<char, 2>, 256> t{};
+        for (std::size_t i = 0; i < 256; ++i)
+            t[i] = { kDigits[i >> 4], kDigits[i & 15] };
+        return t;
+    }();
+
+static constexpr std::array<char, 256> kPrintable = []
+    {
+        std::array<char, 256> t{};
+        for (std::size_t i = 0; i < 256; ++i)
+            t[i] = (i >= 32 && i < 127) ? static_cast<char>(i) : '.';
+        return t;
+    }();
+
+template<typename Char>
+static Char* PutAddress(Char* p, std::uint64_t addr) noexcept
+{
+    // Same as setw(8) << hex: at least 8 digits, more when needed.
+    int digits = 8;
+    while (digits < 16 && (addr >> (digits * 4)) != 0)
+        ++digits;
+
+    for (int i = digits - 1; i >= 0; --i)
+        *p++ = static_cast<Char>(kDigits[(addr >> (i * 4)) & 15]);
+
+    return p;
+}
+
+// Append the hex + ASCII rows for [off, off + cnt) to out.
+//
+// out is the caller's buffer and is only ever grown, so a caller
+// that keeps it around (and clears it between uses) renders
+// without allocating once it is large enough.
+export template<typename Char>
+void HexFormatRows(std::span<const std::byte> data,
     std::size_t off,
-    std::size_t cnt)
+    std::size_t cnt,
+    std::basic_string<Char>& out)
 {
     const std::size_t end = mmin(off + cnt, data.size());
     const std::size_t n = (end > off) ? (end - off) : 0;
+    if (n == 0)
+        return;
 
-    std::wstringstream out;
+    const std::size_t rows = (n + kHexRowBytes - 1) / kHexRowBytes;
 
-    for (std::size_t i = 0; i < n; i += 16)
+    // 8 extra address digits per row covers offsets past 4 GB.
+    const std::size_t base = out.size();
+    out.resize(base + rows * (kHexRowChars + 8));
+
+    Char* p = out.data() + base;
+    const auto* src = reinterpret_cast<const unsigned char*>(data.data() + off);
+
+    for (std::size_t i = 0; i < n; i += kHexRowBytes)
     {
-        const std::size_t addr = off + i;
+        const std::size_t len = mmin(kHexRowBytes, n - i);
 
-        out << std::hex << std::setw(8) << std::setfill(L'0')
-            << addr << L"  ";
+        p = PutAddress(p, off + i);
+        *p++ = Char(' ');
+        *p++ = Char(' ');
 
-        for (std::size_t j = 0; j < 16; ++j)
+        for (std::size_t j = 0; j < kHexRowBytes; ++j)
         {
-            if (i + j < n)
+            if (j < len)
             {
-                unsigned v = std::to_integer<unsigned char>(data[off + i + j]);
-                out << std::setw(2) << v << L" ";
+                const auto& h = kHexPairs[src[i + j]];
+                p[0] = static_cast<Char>(h[0]);
+                p[1] = static_cast<Char>(h[1]);
             }
             else
             {
-                out << L"   ";
+                p[0] = Char(' ');
+                p[1] = Char(' ');
             }
+            p[2] = Char(' ');
+            p += 3;
         }
 
-        out << L" ";
+        *p++ = Char(' ');
 
-        for (std::size_t j = 0; j < 16 && (i + j) < n; ++j)
-        {
-            unsigned char c = std::to_integer<unsigned char>(data[off + i + j]);
-            out << ((c >= 32 && c < 127) ? wchar_t(c) : L'.');
-        }
+        for (std::size_t j = 0; j < len; ++j)
+            *p++ = static_cast<Char>(kPrintable[src[i + j]]);
 
-        out << L"\r\n";
+        *p++ = Char('\r');
+        *p++ = Char('\n');
     }
 
-    return out.str();
+    out.resize(static_cast<std::size_t>(p - out.data()));
 }
 
-export std::wstring HexDumpRegion(std::span<const std::byte> data,
+// Render a hex + ASCII view of a slice of bytes.
+export std::wstring HexPage(std::span<const std::byte> data,
     std::size_t off,
-    std::size_t size)
+    std::size_t cnt)
+{
+    std::wstring out;
+    HexFormatRows(data, off, cnt, out);
+    return out;
+}
+
+// Append "Dump @ 0x<OFF>, size <n>" and the rows to out.
+export template<typename Char>
+void HexDumpRegionTo(std::span<const std::byte> data,
+    std::size_t off,
+    std::size_t size,
+    std::basic_string<Char>& out)
 {
     const std::size_t end = mmin(off + size, data.size());
     const std::size_t n = (end > off) ? (end - off) : 0;
 
-    std::wstringstream out;
-    out << std::uppercase
-        << L"Dump @ 0x"
-        << std::hex << off
-        << L", size "
-        << std::dec << n
-        << L"\r\n\r\n";
+    constexpr char kUpper[] = "0123456789ABCDEF";
 
-    out << HexPage(data, off, n);
-    return out.str();
+    char hex[17]{};
+    int h = 16;
+    std::uint64_t v = off;
+    do
+    {
+        hex[--h] = kUpper[v & 15];
+        v >>= 4;
+    } while (v);
+
+    const std::string head = std::string("Dump @ 0x") + (hex + h) +
+        ", size " + std::to_string(n) + "\r\n\r\n";
+
+    out.append(head.begin(), head.end());
+    HexFormatRows(data, off, n, out);
+}
+
+export std::wstring HexDumpRegion(std::span<const std::byte> data,
+    std::size_t off,
+    std::size_t size)
+{
+    std::wstring out;
+    HexDumpRegionTo(data, off, size, out);
+    return out;
 }
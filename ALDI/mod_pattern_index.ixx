@@ -0,0 +1,450 @@
+export module mod_pattern_index;
+
+import mod_patterns;
+
+import <vector>;
+import <span>;
+import <memory>;
+import <mutex>;
+import <thread>;
+import <stop_token>;
+import <optional>;
+import <chrono>;
+import <bit>;
+import <cstddef>;
+import <cstdint>;
+import <algorithm>;
+import <utility>;
+
+// ------------------------------------------------------------
+// Trigram index for repeated pattern queries
+//
+// Every position of the file is filed under the three bytes that
+// start there, hashed into a bucket table sized to the file: CSR,
+// bucket → ascending positions. A query looks up the rarest run
+// of three exact bytes in the pattern and checks only the
+// positions listed for it, so a signature that is tweaked and
+// retried costs a few hundred compares instead of a pass.
+//
+// Buckets that would push the table past its memory budget are
+// left out, the fullest first (zero and int3 padding, mostly).
+// Patterns anchored only on those, and patterns without three
+// exact bytes in a row, go to the linear scanner.
+// ------------------------------------------------------------
+
+static std::uint32_t GramBucket(const unsigned char* p, unsigned bits) noexcept
+{
+    const std::uint32_t g = p[0] | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16);
+    return bits >= 24 ? g : (g * 0x9E3779B1u) >> (32 - bits);
+}
+
+static bool MatchAt(const unsigned char* d, const Pattern& pat) noexcept
+{
+    for (std::size_t k = 0; k < pat.size(); ++k)
+    {
+        if ((d[k] & pat.mask[k]) != pat.value[k])
+            return false;
+    }
+    return true;
+}
+
+class GramTable
+{
+public:
+    static constexpr unsigned    kMinBits = 12;
+    static constexpr unsigned    kMaxBits = 24;
+    static constexpr std::size_t kCheckEvery = std::size_t(1) << 20;
+
+    // Null when stopped, when the file is too small or too large for
+    // 32-bit positions, or when not even the bucket table fits.
+    static std::unique_ptr<GramTable> build(std::span<const std::byte> data,
+        std::size_t budget,
+        std::stop_token stop)
+    {
+        const std::size_t n = data.size();
+        if (n < 3 || n > UINT32_MAX)
+            return nullptr;
+
+        const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+
+        // About eight positions per bucket, and the bucket table
+        // itself at most a quarter of the budget.
+        unsigned bits = std::clamp<unsigned>(static_cast<unsigned>(std::bit_width(n / 8)), kMinBits, kMaxBits);
+        auto fixedBytes = [](unsigned b) { return ((std::size_t(1) << b) + 1) * 4 + (std::size_t(1) << b) / 8; };
+        while (bits > kMinBits && fixedBytes(bits) > budget / 4)
+            --bits;
+        if (fixedBytes(bits) >= budget)
+            return nullptr;
+
+        auto t = std::make_unique<GramTable>();
+        t->m_bits = bits;
+        t->m_size = n;
+
+        const std::size_t buckets = std::size_t(1) << bits;
+        const std::size_t grams = n - 2;
+
+        auto& start = t->m_start;
+        start.assign(buckets + 1, 0);
+        for (std::size_t i = 0; i < grams; ++i)
+        {
+            if (i % kCheckEvery == 0 && stop.stop_requested())
+                return nullptr;
+            ++start[GramBucket(d + i, bits)];
+        }
+
+        // Over budget: leave out the fullest buckets until the rest fits.
+        std::size_t kept = grams;
+        if (fixedBytes(bits) + kept * 4 > budget)
+        {
+            std::vector<std::uint32_t> order;
+            for (std::uint32_t b = 0; b < buckets; ++b)
+            {
+                if (start[b])
+                    order.push_back(b);
+            }
+            std::sort(order.begin(), order.end(),
+                [&](std::uint32_t a, std::uint32_t b) { return start[a] > start[b]; });
+
+            t->m_dropped.assign((buckets + 63) / 64, 0);
+            for (const auto b : order)
+            {
+                if (fixedBytes(bits) + kept * 4 <= budget)
+                    break;
+
+                kept -= start[b];
+                t->m_droppedGrams += start[b];
+                ++t->m_droppedBuckets;
+                start[b] = 0;
+                t->m_dropped[b / 64] |= std::uint64_t(1) << (b % 64);
+            }
+        }
+
+        // Inclusive sums, then fill from the back so that every
+        // bucket ends up ascending and start[b] at its first entry.
+        for (std::size_t b = 0; b < buckets; ++b)
+            start[b + 1] += start[b];
+
+        auto& pos = t->m_positions;
+        pos.resize(kept);
+        for (std::size_t i = grams; i-- > 0;)
+        {
+            if (i % kCheckEvery == 0 && stop.stop_requested())
+                return nullptr;
+
+            const auto b = GramBucket(d + i, bits);
+            if (!t->dropped(b))
+                pos[--start[b]] = static_cast<std::uint32_t>(i);
+        }
+        start[buckets] = static_cast<std::uint32_t>(kept);
+
+        return t;
+    }
+
+    [[nodiscard]] std::size_t file_size() const noexcept { return m_size; }
+    [[nodiscard]] std::size_t buckets() const noexcept { return m_start.size() - 1; }
+    [[nodiscard]] std::size_t dropped_buckets() const noexcept { return m_droppedBuckets; }
+    [[nodiscard]] std::size_t dropped_positions() const noexcept { return m_droppedGrams; }
+
+    [[nodiscard]] std::size_t memory() const noexcept
+    {
+        return (m_start.size() + m_positions.size()) * sizeof(std::uint32_t) +
+            m_dropped.size() * sizeof(std::uint64_t);
+    }
+
+    // Matches starting in [begin, last], taken from the postings of
+    // the pattern's rarest indexed trigram and checked against data.
+    // Nullopt when the pattern has no indexed trigram.
+    std::optional<std::vector<std::size_t>> find_all(std::span<const std::byte> data,
+        const Pattern& pat,
+        std::size_t begin,
+        std::size_t last,
+        std::size_t limit) const
+    {
+        const std::size_t m = pat.size();
+
+        std::size_t anchor = SIZE_MAX;
+        std::uint32_t anchorBucket = 0;
+        std::uint32_t fewest = UINT32_MAX;
+
+        for (std::size_t i = 0; i + 3 <= m; ++i)
+        {
+            if (pat.mask[i] != 0xFF || pat.mask[i + 1] != 0xFF || pat.mask[i + 2] != 0xFF)
+                continue;
+
+            const auto b = GramBucket(pat.value.data() + i, m_bits);
+            if (dropped(b))
+                continue;
+
+            const std::uint32_t count = m_start[b + 1] - m_start[b];
+            if (count < fewest)
+            {
+                fewest = count;
+                anchor = i;
+                anchorBucket = b;
+            }
+        }
+
+        if (anchor == SIZE_MAX)
+            return std::nullopt;
+
+        std::vector<std::size_t> hits;
+
+        const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+        const auto first = m_positions.begin() + m_start[anchorBucket];
+        const auto end = m_positions.begin() + m_start[anchorBucket + 1];
+
+        for (auto it = std::lower_bound(first, end, begin + anchor); it != end && hits.size() < limit; ++it)
+        {
+            const std::size_t p = *it - anchor;
+            if (p > last)
+                break;
+            if (MatchAt(d + p, pat))
+                hits.push_back(p);
+        }
+
+        return hits;
+    }
+
+private:
+    [[nodiscard]] bool dropped(std::uint32_t b) const noexcept
+    {
+        return !m_dropped.empty() && (m_dropped[b / 64] >> (b % 64)) & 1;
+    }
+
+    unsigned                   m_bits{};
+    std::size_t                m_size{};
+    std::vector<std::uint32_t> m_start;         // bucket → first posting; one extra at the end
+    std::vector<std::uint32_t> m_positions;
+    std::vector<std::uint64_t> m_dropped;       // bit per bucket left out for the budget
+    std::size_t                m_droppedBuckets{};
+    std::size_t                m_droppedGrams{};
+};
+
+// ------------------------------------------------------------
+// Background build and patches
+//
+// The table is built on a thread of its own and published when
+// done; until then queries go to the linear scanner. Patched
+// ranges are not refiled: they are kept as a list and scanned
+// linearly on every query next to the postings (a patched
+// position may still sit in its old bucket, which the check
+// against the live bytes rejects). Once the list is long enough
+// that the scans add up, the table is rebuilt.
+// ------------------------------------------------------------
+
+export class PatternIndex
+{
+public:
+    static constexpr std::size_t kDefaultBudget = std::size_t(256) << 20;
+    static constexpr std::size_t kMaxPatches = 256;
+
+    enum class Status
+    {
+        Off,
+        Building,
+        Ready,
+        Unavailable     // file too small or too large, or budget too small
+    };
+
+    struct Stats
+    {
+        Status      status{};
+        std::size_t budget{};
+        std::size_t memory{};
+        std::size_t buckets{};
+        std::size_t droppedBuckets{};
+        std::size_t droppedPositions{};
+        std::size_t patches{};
+        double      seconds{};
+    };
+
+    PatternIndex() = default;
+    PatternIndex(const PatternIndex&) = delete;
+    PatternIndex& operator=(const PatternIndex&) = delete;
+
+    ~PatternIndex()
+    {
+        stop();
+    }
+
+    // Drop whatever was built and start over on data, which has to
+    // stay mapped until stop().
+    void build(std::span<const std::byte> data, std::size_t budget = kDefaultBudget)
+    {
+        stop();
+
+        {
+            std::lock_guard lk(m_mutex);
+            m_data = data;
+            m_budget = budget;
+            m_status = Status::Building;
+            m_patches.clear();
+        }
+
+        m_builder = std::jthread([this, data, budget](std::stop_token st)
+            {
+                const auto t0 = std::chrono::steady_clock::now();
+                std::shared_ptr<const GramTable> table = GramTable::build(data, budget, st);
+                const std::chrono::duration<double> took = std::chrono::steady_clock::now() - t0;
+
+                if (st.stop_requested())
+                    return;
+
+                std::lock_guard lk(m_mutex);
+                m_table = std::move(table);
+                m_status = m_table ? Status::Ready : Status::Unavailable;
+                m_seconds = took.count();
+            });
+    }
+
+    // Drop the table; a build in progress is stopped and waited for.
+    void stop()
+    {
+        if (m_builder.joinable())
+        {
+            m_builder.request_stop();
+            m_builder.join();
+        }
+
+        std::lock_guard lk(m_mutex);
+        m_table.reset();
+        m_status = Status::Off;
+        m_data = {};
+        m_patches.clear();
+    }
+
+    // Bytes in [off, off + len) changed.
+    void invalidate(std::size_t off, std::size_t len)
+    {
+        std::unique_lock lk(m_mutex);
+        if (m_status != Status::Building && m_status != Status::Ready)
+            return;
+
+        // Merge with overlapping or touching ranges; kept sorted.
+        std::size_t lo = off;
+        std::size_t hi = off + len;
+
+        auto it = std::lower_bound(m_patches.begin(), m_patches.end(), lo,
+            [](const auto& r, std::size_t v) { return r.second < v; });
+        auto last = it;
+        while (last != m_patches.end() && last->first <= hi)
+        {
+            lo = (std::min)(lo, last->first);
+            hi = (std::max)(hi, last->second);
+            ++last;
+        }
+        it = m_patches.erase(it, last);
+        m_patches.insert(it, { lo, hi });
+
+        if (m_status != Status::Ready || m_patches.size() <= kMaxPatches)
+            return;
+
+        const auto data = m_data;
+        const auto budget = m_budget;
+        lk.unlock();
+        build(data, budget);
+    }
+
+    [[nodiscard]] Stats stats() const
+    {
+        std::lock_guard lk(m_mutex);
+
+        Stats s;
+        s.status = m_status;
+        s.budget = m_budget;
+        s.patches = m_patches.size();
+        s.seconds = m_seconds;
+        if (m_table)
+        {
+            s.memory = m_table->memory();
+            s.buckets = m_table->buckets();
+            s.droppedBuckets = m_table->dropped_buckets();
+            s.droppedPositions = m_table->dropped_positions();
+        }
+        return s;
+    }
+
+    // What FindPatternAll(data, pat, start, limit) would return, or nullopt
+    // when the index cannot answer: not built, built over other
+    // bytes, or no indexed trigram in pat. data may be a prefix of
+    // the indexed bytes, to cut the search short.
+    std::optional<std::vector<std::size_t>> find_all(std::span<const std::byte> data,
+        const Pattern& pat,
+        std::size_t start,
+        std::size_t limit = SIZE_MAX) const
+    {
+        if (pat.empty() || pat.mask.size() != pat.size())
+            return std::nullopt;
+
+        std::shared_ptr<const GramTable> table;
+        std::vector<std::pair<std::size_t, std::size_t>> patches;
+        {
+            std::lock_guard lk(m_mutex);
+            if (!m_table || data.data() != m_data.data() || data.size() > m_table->file_size())
+                return std::nullopt;
+
+            table = m_table;
+            patches = m_patches;
+        }
+
+        const std::size_t m = pat.size();
+        if (m > data.size() || start > data.size() - m)
+            return std::vector<std::size_t>{};
+
+        const std::size_t last = data.size() - m;
+        auto hits = table->find_all(data, pat, start, last, limit);
+        if (!hits)
+            return std::nullopt;
+
+        // Windows that overlap a patch are scanned as they are now.
+        bool patched = false;
+        for (const auto& [lo, hi] : patches)
+        {
+            const std::size_t a = (std::max)(start, lo >= m - 1 ? lo - (m - 1) : 0);
+            const std::size_t b = (std::min)(last + 1, hi);
+            if (a >= b)
+                continue;
+
+            auto more = FindPatternAll(data.first(b + m - 1), pat, a, limit);
+            hits->insert(hits->end(), more.begin(), more.end());
+            patched = true;
+        }
+
+        if (patched)
+        {
+            std::sort(hits->begin(), hits->end());
+            hits->erase(std::unique(hits->begin(), hits->end()), hits->end());
+            if (hits->size() > limit)
+                hits->resize(limit);
+        }
+
+        return hits;
+    }
+
+private:
+    mutable std::mutex                  m_mutex;
+    std::shared_ptr<const GramTable>    m_table;
+    Status                              m_status{ Status::Off };
+    std::span<const std::byte>          m_data{};
+    std::size_t                         m_budget{ kDefaultBudget };
+    double                              m_seconds{};
+
+    // Patched ranges [first, second) since the build started.
+    std::vector<std::pair<std::size_t, std::size_t>> m_patches;
+
+    std::jthread                        m_builder;
+};
+
+// Every match at or after start, or the first limit of them, from
+// the index when it can answer and from the linear scanner otherwise.
+export std::vector<std::size_t> FindPatternAll(std::span<const std::byte> data,
+    const Pattern& pat,
+    std::size_t start,
+    const PatternIndex& index,
+    std::size_t limit = SIZE_MAX)
+{
+    if (auto hits = index.find_all(data, pat, start, limit))
+        return std::move(*hits);
+
+    return FindPatternAll(data, pat, start, limit);
+}
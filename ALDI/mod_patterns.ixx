@@ -1,18 +1,39 @@
+module;
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ALDI_SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ALDI_TARGET_AVX2
+#else
+#define ALDI_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
 export module mod_patterns;
 
+import mod_threadpool;
+
 import <string>;
 import <vector>;
 import <cstddef>;
 import <cstdint>;
+import <cstring>;
 import <cwctype>;
 import <stdexcept>;
 import <span>;
+import <array>;
+import <bit>;
+import <algorithm>;
+import <utility>;
+import <atomic>;
 
 // Parse hex bytes from something like:
 //   L"48 8B 05 39 00 13 00"
-//   L"48 8B 05 ?? ?? ?? ??"
 // Non-hex chars are stripped; odd trailing nibble is dropped.
-// "??" are simply ignored (treated as wildcards upstream if desired).
+// Wildcards make no sense for written bytes; use ParsePattern
+// for signatures.
 export std::vector<unsigned char> ParseHexBytes(const std::wstring& hex)
 {
     std::wstring cleaned;
@@ -86,28 +107,801 @@ export std::size_t ParseOffset(const std::wstring& s, std::size_t baseOffset)
     return static_cast<std::size_t>(std::stoull(t, nullptr, 0));
 }
 
-// Simple linear pattern search.
-// Returns std::wstring::npos on failure.
+// ------------------------------------------------------------
+// Signature patterns
+// ------------------------------------------------------------
+
+// A byte signature with a per-byte mask. A byte matches when
+// (data & mask) == value; mask 0xFF is an exact byte, 0x00 is "??",
+// and 0xF0 / 0x0F are nibble wildcards such as "4?".
+export struct Pattern
+{
+    std::vector<unsigned char> value;
+    std::vector<unsigned char> mask;
+
+    [[nodiscard]] std::size_t size() const noexcept { return value.size(); }
+    [[nodiscard]] bool empty() const noexcept { return value.empty(); }
+};
+
+export Pattern MakePattern(const std::vector<unsigned char>& bytes)
+{
+    return { bytes, std::vector<unsigned char>(bytes.size(), 0xFF) };
+}
+
+// Parse IDA / x64dbg style signatures:
+//   L"48 8B 05 ?? ?? ?? ?? 48 85 C0"
+//   L"48 8B 05 ? ? ? ? E8"
+//   L"488B05????????"
+//   L"4? 8B"
+// A lone "?" token is a whole wildcard byte; otherwise characters
+// pair up into bytes with '?' standing for a wildcard nibble.
+export Pattern ParsePattern(const std::wstring& text)
+{
+    auto nibble = [](wchar_t c) noexcept -> int
+        {
+            if (c >= L'0' && c <= L'9') return c - L'0';
+            if (c >= L'a' && c <= L'f') return c - L'a' + 10;
+            if (c >= L'A' && c <= L'F') return c - L'A' + 10;
+            return -1;
+        };
+
+    Pattern out;
+    std::wstring tok;
+
+    auto flush = [&]
+        {
+            if (tok == L"?")
+            {
+                out.value.push_back(0);
+                out.mask.push_back(0);
+            }
+            else
+            {
+                for (std::size_t i = 0; i + 1 < tok.size(); i += 2)
+                {
+                    int hi = nibble(tok[i]);
+                    int lo = nibble(tok[i + 1]);
+
+                    unsigned char v = 0, m = 0;
+                    if (hi >= 0) { v |= static_cast<unsigned char>(hi << 4); m |= 0xF0; }
+                    if (lo >= 0) { v |= static_cast<unsigned char>(lo);      m |= 0x0F; }
+
+                    out.value.push_back(v);
+                    out.mask.push_back(m);
+                }
+            }
+            tok.clear();
+        };
+
+    for (wchar_t c : text)
+    {
+        if (iswspace(c))
+        {
+            flush();
+            continue;
+        }
+
+        if (c == L'?' || nibble(c) >= 0)
+            tok.push_back(c);
+    }
+    flush();
+
+    return out;
+}
+
+// ------------------------------------------------------------
+// Scanner
+//
+// Pick the two rarest exact bytes of the pattern as anchors,
+// compare both anchors against 32 (AVX2) or 16 (SSE2) positions
+// at once, and run the full masked compare only on positions
+// where both anchors hit. Patterns without an exact byte fall
+// back to the scalar loop.
+// ------------------------------------------------------------
+
+struct ScanPlan
+{
+    const unsigned char* value{};
+    const unsigned char* mask{};
+    std::size_t          size{};
+
+    bool          anchored{};
+    std::size_t   a1{}, a2{};
+    unsigned char v1{}, v2{};
+};
+
+// Byte frequencies from up to 64 KB spread over the range, so the
+// anchor choice fits the data (0x00 / 0xCC / 0x48 in code, text in
+// .rdata) instead of a fixed table.
+static std::array<std::uint32_t, 256> SampleHistogram(const std::byte* d, std::size_t n)
+{
+    std::array<std::uint32_t, 256> h{};
+
+    constexpr std::size_t kBlocks = 16;
+    constexpr std::size_t kBlock = 4096;
+
+    if (n <= kBlocks * kBlock)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            ++h[std::to_integer<unsigned char>(d[i])];
+        return h;
+    }
+
+    const std::size_t stride = n / kBlocks;
+    for (std::size_t b = 0; b < kBlocks; ++b)
+    {
+        const std::byte* p = d + b * stride;
+        for (std::size_t i = 0; i < kBlock; ++i)
+            ++h[std::to_integer<unsigned char>(p[i])];
+    }
+
+    return h;
+}
+
+static ScanPlan MakePlan(const Pattern& pat, const std::byte* d, std::size_t n)
+{
+    ScanPlan plan{ pat.value.data(), pat.mask.data(), pat.size() };
+
+    std::size_t best = SIZE_MAX, second = SIZE_MAX;
+    std::uint32_t bestF = UINT32_MAX, secondF = UINT32_MAX;
+
+    const auto hist = SampleHistogram(d, n);
+
+    for (std::size_t i = 0; i < pat.size(); ++i)
+    {
+        if (pat.mask[i] != 0xFF)
+            continue;
+
+        const std::uint32_t f = hist[pat.value[i]];
+        if (f < bestF)
+        {
+            second = best; secondF = bestF;
+            best = i; bestF = f;
+        }
+        else if (f < secondF)
+        {
+            second = i; secondF = f;
+        }
+    }
+
+    if (best == SIZE_MAX)
+        return plan;
+
+    if (second == SIZE_MAX)
+        second = best;
+
+    plan.anchored = true;
+    plan.a1 = best;
+    plan.a2 = second;
+    plan.v1 = pat.value[best];
+    plan.v2 = pat.value[second];
+    return plan;
+}
+
+static inline bool MatchAt(const ScanPlan& p, const std::byte* at) noexcept
+{
+    const auto* d = reinterpret_cast<const unsigned char*>(at);
+    for (std::size_t i = 0; i < p.size; ++i)
+    {
+        if ((d[i] & p.mask[i]) != p.value[i])
+            return false;
+    }
+    return true;
+}
+
+// Every kernel checks candidate start positions in [begin, end).
+// If hits is null it returns the first match; otherwise it appends
+// every match to *hits and returns npos.
+using ScanKernel = std::size_t(*)(const ScanPlan&, const std::byte*,
+    std::size_t, std::size_t, std::vector<std::size_t>*);
+
+static std::size_t ScanScalar(const ScanPlan& p, const std::byte* d,
+    std::size_t begin, std::size_t end, std::vector<std::size_t>* hits)
+{
+    if (!p.anchored)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            if (!MatchAt(p, d + i))
+                continue;
+            if (!hits)
+                return i;
+            hits->push_back(i);
+        }
+        return std::wstring::npos;
+    }
+
+    // memchr on the rarest byte does the skipping for us.
+    const auto* base = reinterpret_cast<const unsigned char*>(d);
+    std::size_t i = begin;
+
+    while (i < end)
+    {
+        const void* q = std::memchr(base + i + p.a1, p.v1, end - i);
+        if (!q)
+            break;
+
+        const std::size_t cand = static_cast<const unsigned char*>(q) - base - p.a1;
+        if (base[cand + p.a2] == p.v2 && MatchAt(p, d + cand))
+        {
+            if (!hits)
+                return cand;
+            hits->push_back(cand);
+        }
+        i = cand + 1;
+    }
+
+    return std::wstring::npos;
+}
+
+#ifdef ALDI_SCAN_X86
+
+static std::size_t ScanSSE2(const ScanPlan& p, const std::byte* d,
+    std::size_t begin, std::size_t end, std::vector<std::size_t>* hits)
+{
+    if (!p.anchored)
+        return ScanScalar(p, d, begin, end, hits);
+
+    const __m128i v1 = _mm_set1_epi8(static_cast<char>(p.v1));
+    const __m128i v2 = _mm_set1_epi8(static_cast<char>(p.v2));
+
+    std::size_t i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i + p.a1));
+        const __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i + p.a2));
+
+        unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(b1, v1), _mm_cmpeq_epi8(b2, v2))));
+
+        while (bits)
+        {
+            const std::size_t cand = i + std::countr_zero(bits);
+            bits &= bits - 1;
+
+            if (MatchAt(p, d + cand))
+            {
+                if (!hits)
+                    return cand;
+                hits->push_back(cand);
+            }
+        }
+    }
+
+    return ScanScalar(p, d, i, end, hits);
+}
+
+ALDI_TARGET_AVX2
+static std::size_t ScanAVX2(const ScanPlan& p, const std::byte* d,
+    std::size_t begin, std::size_t end, std::vector<std::size_t>* hits)
+{
+    if (!p.anchored)
+        return ScanScalar(p, d, begin, end, hits);
+
+    const __m256i v1 = _mm256_set1_epi8(static_cast<char>(p.v1));
+    const __m256i v2 = _mm256_set1_epi8(static_cast<char>(p.v2));
+
+    std::size_t i = begin;
+    for (; i + 32 <= end; i += 32)
+    {
+        const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + i + p.a1));
+        const __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + i + p.a2));
+
+        std::uint32_t bits = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(b1, v1), _mm256_cmpeq_epi8(b2, v2))));
+
+        while (bits)
+        {
+            const std::size_t cand = i + std::countr_zero(bits);
+            bits &= bits - 1;
+
+            if (MatchAt(p, d + cand))
+            {
+                if (!hits)
+                    return cand;
+                hits->push_back(cand);
+            }
+        }
+    }
+
+    return ScanScalar(p, d, i, end, hits);
+}
+
+static bool CpuHasAVX2() noexcept
+{
+#ifdef _MSC_VER
+    int r[4]{};
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return false;
+
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    const bool avx = (r[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+
+    // OS must save YMM state.
+    if ((_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // ALDI_SCAN_X86
+
+static ScanKernel SelectKernel() noexcept
+{
+#ifdef ALDI_SCAN_X86
+    static const ScanKernel k = CpuHasAVX2() ? &ScanAVX2 : &ScanSSE2;
+    return k;
+#else
+    return &ScanScalar;
+#endif
+}
+
+// ------------------------------------------------------------
+// Chunked parallel driver
+//
+// Candidate start positions are split into kScanChunk slices.
+// A slice only owns the starts in [begin, end) but its compares
+// read up to pattern_length - 1 bytes past end, which is the
+// overlap that keeps hits straddling a boundary. Small ranges
+// run inline; the pool is not worth it below one chunk.
+// ------------------------------------------------------------
+
+constexpr std::size_t kScanChunk = std::size_t(4) << 20;
+
+static std::size_t ChunkCount(std::size_t begin, std::size_t end) noexcept
+{
+    return (end - begin + kScanChunk - 1) / kScanChunk;
+}
+
+// Returns the first match at or after start, or std::wstring::npos.
 export std::size_t FindPattern(std::span<const std::byte> data,
-    const std::vector<unsigned char>& pat,
+    const Pattern& pat,
     std::size_t start)
 {
-    if (pat.empty() || start >= data.size())
+    if (pat.empty() || pat.mask.size() != pat.size() || start >= data.size())
         return std::wstring::npos;
 
     const std::size_t n = data.size();
     const std::size_t m = pat.size();
-    if (m > n)
+    if (m > n || start > n - m)
         return std::wstring::npos;
 
-    const unsigned char* p = pat.data();
-    const std::byte* d = data.data();
+    const ScanPlan plan = MakePlan(pat, data.data() + start, n - start);
+    const ScanKernel kernel = SelectKernel();
+    const std::size_t end = n - m + 1;
+
+    const std::size_t chunks = ChunkCount(start, end);
+    if (chunks <= 1)
+        return kernel(plan, data.data(), start, end, nullptr);
+
+    // Slices past the earliest one with a hit can be skipped; slices
+    // before it still run since they may hold an earlier hit.
+    std::vector<std::size_t> found(chunks, std::wstring::npos);
+    std::atomic<std::size_t> firstHit{ chunks };
+
+    GlobalPool().parallel_for(chunks, [&](std::size_t c)
+        {
+            if (c > firstHit.load(std::memory_order_relaxed))
+                return;
+
+            JobCheckpoint();
+
+            const std::size_t b = start + c * kScanChunk;
+            const std::size_t e = (std::min)(b + kScanChunk, end);
+
+            const std::size_t hit = kernel(plan, data.data(), b, e, nullptr);
+            JobBytes(e - b);
+            if (hit == std::wstring::npos)
+                return;
 
-    for (std::size_t i = start; i + m <= n; ++i)
+            found[c] = hit;
+
+            std::size_t cur = firstHit.load(std::memory_order_relaxed);
+            while (c < cur && !firstHit.compare_exchange_weak(cur, c))
+            {
+            }
+        });
+
+    for (std::size_t hit : found)
     {
-        if (std::memcmp(d + i, p, m) == 0)
-            return i;
+        if (hit != std::wstring::npos)
+            return hit;
     }
 
     return std::wstring::npos;
 }
+
+// Every match at or after start, in offset order.
+export std::vector<std::size_t> FindPatternAll(std::span<const std::byte> data,
+    const Pattern& pat,
+    std::size_t start)
+{
+    std::vector<std::size_t> hits;
+
+    if (pat.empty() || pat.mask.size() != pat.size() || start >= data.size())
+        return hits;
+
+    const std::size_t n = data.size();
+    const std::size_t m = pat.size();
+    if (m > n || start > n - m)
+        return hits;
+
+    const ScanPlan plan = MakePlan(pat, data.data() + start, n - start);
+    const ScanKernel kernel = SelectKernel();
+    const std::size_t end = n - m + 1;
+
+    const std::size_t chunks = ChunkCount(start, end);
+    std::vector<std::vector<std::size_t>> parts(chunks);
+
+    GlobalPool().parallel_for(chunks, [&](std::size_t c)
+        {
+            JobCheckpoint();
+
+            const std::size_t b = start + c * kScanChunk;
+            const std::size_t e = (std::min)(b + kScanChunk, end);
+            kernel(plan, data.data(), b, e, &parts[c]);
+            JobBytes(e - b);
+        });
+
+    std::size_t total = 0;
+    for (const auto& p : parts)
+        total += p.size();
+
+    hits.reserve(total);
+    for (const auto& p : parts)
+        hits.insert(hits.end(), p.begin(), p.end());
+
+    return hits;
+}
+
+// The first limit matches at or after start, in offset order. Slices
+// are scanned a pool's worth at a time and each stops at limit hits,
+// so a pattern that matches everywhere costs at most limit hits per
+// worker instead of one per match in the file.
+export std::vector<std::size_t> FindPatternAll(std::span<const std::byte> data,
+    const Pattern& pat,
+    std::size_t start,
+    std::size_t limit)
+{
+    if (limit == SIZE_MAX)
+        return FindPatternAll(data, pat, start);
+
+    std::vector<std::size_t> hits;
+
+    if (limit == 0 || pat.empty() || pat.mask.size() != pat.size() || start >= data.size())
+        return hits;
+
+    const std::size_t n = data.size();
+    const std::size_t m = pat.size();
+    if (m > n || start > n - m)
+        return hits;
+
+    const ScanPlan plan = MakePlan(pat, data.data() + start, n - start);
+    const ScanKernel kernel = SelectKernel();
+    const std::size_t end = n - m + 1;
+
+    const std::size_t chunks = ChunkCount(start, end);
+    const std::size_t wave = (std::max)<std::size_t>(1, GlobalPool().size());
+    std::vector<std::vector<std::size_t>> parts;
+
+    for (std::size_t first = 0; first < chunks && hits.size() < limit; first += wave)
+    {
+        const std::size_t count = (std::min)(wave, chunks - first);
+        const std::size_t want = limit - hits.size();
+        parts.assign(count, {});
+
+        GlobalPool().parallel_for(count, [&](std::size_t k)
+            {
+                JobCheckpoint();
+
+                const std::size_t b = start + (first + k) * kScanChunk;
+                const std::size_t e = (std::min)(b + kScanChunk, end);
+                for (std::size_t at = b; at < e && parts[k].size() < want; ++at)
+                {
+                    at = kernel(plan, data.data(), at, e, nullptr);
+                    if (at == std::wstring::npos)
+                        break;
+                    parts[k].push_back(at);
+                }
+                JobBytes(e - b);
+            });
+
+        for (const auto& p : parts)
+        {
+            const std::size_t take = (std::min)(p.size(), limit - hits.size());
+            hits.insert(hits.end(), p.begin(), p.begin() + take);
+        }
+    }
+
+    return hits;
+}
+
+// Exact byte search; same as a pattern without wildcards.
+export std::size_t FindPattern(std::span<const std::byte> data,
+    const std::vector<unsigned char>& pat,
+    std::size_t start)
+{
+    return FindPattern(data, MakePattern(pat), start);
+}
+
+// ------------------------------------------------------------
+// Batch scanning: many signatures, one pass
+//
+// Each pattern is anchored on its rarest pair of adjacent exact
+// bytes. Anchors are bucketed by their 16-bit value in a CSR table
+// with a 64 Kbit presence bitmap in front, so a position whose pair
+// no pattern cares about costs one bit test. Patterns without an
+// exact pair fall back to a single-byte table, and patterns with
+// no exact byte at all get a pass of their own.
+// ------------------------------------------------------------
+
+export struct PatternHit
+{
+    std::uint32_t pattern{};
+    std::uint64_t offset{};
+};
+
+export class PatternSet
+{
+public:
+    std::uint32_t add(Pattern p)
+    {
+        m_patterns.push_back(std::move(p));
+        m_compiled = false;
+        return static_cast<std::uint32_t>(m_patterns.size() - 1);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_patterns.size();
+    }
+
+    [[nodiscard]] const Pattern& operator[](std::uint32_t id) const
+    {
+        return m_patterns[id];
+    }
+
+    [[nodiscard]] bool compiled() const noexcept
+    {
+        return m_compiled;
+    }
+
+    // Longest pattern; chunked scans need this much overlap.
+    [[nodiscard]] std::size_t max_length() const noexcept
+    {
+        return m_maxLen;
+    }
+
+    // Build the anchor tables. The sample only steers which anchors
+    // are considered rare; any data (or none) gives correct results.
+    void compile(std::span<const std::byte> sample)
+    {
+        const auto hist = SampleHistogram(sample.data(), sample.size());
+
+        std::vector<std::pair<std::uint32_t, Entry>> pairs, singles;
+        m_unanchored.clear();
+        m_maxLen = 0;
+
+        for (std::uint32_t id = 0; id < m_patterns.size(); ++id)
+        {
+            const Pattern& p = m_patterns[id];
+            if (p.empty() || p.mask.size() != p.size())
+                continue;
+
+            m_maxLen = (std::max)(m_maxLen, p.size());
+
+            std::size_t bestPair = SIZE_MAX, bestByte = SIZE_MAX;
+            std::uint64_t pairScore = UINT64_MAX, byteScore = UINT64_MAX;
+
+            for (std::size_t k = 0; k < p.size(); ++k)
+            {
+                if (p.mask[k] != 0xFF)
+                    continue;
+
+                const std::uint64_t f = hist[p.value[k]] + 1ull;
+                if (f < byteScore)
+                {
+                    byteScore = f;
+                    bestByte = k;
+                }
+
+                if (k + 1 < p.size() && p.mask[k + 1] == 0xFF)
+                {
+                    const std::uint64_t g = f * (hist[p.value[k + 1]] + 1ull);
+                    if (g < pairScore)
+                    {
+                        pairScore = g;
+                        bestPair = k;
+                    }
+                }
+            }
+
+            if (bestPair != SIZE_MAX)
+            {
+                const std::uint32_t key = p.value[bestPair] |
+                    (static_cast<std::uint32_t>(p.value[bestPair + 1]) << 8);
+                pairs.push_back({ key, { id, static_cast<std::uint32_t>(bestPair) } });
+            }
+            else if (bestByte != SIZE_MAX)
+            {
+                singles.push_back({ p.value[bestByte], { id, static_cast<std::uint32_t>(bestByte) } });
+            }
+            else
+            {
+                m_unanchored.push_back(id);
+            }
+        }
+
+        BuildTable(pairs, 1u << 16, m_pairStart, m_pairEntries);
+        BuildTable(singles, 1u << 8, m_byteStart, m_byteEntries);
+
+        m_pairBits.fill(0);
+        for (const auto& [key, e] : pairs)
+            m_pairBits[key >> 6] |= 1ull << (key & 63);
+
+        m_compiled = true;
+    }
+
+    // Append every hit whose start offset lies in [begin, end).
+    // Anchors are searched past end as needed, so adjacent ranges
+    // together report each hit exactly once.
+    void scan(std::span<const std::byte> data,
+        std::size_t begin,
+        std::size_t end,
+        std::vector<PatternHit>& out) const
+    {
+        const std::size_t n = data.size();
+        end = (std::min)(end, n);
+        if (!m_compiled || begin >= end)
+            return;
+
+        const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+        const std::size_t last = (std::min)(n, end + m_maxLen);
+
+        auto check = [&](const Entry& e, std::size_t at)
+            {
+                if (at < e.anchor)
+                    return;
+
+                const std::size_t start = at - e.anchor;
+                const Pattern& p = m_patterns[e.pattern];
+
+                if (start < begin || start >= end || start + p.size() > n)
+                    return;
+
+                for (std::size_t i = 0; i < p.size(); ++i)
+                {
+                    if ((d[start + i] & p.mask[i]) != p.value[i])
+                        return;
+                }
+
+                out.push_back({ e.pattern, start });
+            };
+
+        if (!m_pairEntries.empty())
+        {
+            for (std::size_t i = begin; i + 1 < last; ++i)
+            {
+                const std::uint32_t key = d[i] | (static_cast<std::uint32_t>(d[i + 1]) << 8);
+                if (!(m_pairBits[key >> 6] & (1ull << (key & 63))))
+                    continue;
+
+                for (std::uint32_t k = m_pairStart[key]; k < m_pairStart[key + 1]; ++k)
+                    check(m_pairEntries[k], i);
+            }
+        }
+
+        if (!m_byteEntries.empty())
+        {
+            for (std::size_t i = begin; i < last; ++i)
+            {
+                const unsigned key = d[i];
+                for (std::uint32_t k = m_byteStart[key]; k < m_byteStart[key + 1]; ++k)
+                    check(m_byteEntries[k], i);
+            }
+        }
+
+        for (std::uint32_t id : m_unanchored)
+        {
+            const Pattern& p = m_patterns[id];
+            if (p.size() > n || begin > n - p.size())
+                continue;
+
+            const ScanPlan plan{ p.value.data(), p.mask.data(), p.size() };
+            std::vector<std::size_t> hits;
+            ScanScalar(plan, data.data(), begin, (std::min)(end, n - p.size() + 1), &hits);
+
+            for (std::size_t h : hits)
+                out.push_back({ id, h });
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::uint32_t pattern{};
+        std::uint32_t anchor{};
+    };
+
+    static void BuildTable(std::vector<std::pair<std::uint32_t, Entry>>& items,
+        std::uint32_t keys,
+        std::vector<std::uint32_t>& start,
+        std::vector<Entry>& entries)
+    {
+        start.assign(keys + 1, 0);
+        for (const auto& [key, e] : items)
+            ++start[key + 1];
+        for (std::uint32_t k = 0; k < keys; ++k)
+            start[k + 1] += start[k];
+
+        entries.resize(items.size());
+        std::vector<std::uint32_t> fill(start.begin(), start.end() - 1);
+        for (const auto& [key, e] : items)
+            entries[fill[key]++] = e;
+    }
+
+    std::vector<Pattern> m_patterns;
+    bool                 m_compiled{};
+    std::size_t          m_maxLen{};
+
+    std::vector<std::uint32_t>     m_pairStart;
+    std::vector<Entry>             m_pairEntries;
+    std::array<std::uint64_t, 1024> m_pairBits{};
+
+    std::vector<std::uint32_t> m_byteStart;
+    std::vector<Entry>         m_byteEntries;
+
+    std::vector<std::uint32_t> m_unanchored;
+};
+
+// Every hit of every pattern in one pass, ordered by offset then id.
+export std::vector<PatternHit> FindAll(std::span<const std::byte> data,
+    PatternSet& set)
+{
+    std::vector<PatternHit> hits;
+
+    if (!set.compiled())
+        set.compile(data);
+
+    if (data.empty())
+        return hits;
+
+    const std::size_t chunks = ChunkCount(0, data.size());
+    std::vector<std::vector<PatternHit>> parts(chunks);
+
+    GlobalPool().parallel_for(chunks, [&](std::size_t c)
+        {
+            JobCheckpoint();
+
+            const std::size_t b = c * kScanChunk;
+            auto& part = parts[c];
+
+            set.scan(data, b, b + kScanChunk, part);
+            JobBytes((std::min)(kScanChunk, data.size() - b));
+
+            std::sort(part.begin(), part.end(),
+                [](const PatternHit& a, const PatternHit& b)
+                {
+                    return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+                });
+        });
+
+    std::size_t total = 0;
+    for (const auto& p : parts)
+        total += p.size();
+
+    hits.reserve(total);
+    for (const auto& p : parts)
+        hits.insert(hits.end(), p.begin(), p.end());
+
+    return hits;
+}
@@ -3,20 +3,31 @@ export module mod_pe_utils;
 import <cstdint>;
 import <cstddef>;
 import <string>;
+import <string_view>;
 import <vector>;
 import <span>;
 import <stdexcept>;
 import <cstring>;
+import <algorithm>;
+import <iterator>;
+import <mutex>;
 
-// Compact, safe PE parser for 64-bit Windows PE files.
+// Compact, safe image parser. Layout is format-neutral: PE32, PE32+
+// and ELF64 images all come out as sections, entry and bitness, with
+// addresses relative to the image base (RVAs; for ELF, the lowest
+// loaded address).
 // Supports:
 //
 //  * DOS header
 //  * NT header
-//  * Optional header (PE32+ minimal fields)
+//  * Optional header (PE32 and PE32+)
+//  * ELF64 file, program and section headers
 //  * Section headers
+//  * Data directories
 //  * RVA ↔ file offset translation
-//  * .text lookup
+//  * .text / section-by-name lookup
+//  * Function table (.pdata, or prologue heuristics)
+//  * Imports, exports, relocations, TLS callbacks (parsed on demand)
 //
 export namespace pe
 {
@@ -68,9 +79,119 @@ export namespace pe
         std::uint32_t sizeInitData;
         std::uint32_t sizeUninitData;
         std::uint32_t entryRVA;
+        std::uint32_t baseOfCode;
         std::uint64_t imageBase;
+        std::uint32_t sectionAlignment;
+        std::uint32_t fileAlignment;
+        std::uint16_t osMajor;
+        std::uint16_t osMinor;
+        std::uint16_t imageMajor;
+        std::uint16_t imageMinor;
+        std::uint16_t subsystemMajor;
+        std::uint16_t subsystemMinor;
+        std::uint32_t win32Version;
+        std::uint32_t sizeOfImage;
+        std::uint32_t sizeOfHeaders;
+        std::uint32_t checkSum;
+        std::uint16_t subsystem;
+        std::uint16_t dllCharacteristics;
+        std::uint64_t stackReserve;
+        std::uint64_t stackCommit;
+        std::uint64_t heapReserve;
+        std::uint64_t heapCommit;
+        std::uint32_t loaderFlags;
+        std::uint32_t numberOfRvaAndSizes;
 
-        // We stop here—this is enough for disassembly.
+        // The data directories follow; see Layout::directories.
+    };
+    static_assert(sizeof(OptionalHeader64) == 112);
+
+    struct OptionalHeader32
+    {
+        std::uint16_t magic;     // 0x10B
+        std::uint8_t  linkerMajor;
+        std::uint8_t  linkerMinor;
+        std::uint32_t sizeCode;
+        std::uint32_t sizeInitData;
+        std::uint32_t sizeUninitData;
+        std::uint32_t entryRVA;
+        std::uint32_t baseOfCode;
+        std::uint32_t baseOfData;
+        std::uint32_t imageBase;
+        std::uint32_t sectionAlignment;
+        std::uint32_t fileAlignment;
+        std::uint16_t osMajor;
+        std::uint16_t osMinor;
+        std::uint16_t imageMajor;
+        std::uint16_t imageMinor;
+        std::uint16_t subsystemMajor;
+        std::uint16_t subsystemMinor;
+        std::uint32_t win32Version;
+        std::uint32_t sizeOfImage;
+        std::uint32_t sizeOfHeaders;
+        std::uint32_t checkSum;
+        std::uint16_t subsystem;
+        std::uint16_t dllCharacteristics;
+        std::uint32_t stackReserve;
+        std::uint32_t stackCommit;
+        std::uint32_t heapReserve;
+        std::uint32_t heapCommit;
+        std::uint32_t loaderFlags;
+        std::uint32_t numberOfRvaAndSizes;
+    };
+    static_assert(sizeof(OptionalHeader32) == 96);
+
+    struct ElfHeader64
+    {
+        std::uint8_t  ident[16];
+        std::uint16_t type;
+        std::uint16_t machine;
+        std::uint32_t version;
+        std::uint64_t entry;
+        std::uint64_t phoff;
+        std::uint64_t shoff;
+        std::uint32_t flags;
+        std::uint16_t ehsize;
+        std::uint16_t phentsize;
+        std::uint16_t phnum;
+        std::uint16_t shentsize;
+        std::uint16_t shnum;
+        std::uint16_t shstrndx;
+    };
+    static_assert(sizeof(ElfHeader64) == 64);
+
+    struct ElfProgramHeader64
+    {
+        std::uint32_t type;
+        std::uint32_t flags;
+        std::uint64_t offset;
+        std::uint64_t vaddr;
+        std::uint64_t paddr;
+        std::uint64_t filesz;
+        std::uint64_t memsz;
+        std::uint64_t align;
+    };
+
+    struct ElfSectionHeader64
+    {
+        std::uint32_t name;
+        std::uint32_t type;
+        std::uint64_t flags;
+        std::uint64_t addr;
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint32_t link;
+        std::uint32_t info;
+        std::uint64_t addralign;
+        std::uint64_t entsize;
+    };
+
+    enum class Format : std::uint8_t
+    {
+        None,       // raw bytes
+        PE32,
+        PE32Plus,
+        ELF64
     };
 
     struct Section
@@ -80,19 +201,70 @@ export namespace pe
         std::uint32_t   virtualAddress;  // RVA
         std::uint32_t   rawSize;
         std::uint32_t   rawOffset;
+        std::uint32_t   characteristics;
+
+        [[nodiscard]] bool executable() const noexcept
+        {
+            return (characteristics & 0x20000000) != 0; // IMAGE_SCN_MEM_EXECUTE
+        }
+    };
+
+    struct DataDirectory
+    {
+        std::uint32_t rva{};
+        std::uint32_t size{};
+    };
+
+    // IMAGE_DIRECTORY_ENTRY_* indices we use.
+    enum DirectoryIndex : std::size_t
+    {
+        DirExport = 0,
+        DirImport = 1,
+        DirException = 3,
+        DirBaseReloc = 5,
+        DirTls = 9,
+        DirCount = 16
     };
 
     struct Layout
     {
         bool valid{};
+        bool is64{};
+        Format format{ Format::None };
         std::uint64_t imageBase{};
         std::uint32_t entryRVA{};
+        std::uint32_t headerSize{};
+
+        // Header order, as the file lists them.
         std::vector<Section> sections;
 
-        // Cached .text references
-        const Section* text{};
+        // Section indices sorted by RVA and by file offset, for
+        // binary-search translation in both directions.
+        std::vector<std::uint32_t> byRva;
+        std::vector<std::uint32_t> byRaw;
+
+        // Index of .text in sections (npos if none). An index, not a
+        // pointer, so copies of a Layout stay valid.
+        std::size_t textIndex{ static_cast<std::size_t>(-1) };
+
+        [[nodiscard]] const Section* text() const noexcept
+        {
+            return textIndex < sections.size() ? &sections[textIndex] : nullptr;
+        }
+
+        // Data directories; absent ones are {0, 0}.
+        DataDirectory directories[DirCount]{};
     };
 
+    // RUNTIME_FUNCTION, as stored in .pdata (RVAs, end exclusive).
+    struct Function
+    {
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::uint32_t unwind;   // UNWIND_INFO RVA; 0 for guessed functions
+    };
+    static_assert(sizeof(Function) == 12);
+
     // ------------------------------------------------------------
     // Read helpers (module-internal, not exported)
     // ------------------------------------------------------------
@@ -104,10 +276,25 @@ export namespace pe
         return true;
     }
 
+    // Section indices sorted by RVA and by file offset.
+    inline void index_sections(Layout& L)
+    {
+        const auto count = static_cast<std::uint32_t>(L.sections.size());
+        L.byRva.resize(count);
+        L.byRaw.resize(count);
+        for (std::uint32_t i = 0; i < count; i++)
+            L.byRva[i] = L.byRaw[i] = i;
+
+        std::stable_sort(L.byRva.begin(), L.byRva.end(), [&](std::uint32_t a, std::uint32_t b)
+            { return L.sections[a].virtualAddress < L.sections[b].virtualAddress; });
+        std::stable_sort(L.byRaw.begin(), L.byRaw.end(), [&](std::uint32_t a, std::uint32_t b)
+            { return L.sections[a].rawOffset < L.sections[b].rawOffset; });
+    }
+
     // ------------------------------------------------------------
-    // Parse entire PE layout
+    // PE32 / PE32+
     // ------------------------------------------------------------
-    export inline Layout analyze(std::span<const std::byte> data)
+    inline Layout analyze_pe(std::span<const std::byte> data)
     {
         Layout L{};
 
@@ -122,66 +309,723 @@ export namespace pe
         if (!read(data, dos.e_lfanew, file)) return L;
         if (file.signature != 0x00004550) return L; // PE00
 
-        OptionalHeader64 opt{};
-        if (!read(data, dos.e_lfanew + sizeof(FileHeader), opt)) return L;
-        if (opt.magic != 0x20B) return L; // Only PE32+
+        // The two optional headers differ in field widths; the
+        // directories follow the fixed part of either.
+        const std::size_t optOff = dos.e_lfanew + sizeof(FileHeader);
+        std::uint16_t magic{};
+        if (!read(data, optOff, magic)) return L;
+
+        std::size_t fixedSize{};
+        std::uint32_t dirCount{};
+
+        if (magic == 0x20B)
+        {
+            OptionalHeader64 opt{};
+            if (!read(data, optOff, opt)) return L;
+
+            L.format = Format::PE32Plus;
+            L.is64 = true;
+            L.imageBase = opt.imageBase;
+            L.entryRVA = opt.entryRVA;
+            L.headerSize = opt.sizeOfHeaders;
+            fixedSize = sizeof(OptionalHeader64);
+            dirCount = opt.numberOfRvaAndSizes;
+        }
+        else if (magic == 0x10B)
+        {
+            OptionalHeader32 opt{};
+            if (!read(data, optOff, opt)) return L;
+
+            L.format = Format::PE32;
+            L.is64 = false;
+            L.imageBase = opt.imageBase;
+            L.entryRVA = opt.entryRVA;
+            L.headerSize = opt.sizeOfHeaders;
+            fixedSize = sizeof(OptionalHeader32);
+            dirCount = opt.numberOfRvaAndSizes;
+        }
+        else
+        {
+            return L;
+        }
 
         L.valid = true;
-        L.imageBase = opt.imageBase;
-        L.entryRVA = opt.entryRVA;
+
+        if (file.optHeaderSize >= fixedSize)
+        {
+            dirCount = std::min<std::uint32_t>(dirCount, DirCount);
+            dirCount = std::min<std::uint32_t>(dirCount,
+                static_cast<std::uint32_t>((file.optHeaderSize - fixedSize) / sizeof(DataDirectory)));
+            for (std::uint32_t i = 0; i < dirCount; i++)
+                read(data, optOff + fixedSize + i * sizeof(DataDirectory), L.directories[i]);
+        }
 
         // Parse sections
-        std::size_t sectStart = dos.e_lfanew + sizeof(FileHeader) + file.optHeaderSize;
+        std::size_t sectStart = optOff + file.optHeaderSize;
         L.sections.reserve(file.sectionCount);
-
         for (int i = 0; i < file.sectionCount; i++)
         {
             std::size_t off = sectStart + i * 40; // IMAGE_SECTION_HEADER size
+            if (off + 40 > data.size())
+                break;
 
             char name[9]{};
             std::memcpy(name, data.data() + off, 8);
 
-            std::uint32_t vs{}, va{}, rs{}, ro{};
+            std::uint32_t vs{}, va{}, rs{}, ro{}, ch{};
             read(data, off + 8, vs);
             read(data, off + 12, va);
             read(data, off + 16, rs);
             read(data, off + 20, ro);
+            read(data, off + 36, ch);
 
             Section s{
                 name,
                 vs,
                 va,
                 rs,
-                ro
+                ro,
+                ch
+            };
+
+            L.sections.push_back(s);
+
+            if (L.textIndex == static_cast<std::size_t>(-1) && s.name.starts_with(".text"))
+                L.textIndex = L.sections.size() - 1;
+        }
+
+        index_sections(L);
+        return L;
+    }
+
+    // ------------------------------------------------------------
+    // ELF64 (little-endian)
+    //
+    // RVAs are relative to the lowest PT_LOAD address, so a PIE and a
+    // fixed-address binary look the same to everything downstream.
+    // Sections come from the section headers (SHF_ALLOC only); a
+    // binary stripped of those falls back to its PT_LOAD segments.
+    // Flags are mapped onto the PE characteristics bits.
+    // ------------------------------------------------------------
+    inline Layout analyze_elf(std::span<const std::byte> data)
+    {
+        Layout L{};
+
+        ElfHeader64 eh{};
+        if (!read(data, 0, eh)) return L;
+        if (std::memcmp(eh.ident, "\x7F" "ELF", 4) != 0) return L;
+        if (eh.ident[4] != 2 || eh.ident[5] != 1) return L; // ELFCLASS64, little-endian
+
+        std::uint64_t base = ~0ull;
+        std::vector<ElfProgramHeader64> loads;
+
+        for (std::uint16_t i = 0; i < eh.phnum; i++)
+        {
+            ElfProgramHeader64 ph{};
+            if (!read(data, eh.phoff + std::size_t(i) * eh.phentsize, ph))
+                break;
+            if (ph.type == 1) // PT_LOAD
+            {
+                loads.push_back(ph);
+                base = std::min<std::uint64_t>(base, ph.vaddr & ~0xFFFull);
+            }
+        }
+
+        if (loads.empty())
+            base = 0;
+
+        L.format = Format::ELF64;
+        L.valid = true;
+        L.is64 = eh.machine != 3; // EM_386 in a 64-bit container is rare but possible
+        L.imageBase = base;
+        L.entryRVA = eh.entry >= base ? static_cast<std::uint32_t>(eh.entry - base) : 0;
+        L.headerSize = static_cast<std::uint32_t>(std::max<std::uint64_t>(eh.ehsize,
+            eh.phoff + std::uint64_t(eh.phnum) * eh.phentsize));
+
+        auto flagsFromShf = [](std::uint64_t f)
+            {
+                std::uint32_t ch = 0x40000000;                              // readable
+                if (f & 0x1) ch |= 0x80000000;                              // SHF_WRITE
+                if (f & 0x4) ch |= 0x20000000 | 0x20;                       // SHF_EXECINSTR
+                return ch;
+            };
+
+        ElfSectionHeader64 strtab{};
+        const bool haveNames = eh.shstrndx < eh.shnum &&
+            read(data, eh.shoff + std::size_t(eh.shstrndx) * eh.shentsize, strtab);
+
+        for (std::uint16_t i = 0; i < eh.shnum; i++)
+        {
+            ElfSectionHeader64 sh{};
+            if (!read(data, eh.shoff + std::size_t(i) * eh.shentsize, sh))
+                break;
+            if (!(sh.flags & 0x2) || sh.addr < base) // SHF_ALLOC
+                continue;
+
+            std::string name;
+            if (haveNames && strtab.offset + sh.name < data.size())
+            {
+                const auto* p = reinterpret_cast<const char*>(data.data() + strtab.offset + sh.name);
+                const std::size_t max = data.size() - (strtab.offset + sh.name);
+                name.assign(p, std::find(p, p + max, '\0'));
+            }
+
+            const bool nobits = sh.type == 8; // SHT_NOBITS
+            Section s{
+                name,
+                static_cast<std::uint32_t>(sh.size),
+                static_cast<std::uint32_t>(sh.addr - base),
+                nobits ? 0u : static_cast<std::uint32_t>(sh.size),
+                nobits ? 0u : static_cast<std::uint32_t>(sh.offset),
+                flagsFromShf(sh.flags)
             };
 
             L.sections.push_back(s);
 
-            if (!L.text && s.name.starts_with(".text"))
-                L.text = &L.sections.back();
+            if (L.textIndex == static_cast<std::size_t>(-1) && s.name == ".text")
+                L.textIndex = L.sections.size() - 1;
+        }
+
+        if (L.sections.empty())
+        {
+            for (std::size_t i = 0; i < loads.size(); i++)
+            {
+                const auto& ph = loads[i];
+                std::uint32_t ch = 0x40000000;
+                if (ph.flags & 0x2) ch |= 0x80000000;                       // PF_W
+                if (ph.flags & 0x1) ch |= 0x20000000 | 0x20;                // PF_X
+
+                L.sections.push_back({
+                    "LOAD" + std::to_string(i),
+                    static_cast<std::uint32_t>(ph.memsz),
+                    static_cast<std::uint32_t>(ph.vaddr - base),
+                    static_cast<std::uint32_t>(ph.filesz),
+                    static_cast<std::uint32_t>(ph.offset),
+                    ch });
+            }
         }
 
+        index_sections(L);
         return L;
     }
 
     // ------------------------------------------------------------
-    // RVA → file offset
+    // Parse the image layout of whatever format data is in
+    // ------------------------------------------------------------
+    export inline Layout analyze(std::span<const std::byte> data)
+    {
+        if (data.size() >= 4 && std::memcmp(data.data(), "\x7F" "ELF", 4) == 0)
+            return analyze_elf(data);
+
+        return analyze_pe(data);
+    }
+
+    // "PE32+ (x64)", "ELF64 (x64)", ...
+    export inline std::wstring format_name(const Layout& L)
+    {
+        const wchar_t* arch = L.is64 ? L" (x64)" : L" (x86)";
+        switch (L.format)
+        {
+        case Format::PE32:     return std::wstring(L"PE32") + arch;
+        case Format::PE32Plus: return std::wstring(L"PE32+") + arch;
+        case Format::ELF64:    return std::wstring(L"ELF64") + arch;
+        default:               return L"raw";
+        }
+    }
+
+    // ------------------------------------------------------------
+    // RVA → file offset (O(log n) over byRva)
     // ------------------------------------------------------------
     export inline bool rva_to_file(const Layout& L, std::uint32_t rva, std::size_t& out)
     {
         if (!L.valid) return false;
 
+        auto it = std::upper_bound(L.byRva.begin(), L.byRva.end(), rva,
+            [&](std::uint32_t v, std::uint32_t i) { return v < L.sections[i].virtualAddress; });
+
+        if (it == L.byRva.begin())
+            return false;
+
+        const Section& s = L.sections[*std::prev(it)];
+        const std::uint32_t delta = rva - s.virtualAddress;
+        const std::uint32_t span = s.virtualSize ? s.virtualSize : s.rawSize;
+
+        // Past the raw data is zero-fill with no file bytes behind it.
+        if (delta >= span || delta >= s.rawSize)
+            return false;
+
+        out = static_cast<std::size_t>(s.rawOffset) + delta;
+        return true;
+    }
+
+    // ------------------------------------------------------------
+    // File offset → RVA (O(log n) over byRaw)
+    // ------------------------------------------------------------
+    export inline bool file_to_rva(const Layout& L, std::size_t off, std::uint32_t& out)
+    {
+        if (!L.valid) return false;
+
+        auto it = std::upper_bound(L.byRaw.begin(), L.byRaw.end(), off,
+            [&](std::size_t v, std::uint32_t i) { return v < L.sections[i].rawOffset; });
+
+        if (it == L.byRaw.begin())
+            return false;
+
+        const Section& s = L.sections[*std::prev(it)];
+        if (off >= static_cast<std::size_t>(s.rawOffset) + s.rawSize)
+            return false;
+
+        out = static_cast<std::uint32_t>(off - s.rawOffset) + s.virtualAddress;
+        return true;
+    }
+
+    // ------------------------------------------------------------
+    // Section by name (".text", ".rdata", ...)
+    // ------------------------------------------------------------
+    export inline const Section* find_section(const Layout& L, std::string_view name)
+    {
         for (auto& s : L.sections)
         {
-            if (rva >= s.virtualAddress &&
-                rva < s.virtualAddress + s.virtualSize)
+            if (s.name == name)
+                return &s;
+        }
+        return nullptr;
+    }
+
+    // ------------------------------------------------------------
+    // Function table from the exception directory
+    //
+    // .pdata is already an array of RUNTIME_FUNCTION sorted by begin,
+    // so this is one copy plus a sortedness check: a few ms for half
+    // a million functions. Empty when there is no exception directory.
+    // ------------------------------------------------------------
+    export inline std::vector<Function> load_functions(std::span<const std::byte> data, const Layout& L)
+    {
+        std::vector<Function> out;
+
+        const DataDirectory& dir = L.directories[DirException];
+        std::size_t off{};
+        if (!L.valid || dir.size < sizeof(Function) || !rva_to_file(L, dir.rva, off))
+            return out;
+
+        // A truncated file can put the directory past its end.
+        if (off >= data.size())
+            return out;
+
+        const std::size_t bytes = std::min<std::size_t>(dir.size, data.size() - off);
+        const std::size_t count = bytes / sizeof(Function);
+
+        out.resize(count);
+        std::memcpy(out.data(), data.data() + off, count * sizeof(Function));
+
+        std::erase_if(out, [](const Function& f) { return f.begin >= f.end; });
+
+        auto byBegin = [](const Function& a, const Function& b) { return a.begin < b.begin; };
+        if (!std::is_sorted(out.begin(), out.end(), byBegin))
+            std::sort(out.begin(), out.end(), byBegin);
+
+        return out;
+    }
+
+    // ------------------------------------------------------------
+    // Function starts guessed from code bytes (no .pdata)
+    //
+    // code[0] is at baseRva. A start is a 16-byte aligned address
+    // right after padding (int3 / nop) or a ret that begins with a
+    // common x64 prologue; the first byte of code always starts one.
+    // Each function runs to the next start, minus trailing padding.
+    // ------------------------------------------------------------
+    inline bool LooksLikePrologue(const std::uint8_t* p, std::size_t n) noexcept
+    {
+        if (n < 4)
+            return false;
+
+        switch (p[0])
+        {
+        case 0x55:                                          // push rbp; mov rbp, rsp
+            return p[1] == 0x48 && p[2] == 0x89 && p[3] == 0xE5;
+        case 0x53: case 0x56: case 0x57:                    // push rbx / rsi / rdi
+            return true;
+        case 0x40:                                          // push with REX
+            return p[1] >= 0x53 && p[1] <= 0x57;
+        case 0x41:                                          // push r12..r15
+            return p[1] >= 0x54 && p[1] <= 0x57;
+        case 0x48:
+            return ((p[1] == 0x83 || p[1] == 0x81) && p[2] == 0xEC) ||      // sub rsp, imm
+                (p[1] == 0x89 && (p[2] & 0xC7) == 0x44 && p[3] == 0x24);    // mov [rsp+x], reg
+        case 0x4C:
+            return p[1] == 0x89 && (p[2] & 0xC7) == 0x44 && p[3] == 0x24;
+        case 0xF3:                                          // endbr64
+            return p[1] == 0x0F && p[2] == 0x1E && p[3] == 0xFA;
+        default:
+            return false;
+        }
+    }
+
+    export inline std::vector<Function> guess_functions(std::span<const std::byte> code, std::uint32_t baseRva)
+    {
+        std::vector<Function> out;
+        if (code.empty())
+            return out;
+
+        const auto* p = reinterpret_cast<const std::uint8_t*>(code.data());
+        const std::size_t n = code.size();
+
+        std::vector<std::size_t> starts{ 0 };
+        for (std::size_t i = (16 - baseRva % 16) % 16; i < n; i += 16)
+        {
+            if (i == 0)
+                continue;
+
+            const std::uint8_t prev = p[i - 1];
+            if ((prev == 0xCC || prev == 0x90 || prev == 0xC3) && LooksLikePrologue(p + i, n - i))
+                starts.push_back(i);
+        }
+
+        out.reserve(starts.size());
+        for (std::size_t k = 0; k < starts.size(); ++k)
+        {
+            std::size_t end = (k + 1 < starts.size()) ? starts[k + 1] : n;
+            while (end > starts[k] + 1 && (p[end - 1] == 0xCC || p[end - 1] == 0x90))
+                --end;
+
+            out.push_back({
+                baseRva + static_cast<std::uint32_t>(starts[k]),
+                baseRva + static_cast<std::uint32_t>(end),
+                0 });
+        }
+
+        return out;
+    }
+
+    // ------------------------------------------------------------
+    // Function containing rva (O(log n)), or nullptr
+    // ------------------------------------------------------------
+    export inline const Function* find_function(std::span<const Function> table, std::uint32_t rva)
+    {
+        auto it = std::upper_bound(table.begin(), table.end(), rva,
+            [](std::uint32_t v, const Function& f) { return v < f.begin; });
+
+        if (it == table.begin())
+            return nullptr;
+
+        const Function& f = *std::prev(it);
+        return rva < f.end ? &f : nullptr;
+    }
+
+    // ------------------------------------------------------------
+    // Imports, exports, relocations and TLS callbacks
+    //
+    // Nothing is read until a table is first asked for, so opening a
+    // file with a huge relocation table costs nothing until someone
+    // looks at it. Each table is a flat array sorted by RVA; names
+    // live in one string pool per table and are NUL-terminated.
+    // Safe to query from several threads.
+    // ------------------------------------------------------------
+    struct Import
+    {
+        std::uint32_t slot;      // IAT entry RVA
+        std::uint32_t name;      // "dll!function" or "dll!#ordinal" in the pool
+    };
+
+    struct Export
+    {
+        std::uint32_t rva;
+        std::uint32_t name;      // name, or "#ordinal", in the pool
+        std::uint16_t ordinal;
+        bool          forwarded; // rva points at a "dll.func" string
+    };
+
+    struct Relocation
+    {
+        std::uint32_t rva;
+        std::uint8_t  type;      // IMAGE_REL_BASED_*
+    };
+
+    class DataDirectories
+    {
+    public:
+        DataDirectories(std::span<const std::byte> data, const Layout& L)
+            : m_data(data), m_layout(L)
+        {
+        }
+
+        DataDirectories(const DataDirectories&) = delete;
+        DataDirectories& operator=(const DataDirectories&) = delete;
+
+        [[nodiscard]] std::uint64_t image_base() const noexcept
+        {
+            return m_layout.imageBase;
+        }
+
+        [[nodiscard]] std::span<const Import> imports() const
+        {
+            std::call_once(m_importsOnce, [this] { parse_imports(); });
+            return m_imports;
+        }
+
+        [[nodiscard]] std::span<const Export> exports() const
+        {
+            std::call_once(m_exportsOnce, [this] { parse_exports(); });
+            return m_exports;
+        }
+
+        [[nodiscard]] std::span<const Relocation> relocations() const
+        {
+            std::call_once(m_relocsOnce, [this] { parse_relocations(); });
+            return m_relocs;
+        }
+
+        // Callback RVAs, in table order.
+        [[nodiscard]] std::span<const std::uint32_t> tls_callbacks() const
+        {
+            std::call_once(m_tlsOnce, [this] { parse_tls(); });
+            return m_tls;
+        }
+
+        [[nodiscard]] const char* import_name(const Import& i) const noexcept
+        {
+            return m_importNames.data() + i.name;
+        }
+
+        [[nodiscard]] const char* export_name(const Export& e) const noexcept
+        {
+            return m_exportNames.data() + e.name;
+        }
+
+        // Name for an RVA: an import slot, an export, a TLS callback
+        // or the entry point. Empty when there is none.
+        [[nodiscard]] std::string symbol(std::uint32_t rva) const
+        {
+            const auto imp = imports();
+            auto i = std::lower_bound(imp.begin(), imp.end(), rva,
+                [](const Import& x, std::uint32_t v) { return x.slot < v; });
+            if (i != imp.end() && i->slot == rva)
+                return import_name(*i);
+
+            const auto exp = exports();
+            auto e = std::lower_bound(exp.begin(), exp.end(), rva,
+                [](const Export& x, std::uint32_t v) { return x.rva < v; });
+            if (e != exp.end() && e->rva == rva)
+                return export_name(*e);
+
+            const auto tls = tls_callbacks();
+            for (std::size_t k = 0; k < tls.size(); ++k)
             {
-                out = (rva - s.virtualAddress) + s.rawOffset;
-                return true;
+                if (tls[k] == rva)
+                    return "tls_callback_" + std::to_string(k);
             }
+
+            if (m_layout.valid && rva == m_layout.entryRVA)
+                return "entry";
+
+            return {};
         }
-        return false;
-    }
+
+    private:
+        // NUL-terminated string at rva, clipped to the file bytes of its
+        // section and to 4 KB.
+        [[nodiscard]] std::string_view string_at(std::uint32_t rva) const
+        {
+            std::size_t off{};
+            if (!rva_to_file(m_layout, rva, off) || off >= m_data.size())
+                return {};
+
+            // rva_to_file found it in this section.
+            const auto it = std::upper_bound(m_layout.byRva.begin(), m_layout.byRva.end(), rva,
+                [&](std::uint32_t v, std::uint32_t i) { return v < m_layout.sections[i].virtualAddress; });
+            const Section& s = m_layout.sections[*std::prev(it)];
+            const std::uint32_t span = s.virtualSize ? std::min(s.virtualSize, s.rawSize) : s.rawSize;
+            const std::size_t end = std::min<std::size_t>(std::size_t(s.rawOffset) + span, m_data.size());
+
+            const auto* p = reinterpret_cast<const char*>(m_data.data() + off);
+            const std::size_t max = std::min<std::size_t>(end - off, 4096);
+            return { p, static_cast<std::size_t>(std::find(p, p + max, '\0') - p) };
+        }
+
+        template<typename T>
+        bool read_rva(std::uint32_t rva, T& out) const
+        {
+            std::size_t off{};
+            return rva_to_file(m_layout, rva, off) && read(m_data, off, out);
+        }
+
+        // A pointer-sized value: 8 bytes in PE32+, 4 in PE32.
+        bool read_ptr(std::uint32_t rva, std::uint64_t& out) const
+        {
+            if (m_layout.is64)
+                return read_rva(rva, out);
+
+            std::uint32_t v{};
+            if (!read_rva(rva, v))
+                return false;
+            out = v;
+            return true;
+        }
+
+        static std::uint32_t pool_add(std::string& pool, std::string_view a, std::string_view b = {})
+        {
+            const auto at = static_cast<std::uint32_t>(pool.size());
+            pool.append(a);
+            pool.append(b);
+            pool.push_back('\0');
+            return at;
+        }
+
+        void parse_imports() const
+        {
+            const DataDirectory& dir = m_layout.directories[DirImport];
+            if (!m_layout.valid || !dir.rva)
+                return;
+
+            // IMAGE_IMPORT_DESCRIPTOR: OriginalFirstThunk, TimeDateStamp,
+            // ForwarderChain, Name, FirstThunk.
+            for (std::uint32_t d = dir.rva;; d += 20)
+            {
+                std::uint32_t desc[5]{};
+                if (!read_rva(d, desc) || (desc[0] == 0 && desc[3] == 0 && desc[4] == 0))
+                    break;
+
+                const std::string dll = std::string(string_at(desc[3])) + "!";
+                const std::uint32_t lookup = desc[0] ? desc[0] : desc[4];
+
+                // Thunks are pointer-sized; the top bit flags an ordinal.
+                const std::uint32_t width = m_layout.is64 ? 8 : 4;
+                const std::uint64_t ordinalFlag = 1ull << (width * 8 - 1);
+
+                for (std::uint32_t k = 0; k < 0x10000; ++k)
+                {
+                    std::uint64_t thunk{};
+                    if (!read_ptr(lookup + k * width, thunk) || thunk == 0)
+                        break;
+
+                    std::uint32_t name{};
+                    if (thunk & ordinalFlag)
+                        name = pool_add(m_importNames, dll, "#" + std::to_string(thunk & 0xFFFF));
+                    else
+                        name = pool_add(m_importNames, dll, string_at(static_cast<std::uint32_t>(thunk) + 2));
+
+                    m_imports.push_back({ desc[4] + k * width, name });
+                }
+            }
+
+            std::sort(m_imports.begin(), m_imports.end(),
+                [](const Import& a, const Import& b) { return a.slot < b.slot; });
+        }
+
+        void parse_exports() const
+        {
+            const DataDirectory& dir = m_layout.directories[DirExport];
+            if (!m_layout.valid || !dir.rva)
+                return;
+
+            // IMAGE_EXPORT_DIRECTORY from Base on: Base, NumberOfFunctions,
+            // NumberOfNames, AddressOfFunctions, AddressOfNames,
+            // AddressOfNameOrdinals.
+            std::uint32_t ed[6]{};
+            if (!read_rva(dir.rva + 16, ed))
+                return;
+
+            const std::uint32_t count = std::min<std::uint32_t>(ed[1], 0x100000);
+            std::vector<std::uint32_t> names(count, 0xFFFFFFFF);
+
+            for (std::uint32_t j = 0; j < std::min(ed[2], count); ++j)
+            {
+                std::uint32_t nameRva{};
+                std::uint16_t index{};
+                if (read_rva(ed[4] + j * 4, nameRva) && read_rva(ed[5] + j * 2, index) && index < count)
+                    names[index] = pool_add(m_exportNames, string_at(nameRva));
+            }
+
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                std::uint32_t rva{};
+                if (!read_rva(ed[3] + i * 4, rva) || rva == 0)
+                    continue;
+
+                const auto ordinal = static_cast<std::uint16_t>(ed[0] + i);
+                const std::uint32_t name = names[i] != 0xFFFFFFFF ? names[i]
+                    : pool_add(m_exportNames, "#" + std::to_string(ordinal));
+                const bool forwarded = rva >= dir.rva && rva < dir.rva + dir.size;
+
+                m_exports.push_back({ rva, name, ordinal, forwarded });
+            }
+
+            std::sort(m_exports.begin(), m_exports.end(),
+                [](const Export& a, const Export& b) { return a.rva < b.rva; });
+        }
+
+        void parse_relocations() const
+        {
+            const DataDirectory& dir = m_layout.directories[DirBaseReloc];
+            std::size_t off{};
+            if (!m_layout.valid || !dir.rva || !rva_to_file(m_layout, dir.rva, off))
+                return;
+
+            const std::size_t end = std::min<std::size_t>(off + dir.size, m_data.size());
+
+            // Blocks: PageRVA, BlockSize, then (type << 12 | offset) words.
+            while (off + 8 <= end)
+            {
+                std::uint32_t page{}, size{};
+                read(m_data, off, page);
+                read(m_data, off + 4, size);
+                if (size < 8)
+                    break;
+
+                const std::size_t blockEnd = std::min(off + size, end);
+                for (std::size_t p = off + 8; p + 2 <= blockEnd; p += 2)
+                {
+                    std::uint16_t w{};
+                    read(m_data, p, w);
+                    if ((w >> 12) != 0) // IMAGE_REL_BASED_ABSOLUTE is padding
+                        m_relocs.push_back({ page + (w & 0xFFF), static_cast<std::uint8_t>(w >> 12) });
+                }
+
+                off += size;
+            }
+
+            auto byRva = [](const Relocation& a, const Relocation& b) { return a.rva < b.rva; };
+            if (!std::is_sorted(m_relocs.begin(), m_relocs.end(), byRva))
+                std::sort(m_relocs.begin(), m_relocs.end(), byRva);
+        }
+
+        void parse_tls() const
+        {
+            const DataDirectory& dir = m_layout.directories[DirTls];
+            if (!m_layout.valid || !dir.rva)
+                return;
+
+            // AddressOfCallBacks is the fourth pointer of
+            // IMAGE_TLS_DIRECTORY32/64, and a VA.
+            const std::uint32_t width = m_layout.is64 ? 8 : 4;
+
+            std::uint64_t callbacks{};
+            if (!read_ptr(dir.rva + 3 * width, callbacks) || callbacks < m_layout.imageBase)
+                return;
+
+            auto at = static_cast<std::uint32_t>(callbacks - m_layout.imageBase);
+            for (int k = 0; k < 1024; ++k, at += width)
+            {
+                std::uint64_t va{};
+                if (!read_ptr(at, va) || va < m_layout.imageBase)
+                    break;
+                m_tls.push_back(static_cast<std::uint32_t>(va - m_layout.imageBase));
+            }
+        }
+
+        std::span<const std::byte> m_data;
+        Layout                     m_layout;
+
+        mutable std::once_flag m_importsOnce, m_exportsOnce, m_relocsOnce, m_tlsOnce;
+
+        mutable std::vector<Import>        m_imports;
+        mutable std::string                m_importNames;
+        mutable std::vector<Export>        m_exports;
+        mutable std::string                m_exportNames;
+        mutable std::vector<Relocation>    m_relocs;
+        mutable std::vector<std::uint32_t> m_tls;
+    };
 
     // ------------------------------------------------------------
     // Format string for the UI
@@ -189,10 +1033,10 @@ export namespace pe
     export inline std::wstring describe(const Layout& L)
     {
         if (!L.valid)
-            return L"Not a PE file.";
+            return L"Not a PE or ELF file.";
 
         std::wstring s;
-        s += L"PE32+ detected\n";
+        s += format_name(L) + L" detected\n";
         s += L"ImageBase: 0x" + std::to_wstring(L.imageBase) + L"\n";
         s += L"Entry RVA: 0x" + std::to_wstring(L.entryRVA) + L"\n";
         s += L"Sections:\n";
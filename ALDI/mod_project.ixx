@@ -0,0 +1,564 @@
+export module mod_project;
+
+import mod_binary_file;
+import mod_pe_utils;
+import mod_analysis;
+import mod_xrefs;
+import mod_threadpool;
+
+import <string>;
+import <string_view>;
+import <vector>;
+import <span>;
+import <fstream>;
+import <cstddef>;
+import <cstdint>;
+import <cstring>;
+import <algorithm>;
+import <type_traits>;
+
+// ---------------------------------------------------------------------------
+// Project database: "<file>.aldi", everything learned about one file.
+//
+//   header     "ALDIPROJ", version, section count, size and hash of the
+//              file it describes, offset of the directory
+//   sections   raw little-endian data, each 8-byte aligned
+//   directory  { tag, offset, size } per section
+//
+// A save is written to "<file>.aldi.tmp" and renamed over the old
+// database once complete, so a failed save leaves the last good one.
+// The header goes in last, so a file whose save was cut short has no
+// magic and is ignored. Sections are found by tag; a reader skips
+// tags it does not know, and any other version is refused whole.
+// ---------------------------------------------------------------------------
+
+export constexpr std::uint32_t kProjectVersion = 1;
+
+export constexpr std::uint32_t ProjectTag(const char (&s)[5]) noexcept
+{
+    return std::uint32_t(std::uint8_t(s[0])) | std::uint32_t(std::uint8_t(s[1])) << 8 |
+        std::uint32_t(std::uint8_t(s[2])) << 16 | std::uint32_t(std::uint8_t(s[3])) << 24;
+}
+
+struct ProjectHeader
+{
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t sections;
+    std::uint64_t fileSize;
+    std::uint64_t fileHash;
+    std::uint64_t directory;
+};
+static_assert(sizeof(ProjectHeader) == 40);
+
+struct ProjectEntry
+{
+    std::uint32_t tag;
+    std::uint32_t reserved;
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+static_assert(sizeof(ProjectEntry) == 24);
+
+static constexpr char kProjectMagic[8] = { 'A', 'L', 'D', 'I', 'P', 'R', 'O', 'J' };
+
+// ---------------------------------------------------------------------------
+// ContentHash: 64-bit hash of a whole file, in parallel 1 MB slices.
+// A cache key, not a checksum against tampering; four independent
+// lanes per slice keep the multiplier busy.
+// ---------------------------------------------------------------------------
+
+static constexpr std::size_t   kHashSlice = std::size_t(1) << 20;
+static constexpr std::uint64_t kHashMul = 0x9E3779B97F4A7C15ull;
+
+static std::uint64_t HashMix(std::uint64_t h) noexcept
+{
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+static std::uint64_t HashSlice(const std::byte* p, std::size_t n, std::uint64_t seed) noexcept
+{
+    std::uint64_t h[4] = { seed, seed ^ kHashMul, ~seed, seed + kHashMul };
+
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            std::uint64_t w{};
+            std::memcpy(&w, p + i + k * 8, 8);
+            h[k] = (h[k] ^ w) * kHashMul;
+            h[k] ^= h[k] >> 29;
+        }
+    }
+
+    std::uint64_t tail = n;
+    for (; i < n; ++i)
+        tail = (tail ^ std::to_integer<std::uint64_t>(p[i])) * kHashMul;
+
+    return HashMix(h[0] ^ HashMix(h[1] ^ HashMix(h[2] ^ HashMix(h[3] ^ tail))));
+}
+
+export std::uint64_t ContentHash(std::span<const std::byte> data)
+{
+    const std::size_t slices = (data.size() + kHashSlice - 1) / kHashSlice;
+    std::vector<std::uint64_t> parts(slices);
+
+    GlobalPool().parallel_for(slices, [&](std::size_t k)
+        {
+            const std::size_t a = k * kHashSlice;
+            const std::size_t n = std::min(kHashSlice, data.size() - a);
+            parts[k] = HashSlice(data.data() + a, n, k);
+            JobBytes(n);
+        });
+
+    std::uint64_t h = data.size();
+    for (const auto p : parts)
+        h = HashMix((h ^ p) * kHashMul);
+    return h;
+}
+
+// ---------------------------------------------------------------------------
+// ProjectWriter: streams sections out one after another, so a large
+// cache is written straight from its arrays.
+// ---------------------------------------------------------------------------
+export class ProjectWriter
+{
+public:
+    bool open(const std::wstring& path, std::uint64_t fileSize, std::uint64_t fileHash)
+    {
+        m_path = path;
+        m_out = OpenFileStream(temp_path(), std::ios::binary | std::ios::out | std::ios::trunc);
+        m_entries.clear();
+        m_fileSize = fileSize;
+        m_fileHash = fileHash;
+        m_pos = 0;
+
+        // Zeros until finish(): no magic, no valid project.
+        const ProjectHeader blank{};
+        raw(&blank, sizeof(blank));
+        return m_out.good();
+    }
+
+    void begin(std::uint32_t tag)
+    {
+        align();
+        m_entries.push_back({ tag, 0, m_pos, 0 });
+    }
+
+    template<typename T>
+    void put(const T& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        raw(&v, sizeof(T));
+    }
+
+    // Element count, then the elements, 8-byte aligned so a reader
+    // can use them in place.
+    template<typename T>
+    void put_array(std::span<const T> v)
+    {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 8);
+        align();
+        put(std::uint64_t(v.size()));
+        raw(v.data(), v.size_bytes());
+    }
+
+    // UTF-16 units, whatever the size of wchar_t here.
+    void put_string(std::wstring_view s)
+    {
+        std::vector<std::uint16_t> units;
+        units.reserve(s.size());
+        for (const wchar_t c : s)
+        {
+            const auto u = static_cast<std::uint32_t>(c);
+            if (u >= 0x10000)
+            {
+                units.push_back(static_cast<std::uint16_t>(0xD800 + ((u - 0x10000) >> 10)));
+                units.push_back(static_cast<std::uint16_t>(0xDC00 + ((u - 0x10000) & 0x3FF)));
+            }
+            else
+            {
+                units.push_back(static_cast<std::uint16_t>(u));
+            }
+        }
+        put_array<std::uint16_t>(units);
+    }
+
+    // Directory, then the header, then the rename over the old
+    // database; false when anything failed, which leaves it as it was.
+    bool finish()
+    {
+        align();
+        const std::uint64_t directory = m_pos;
+
+        for (std::size_t i = 0; i < m_entries.size(); ++i)
+        {
+            const std::uint64_t end = i + 1 < m_entries.size() ? m_entries[i + 1].offset : directory;
+            m_entries[i].size = end - m_entries[i].offset;
+        }
+        raw(m_entries.data(), m_entries.size() * sizeof(ProjectEntry));
+
+        ProjectHeader h{};
+        std::memcpy(h.magic, kProjectMagic, sizeof(h.magic));
+        h.version = kProjectVersion;
+        h.sections = static_cast<std::uint32_t>(m_entries.size());
+        h.fileSize = m_fileSize;
+        h.fileHash = m_fileHash;
+        h.directory = directory;
+
+        m_out.seekp(0);
+        m_out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        m_out.flush();
+
+        const bool ok = m_out.good();
+        m_out.close();
+
+        if (!ok || !RenameFile(temp_path(), m_path))
+        {
+            RemoveFile(temp_path());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    [[nodiscard]] std::wstring temp_path() const
+    {
+        return m_path + L".tmp";
+    }
+
+    void raw(const void* p, std::size_t n)
+    {
+        m_out.write(static_cast<const char*>(p), static_cast<std::streamsize>(n));
+        m_pos += n;
+    }
+
+    void align()
+    {
+        static constexpr char kZero[8]{};
+        raw(kZero, (8 - m_pos % 8) % 8);
+    }
+
+    std::wstring              m_path;
+    std::fstream              m_out;
+    std::vector<ProjectEntry> m_entries;
+    std::uint64_t             m_fileSize{};
+    std::uint64_t             m_fileHash{};
+    std::uint64_t             m_pos{};
+};
+
+// ---------------------------------------------------------------------------
+// SectionReader: bounds-checked cursor over one section. Scalars are
+// copied out, arrays can be used in place; after the first short read
+// every further read fails too.
+// ---------------------------------------------------------------------------
+export class SectionReader
+{
+public:
+    SectionReader() = default;
+    explicit SectionReader(std::span<const std::byte> data) noexcept : m_data(data) {}
+
+    [[nodiscard]] bool ok() const noexcept { return m_ok; }
+    [[nodiscard]] bool empty() const noexcept { return m_data.empty(); }
+
+    template<typename T>
+    bool get(T& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto b = take(sizeof(T));
+        if (m_ok)
+            std::memcpy(&v, b.data(), sizeof(T));
+        return m_ok;
+    }
+
+    // An array written by put_array, in place in the mapping.
+    template<typename T>
+    std::span<const T> get_view()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto b = get_raw_array(sizeof(T));
+        if (!m_ok || reinterpret_cast<std::uintptr_t>(b.data()) % alignof(T) != 0)
+        {
+            m_ok = false;
+            return {};
+        }
+        return { reinterpret_cast<const T*>(b.data()), b.size() / sizeof(T) };
+    }
+
+    template<typename T>
+    bool get_array(std::vector<T>& out)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto b = get_raw_array(sizeof(T));
+        if (!m_ok)
+            return false;
+
+        out.resize(b.size() / sizeof(T));
+        if (!b.empty())
+            std::memcpy(out.data(), b.data(), b.size());
+        return true;
+    }
+
+    bool get_string(std::wstring& s)
+    {
+        std::vector<std::uint16_t> units;
+        if (!get_array(units))
+            return false;
+
+        s.clear();
+        s.reserve(units.size());
+        for (std::size_t i = 0; i < units.size(); ++i)
+        {
+            std::uint32_t u = units[i];
+            if constexpr (sizeof(wchar_t) == 4)
+            {
+                if (u >= 0xD800 && u < 0xDC00 && i + 1 < units.size())
+                    u = 0x10000 + ((u - 0xD800) << 10) + (units[++i] - 0xDC00u);
+            }
+            s += static_cast<wchar_t>(u);
+        }
+        return true;
+    }
+
+private:
+    std::span<const std::byte> take(std::size_t n)
+    {
+        if (!m_ok || n > m_data.size())
+        {
+            m_ok = false;
+            return {};
+        }
+        const auto b = m_data.first(n);
+        m_data = m_data.subspan(n);
+        m_pos += n;
+        return b;
+    }
+
+    // Padding, count, elements; the section itself starts aligned.
+    std::span<const std::byte> get_raw_array(std::size_t elementSize)
+    {
+        take((8 - m_pos % 8) % 8);
+
+        std::uint64_t n{};
+        if (!get(n) || n > m_data.size() / elementSize)
+        {
+            m_ok = false;
+            return {};
+        }
+        return take(static_cast<std::size_t>(n) * elementSize);
+    }
+
+    std::span<const std::byte> m_data;
+    std::size_t                m_pos{};
+    bool                       m_ok{ true };
+};
+
+// ---------------------------------------------------------------------------
+// ProjectFile: a project database mapped for reading. Opening checks
+// the header and directory only; sections are read when asked for.
+// ---------------------------------------------------------------------------
+export class ProjectFile
+{
+public:
+    bool open(const std::wstring& path)
+    {
+        m_entries = {};
+        if (!m_map.map(path) || m_map.size() < sizeof(ProjectHeader))
+        {
+            m_map.unmap();
+            return false;
+        }
+
+        const std::span<const std::byte> all(m_map.data(), m_map.size());
+        std::memcpy(&m_header, all.data(), sizeof(m_header));
+
+        const bool valid =
+            std::memcmp(m_header.magic, kProjectMagic, sizeof(kProjectMagic)) == 0 &&
+            m_header.version == kProjectVersion &&
+            m_header.directory <= all.size() &&
+            m_header.sections <= (all.size() - m_header.directory) / sizeof(ProjectEntry);
+
+        if (!valid)
+        {
+            m_map.unmap();
+            return false;
+        }
+
+        m_entries.resize(m_header.sections);
+        std::memcpy(m_entries.data(), all.data() + m_header.directory,
+            m_entries.size() * sizeof(ProjectEntry));
+
+        for (const auto& e : m_entries)
+        {
+            if (e.offset > m_header.directory || e.size > m_header.directory - e.offset)
+            {
+                m_map.unmap();
+                m_entries.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] bool is_open() const noexcept { return m_map.data() != nullptr; }
+
+    // Size and hash of the file the project was saved for.
+    [[nodiscard]] std::uint64_t file_size() const noexcept { return m_header.fileSize; }
+    [[nodiscard]] std::uint64_t file_hash() const noexcept { return m_header.fileHash; }
+
+    [[nodiscard]] bool has(std::uint32_t tag) const noexcept
+    {
+        return std::any_of(m_entries.begin(), m_entries.end(),
+            [tag](const ProjectEntry& e) { return e.tag == tag; });
+    }
+
+    // Reader over the section, empty when there is none.
+    [[nodiscard]] SectionReader section(std::uint32_t tag) const noexcept
+    {
+        for (const auto& e : m_entries)
+        {
+            if (e.tag == tag)
+                return SectionReader({ m_map.data() + e.offset, static_cast<std::size_t>(e.size) });
+        }
+        return {};
+    }
+
+private:
+    MappedFile                m_map;
+    ProjectHeader             m_header{};
+    std::vector<ProjectEntry> m_entries;
+};
+
+// ---------------------------------------------------------------------------
+// Analysis caches in and out of sections.
+//
+// The header hash covers the target file, not the project, so the
+// getters check what the readers of a cache rely on (lengths that
+// advance, ascending keys for the binary searches) and refuse a
+// section that does not hold up.
+// ---------------------------------------------------------------------------
+
+export void PutInstructions(ProjectWriter& w, const InstructionCache& code)
+{
+    const auto c = code.columns();
+    w.put_array(c.rva);
+    w.put_array(c.length);
+    w.put_array(c.mnemonic);
+    w.put_array(c.flow);
+    w.put_array(c.target);
+}
+
+export bool GetInstructions(SectionReader& r, InstructionCache& code)
+{
+    InstructionCache::Columns c;
+    c.rva = r.get_view<std::uint32_t>();
+    c.length = r.get_view<std::uint8_t>();
+    c.mnemonic = r.get_view<std::uint16_t>();
+    c.flow = r.get_view<FlowKind>();
+    c.target = r.get_view<std::uint32_t>();
+
+    const std::size_t n = c.rva.size();
+    if (!r.ok() || c.length.size() != n || c.mnemonic.size() != n ||
+        c.flow.size() != n || c.target.size() != n)
+    {
+        return false;
+    }
+
+    // x86 instructions are 1 to 15 bytes; each starts at its own RVA.
+    if (std::any_of(c.length.begin(), c.length.end(),
+            [](std::uint8_t len) { return len == 0 || len > 15; }) ||
+        std::adjacent_find(c.rva.begin(), c.rva.end(),
+            [](std::uint32_t a, std::uint32_t b) { return a >= b; }) != c.rva.end())
+    {
+        return false;
+    }
+
+    code.assign(c);
+    return true;
+}
+
+export void PutXrefs(ProjectWriter& w, const XrefIndex& xrefs)
+{
+    static_assert(sizeof(Xref) == 12);
+    w.put_array(xrefs.by_from());
+    w.put_array(xrefs.by_to());
+}
+
+export bool GetXrefs(SectionReader& r, XrefIndex& xrefs)
+{
+    const auto byFrom = r.get_view<Xref>();
+    const auto byTo = r.get_view<Xref>();
+    if (!r.ok() || byFrom.size() != byTo.size())
+        return false;
+
+    auto fromOrder = [](const Xref& x, const Xref& y) { return x.from < y.from; };
+    auto toOrder = [](const Xref& x, const Xref& y)
+        {
+            return x.to != y.to ? x.to < y.to : x.from < y.from;
+        };
+    if (!std::is_sorted(byFrom.begin(), byFrom.end(), fromOrder) ||
+        !std::is_sorted(byTo.begin(), byTo.end(), toOrder))
+    {
+        return false;
+    }
+
+    xrefs.assign(byFrom, byTo);
+    return true;
+}
+
+// Function table as load_functions and guess_functions leave it:
+// every function nonempty, sorted by start.
+export bool GetFunctions(SectionReader& r, std::vector<pe::Function>& out)
+{
+    if (!r.get_array(out))
+        return false;
+
+    const bool sane =
+        std::all_of(out.begin(), out.end(), [](const pe::Function& f) { return f.begin < f.end; }) &&
+        std::is_sorted(out.begin(), out.end(),
+            [](const pe::Function& a, const pe::Function& b) { return a.begin < b.begin; });
+
+    if (!sane)
+        out.clear();
+    return sane;
+}
+
+export void PutSweepStats(ProjectWriter& w, const SweepStats& st)
+{
+    w.put_string(std::wstring(st.section.begin(), st.section.end()));
+    w.put(st.rva);
+    w.put(std::uint64_t(st.bytes));
+    w.put(std::uint64_t(st.instructions));
+    w.put(std::uint64_t(st.undecodable));
+    w.put(std::uint64_t(st.segments));
+    w.put(std::uint64_t(st.resyncs));
+    w.put(std::uint32_t(st.threads));
+    w.put(st.seconds);
+}
+
+export bool GetSweepStats(SectionReader& r, SweepStats& st)
+{
+    std::wstring section;
+    std::uint64_t bytes{}, instructions{}, undecodable{}, segments{}, resyncs{};
+    std::uint32_t threads{};
+
+    if (!r.get_string(section) || !r.get(st.rva) || !r.get(bytes) || !r.get(instructions) ||
+        !r.get(undecodable) || !r.get(segments) || !r.get(resyncs) || !r.get(threads) ||
+        !r.get(st.seconds))
+    {
+        return false;
+    }
+
+    st.section.assign(section.begin(), section.end());
+    st.bytes = static_cast<std::size_t>(bytes);
+    st.instructions = static_cast<std::size_t>(instructions);
+    st.undecodable = static_cast<std::size_t>(undecodable);
+    st.segments = static_cast<std::size_t>(segments);
+    st.resyncs = static_cast<std::size_t>(resyncs);
+    st.threads = threads;
+    return true;
+}
@@ -0,0 +1,307 @@
+export module mod_signature;
+
+import mod_pe_utils;
+import mod_disasm;
+import mod_patterns;
+import mod_pattern_index;
+
+import <string>;
+import <vector>;
+import <span>;
+import <optional>;
+import <cstddef>;
+import <cstdint>;
+import <algorithm>;
+
+// Zydis include via vcpkg
+import "Zycore/Types.h";
+import "Zydis/Zydis.h";
+
+// ------------------------------------------------------------
+// Unique signatures
+//
+// Instructions are decoded from the offset and their bytes laid
+// out as a pattern, with the parts that move between builds
+// wildcarded: RIP-relative displacements, rel32 branch targets,
+// relocated bytes and immediates or displacements that hold an
+// address inside the image. Every prefix of that pattern ending
+// on an exact byte is a candidate; the shortest candidate with
+// exactly one hit in the code section is the signature.
+// ------------------------------------------------------------
+
+export struct Signature
+{
+    Pattern     pattern;            // shortest unique prefix; empty when none
+    std::size_t offset{};
+    std::size_t scopeBegin{};       // file range searched for other hits
+    std::size_t scopeEnd{};
+    std::size_t decoded{};          // pattern bytes available, up to the limit
+    std::size_t instructions{};     // instructions the signature covers
+    std::size_t matches{};          // hits of the longest candidate when none was unique
+    bool        indexed{};          // uniqueness checked through the pattern index
+};
+
+// "48 8B 05 ?? ?? ?? ??", as ParsePattern reads it back.
+export std::wstring FormatPattern(const Pattern& pat)
+{
+    static constexpr wchar_t kHex[] = L"0123456789ABCDEF";
+
+    std::wstring out;
+    out.reserve(pat.size() * 3);
+
+    for (std::size_t i = 0; i < pat.size(); ++i)
+    {
+        if (i)
+            out.push_back(L' ');
+
+        const unsigned v = pat.value[i];
+        const unsigned m = pat.mask[i];
+        out.push_back(m & 0xF0 ? kHex[v >> 4] : L'?');
+        out.push_back(m & 0x0F ? kHex[v & 0xF] : L'?');
+    }
+
+    return out;
+}
+
+// Candidates need this many exact bytes; shorter ones hit all over.
+static constexpr std::size_t kMinExact = 4;
+
+struct SigBytes
+{
+    Pattern                  pattern;
+    std::vector<std::size_t> starts;    // instruction offsets into pattern
+};
+
+static void Wildcard(Pattern& p, std::size_t at, std::size_t len)
+{
+    for (std::size_t k = at; k < at + len && k < p.size(); ++k)
+    {
+        p.value[k] = 0;
+        p.mask[k] = 0;
+    }
+}
+
+// Decode from offset up to end, at most maxBytes, and wildcard what
+// moves between builds.
+static SigBytes ReadCode(std::span<const std::byte> data,
+    const pe::Layout& L,
+    const pe::DataDirectories* dirs,
+    std::size_t offset,
+    std::size_t end,
+    std::size_t maxBytes)
+{
+    SigBytes out;
+
+    ZydisDecoder decoder{};
+    if (ZYAN_FAILED(InitDecoder(decoder, L)))
+        return out;
+
+    // Addresses inside the image, for immediates and absolute
+    // displacements that point into it.
+    std::uint64_t imageEnd = 0;
+    for (const auto& s : L.sections)
+        imageEnd = (std::max)(imageEnd, std::uint64_t(s.virtualAddress) + (std::max)(s.virtualSize, s.rawSize));
+
+    auto isAddress = [&](std::uint64_t v, std::uint8_t bits)
+        {
+            if (!L.valid || bits < 32)
+                return false;
+            if (bits == 32)
+                v &= 0xFFFFFFFFull;
+            return v >= L.imageBase && v - L.imageBase < imageEnd;
+        };
+
+    // DIR64 patches eight bytes, everything else four.
+    const auto relocs = dirs ? dirs->relocations() : std::span<const pe::Relocation>{};
+    auto relocWidth = [](const pe::Relocation& r) { return r.type == 10 ? 8u : 4u; };
+
+    std::uint32_t rva = static_cast<std::uint32_t>(offset);
+    if (L.valid && !pe::file_to_rva(L, offset, rva))
+        return out;
+
+    const std::size_t last = (std::min)(end, offset + maxBytes);
+    std::size_t at = offset;
+
+    while (at < last)
+    {
+        ZydisDecodedInstruction inst{};
+        ZydisDecodedOperand     ops[ZYDIS_MAX_OPERAND_COUNT]{};
+
+        if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder,
+            data.data() + at, end - at, &inst, ops)))
+        {
+            break;
+        }
+
+        const std::size_t base = out.pattern.size();
+        const auto* code = reinterpret_cast<const unsigned char*>(data.data() + at);
+
+        out.starts.push_back(base);
+        out.pattern.value.insert(out.pattern.value.end(), code, code + inst.length);
+        out.pattern.mask.insert(out.pattern.mask.end(), inst.length, 0xFF);
+
+        for (std::uint8_t k = 0; k < inst.operand_count; ++k)
+        {
+            const auto& op = ops[k];
+            if (op.type != ZYDIS_OPERAND_TYPE_MEMORY || !inst.raw.disp.size)
+                continue;
+
+            const bool ripRelative = op.mem.base == ZYDIS_REGISTER_RIP || op.mem.base == ZYDIS_REGISTER_EIP;
+            const bool absolute = op.mem.base == ZYDIS_REGISTER_NONE && op.mem.index == ZYDIS_REGISTER_NONE;
+            if (ripRelative || (absolute && isAddress(static_cast<std::uint64_t>(inst.raw.disp.value), inst.raw.disp.size)))
+                Wildcard(out.pattern, base + inst.raw.disp.offset, inst.raw.disp.size / 8);
+        }
+
+        for (const auto& imm : inst.raw.imm)
+        {
+            if (!imm.size)
+                continue;
+
+            if (imm.is_relative ? imm.size >= 32 : isAddress(imm.value.u, imm.size))
+                Wildcard(out.pattern, base + imm.offset, imm.size / 8);
+        }
+
+        // Relocated bytes are addresses by definition, whatever the
+        // decoder made of them.
+        if (!relocs.empty())
+        {
+            auto it = std::lower_bound(relocs.begin(), relocs.end(), rva >= 7 ? rva - 7 : 0,
+                [](const pe::Relocation& r, std::uint32_t v) { return r.rva < v; });
+            for (; it != relocs.end() && it->rva < rva + inst.length; ++it)
+            {
+                if (it->rva + relocWidth(*it) <= rva)
+                    continue;
+
+                const std::size_t a = it->rva > rva ? it->rva - rva : 0;
+                const std::size_t b = (std::min)<std::size_t>(inst.length, it->rva + relocWidth(*it) - rva);
+                Wildcard(out.pattern, base + a, b - a);
+            }
+        }
+
+        at += inst.length;
+        rva += inst.length;
+    }
+
+    // The last instruction may run past the limit.
+    if (out.pattern.size() > maxBytes)
+    {
+        out.pattern.value.resize(maxBytes);
+        out.pattern.mask.resize(maxBytes);
+    }
+
+    return out;
+}
+
+static Pattern Prefix(const Pattern& p, std::size_t len)
+{
+    return { { p.value.begin(), p.value.begin() + len }, { p.mask.begin(), p.mask.begin() + len } };
+}
+
+// Shortest prefix of the pattern at offset that matches nowhere else
+// in the code section. Nullopt when offset is not in the code section
+// or does not decode. When index is ready, each candidate is one
+// lookup and a binary search over lengths finds the shortest;
+// otherwise every candidate goes into one PatternSet and a single
+// pass over the section counts them all.
+export std::optional<Signature> MakeSignature(std::span<const std::byte> data,
+    const pe::Layout& L,
+    const pe::DataDirectories* dirs,
+    std::size_t offset,
+    std::size_t maxBytes,
+    const PatternIndex& index)
+{
+    Signature sig;
+    sig.offset = offset;
+    sig.scopeEnd = data.size();
+
+    if (L.valid)
+    {
+        const pe::Section* text = L.text();
+        if (!text)
+            return std::nullopt;
+
+        sig.scopeBegin = text->rawOffset;
+        sig.scopeEnd = (std::min)(data.size(), std::size_t(text->rawOffset) + text->rawSize);
+    }
+
+    if (offset < sig.scopeBegin || offset >= sig.scopeEnd)
+        return std::nullopt;
+
+    const SigBytes laid = ReadCode(data, L, dirs, offset, sig.scopeEnd, maxBytes);
+    if (laid.pattern.empty())
+        return std::nullopt;
+
+    const Pattern& full = laid.pattern;
+    sig.decoded = full.size();
+
+    std::vector<std::size_t> lengths;
+    std::size_t exact = 0;
+    for (std::size_t k = 0; k < full.size(); ++k)
+    {
+        if (full.mask[k] != 0xFF)
+            continue;
+        if (++exact >= kMinExact)
+            lengths.push_back(k + 1);
+    }
+
+    if (lengths.empty())
+        return sig;
+
+    const auto code = data.first(sig.scopeEnd);
+
+    // The pattern was read off the live bytes, so offset itself is
+    // always a hit; one hit is unique.
+    std::size_t found = SIZE_MAX;
+
+    if (index.stats().status == PatternIndex::Status::Ready)
+    {
+        sig.indexed = true;
+
+        auto count = [&](std::size_t len, std::size_t limit)
+            {
+                return FindPatternAll(code, Prefix(full, len), sig.scopeBegin, index, limit).size();
+            };
+
+        sig.matches = count(lengths.back(), SIZE_MAX);
+        if (sig.matches == 1)
+        {
+            // Hits only drop as the prefix grows. A second hit is all
+            // it takes to rule a length out, so none are collected past it.
+            std::size_t lo = 0, hi = lengths.size() - 1;
+            while (lo < hi)
+            {
+                const std::size_t mid = lo + (hi - lo) / 2;
+                if (count(lengths[mid], 2) == 1)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            found = lengths[lo];
+        }
+    }
+    else
+    {
+        PatternSet set;
+        for (const auto len : lengths)
+            set.add(Prefix(full, len));
+
+        std::vector<std::size_t> counts(lengths.size());
+        for (const auto& h : FindAll(code.subspan(sig.scopeBegin), set))
+            ++counts[h.pattern];
+
+        const auto it = std::find(counts.begin(), counts.end(), std::size_t(1));
+        if (it != counts.end())
+            found = lengths[it - counts.begin()];
+        else
+            sig.matches = counts.back();
+    }
+
+    if (found == SIZE_MAX)
+        return sig;
+
+    sig.pattern = Prefix(full, found);
+    sig.matches = 1;
+    sig.instructions = static_cast<std::size_t>(
+        std::lower_bound(laid.starts.begin(), laid.starts.end(), found) - laid.starts.begin());
+    return sig;
+}
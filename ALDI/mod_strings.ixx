@@ -0,0 +1,631 @@
+module;
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ALDI_STRINGS_SSE2 1
+#include <immintrin.h>
+#endif
+
+export module mod_strings;
+
+import mod_pe_utils;
+import mod_threadpool;
+
+import <string>;
+import <string_view>;
+import <vector>;
+import <span>;
+import <regex>;
+import <bit>;
+import <cctype>;
+import <cstddef>;
+import <cstdint>;
+import <cstring>;
+import <algorithm>;
+
+// ------------------------------------------------------------
+// One string found in the file. Text lives once per distinct
+// string in the table; occurrences point at it.
+// ------------------------------------------------------------
+
+export enum class StringEncoding : std::uint8_t
+{
+    Ascii,
+    Utf16       // UTF-16LE, printable ASCII range only
+};
+
+export struct StringRef
+{
+    static constexpr std::uint16_t kNoSection = 0xFFFF;
+
+    std::uint64_t  offset{};        // file offset of the first character
+    std::uint32_t  text{};          // StringTable::text id
+    std::uint32_t  length{};        // characters
+    StringEncoding encoding{};
+    std::uint16_t  section{ kNoSection };   // index into the layout's sections
+};
+
+// ------------------------------------------------------------
+// Printable-run detection
+//
+// Each 64-byte block becomes two bit masks: bytes that are
+// printable (0x20..0x7e or tab), and bytes whose successor is
+// zero. ASCII strings are runs of the first; UTF-16 characters
+// are "printable & next is zero" at every other position, and
+// runs of those are found separately for even and odd starts.
+// ------------------------------------------------------------
+
+static bool Printable(unsigned char c) noexcept
+{
+    return (c >= 0x20 && c < 0x7F) || c == '\t';
+}
+
+struct BlockMasks
+{
+    std::uint64_t printable{};
+    std::uint64_t zeroNext{};
+};
+
+// Bytes past size count as neither printable nor zero.
+static BlockMasks MasksScalar(const unsigned char* d, std::size_t i, std::size_t size) noexcept
+{
+    BlockMasks m;
+    for (std::size_t k = 0; k < 64 && i + k < size; ++k)
+    {
+        if (Printable(d[i + k]))
+            m.printable |= std::uint64_t(1) << k;
+        if (i + k + 1 < size && d[i + k + 1] == 0)
+            m.zeroNext |= std::uint64_t(1) << k;
+    }
+    return m;
+}
+
+#ifdef ALDI_STRINGS_SSE2
+
+// Reads 65 bytes from d + i.
+static BlockMasks MasksSSE2(const unsigned char* d, std::size_t i) noexcept
+{
+    const __m128i first = _mm_set1_epi8(0x20);
+    const __m128i range = _mm_set1_epi8(0x5E);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i zero = _mm_setzero_si128();
+
+    BlockMasks m;
+    for (int q = 0; q < 4; ++q)
+    {
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i + q * 16));
+        const __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i + q * 16 + 1));
+
+        // b - 0x20 <= 0x5e, unsigned: min() leaves it unchanged.
+        const __m128i rel = _mm_sub_epi8(b, first);
+        const __m128i printable = _mm_or_si128(
+            _mm_cmpeq_epi8(_mm_min_epu8(rel, range), rel),
+            _mm_cmpeq_epi8(b, tab));
+
+        m.printable |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(printable))) << (q * 16);
+        m.zeroNext |= std::uint64_t(static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(n, zero)))) << (q * 16);
+    }
+    return m;
+}
+
+#endif // ALDI_STRINGS_SSE2
+
+static BlockMasks Masks(const unsigned char* d, std::size_t i, std::size_t size) noexcept
+{
+#ifdef ALDI_STRINGS_SSE2
+    if (i + 65 <= size)
+        return MasksSSE2(d, i);
+#endif
+    return MasksScalar(d, i, size);
+}
+
+// Bits 0, 2, 4, ... of x packed into the low 32 bits.
+static std::uint64_t EvenBits(std::uint64_t x) noexcept
+{
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return x;
+}
+
+struct Run
+{
+    std::uint64_t  offset;
+    std::uint32_t  length;
+    StringEncoding encoding;
+};
+
+// Runs of set bits in a stream of masks, one bit per character
+// position. Only runs starting before end are reported; one open
+// at end is followed past it, and one carried in from before the
+// start of the slice is skipped.
+class RunScanner
+{
+public:
+    RunScanner(StringEncoding enc, unsigned stride, std::size_t end, std::size_t minLength) noexcept
+        : m_enc(enc), m_stride(stride), m_end(end), m_min(minLength)
+    {
+    }
+
+    void skip_first() noexcept { m_open = true; m_skip = true; }
+    [[nodiscard]] bool open() const noexcept { return m_open; }
+
+    // valid holds width bits for positions base, base + stride, ...
+    void feed(std::uint64_t valid, unsigned width, std::size_t base, std::vector<Run>& out)
+    {
+        unsigned k = 0;
+        while (k < width)
+        {
+            const std::uint64_t rest = valid >> k;
+            if (m_open)
+            {
+                k += std::min<unsigned>(static_cast<unsigned>(std::countr_one(rest)), width - k);
+                if (k < width)
+                    close(base + std::size_t(k) * m_stride, out);
+            }
+            else
+            {
+                if (m_done || rest == 0)
+                    return;
+
+                k += static_cast<unsigned>(std::countr_zero(rest));
+                const std::size_t at = base + std::size_t(k) * m_stride;
+                if (at >= m_end)
+                {
+                    m_done = true;
+                    return;
+                }
+                m_open = true;
+                m_start = at;
+            }
+        }
+    }
+
+private:
+    void close(std::size_t at, std::vector<Run>& out)
+    {
+        const std::size_t length = (at - m_start) / m_stride;
+        if (!m_skip && length >= m_min)
+            out.push_back({ m_start, static_cast<std::uint32_t>(length), m_enc });
+
+        m_open = false;
+        m_skip = false;
+    }
+
+    StringEncoding m_enc;
+    unsigned       m_stride;
+    std::size_t    m_end;
+    std::size_t    m_min;
+    std::size_t    m_start{};
+    bool           m_open{};
+    bool           m_skip{};
+    bool           m_done{};
+};
+
+// All runs starting in [begin, end), in offset order.
+static void ScanSlice(std::span<const std::byte> data, std::size_t begin, std::size_t end,
+    std::size_t minLength, std::vector<Run>& out)
+{
+    const auto* d = reinterpret_cast<const unsigned char*>(data.data());
+    const std::size_t size = data.size();
+
+    RunScanner ascii(StringEncoding::Ascii, 1, end, minLength);
+    RunScanner even(StringEncoding::Utf16, 2, end, minLength);
+    RunScanner odd(StringEncoding::Utf16, 2, end, minLength);
+
+    // Runs that started in the previous slice belong to it.
+    if (begin > 0)
+    {
+        if (Printable(d[begin - 1]))
+            ascii.skip_first();
+        if (begin >= 2 && Printable(d[begin - 2]) && d[begin - 1] == 0)
+            even.skip_first();
+        if (Printable(d[begin - 1]) && d[begin] == 0)
+            odd.skip_first();
+    }
+
+    std::size_t i = begin;
+    for (; i < size && (i < end || ascii.open() || even.open() || odd.open()); i += 64)
+    {
+        const BlockMasks m = Masks(d, i, size);
+        const std::uint64_t utf16 = m.printable & m.zeroNext;
+
+        ascii.feed(m.printable, 64, i, out);
+        even.feed(EvenBits(utf16), 32, i, out);
+        odd.feed(EvenBits(utf16 >> 1), 32, i + 1, out);
+    }
+
+    // A run reaching the end of the file ends there.
+    ascii.feed(0, 1, i, out);
+    even.feed(0, 1, i, out);
+    odd.feed(0, 1, i + 1, out);
+
+    std::sort(out.begin(), out.end(),
+        [](const Run& a, const Run& b) { return a.offset < b.offset; });
+}
+
+// ------------------------------------------------------------
+// Trigram keys: the 96 characters a string can hold, base 96.
+// ------------------------------------------------------------
+
+static constexpr std::size_t kGramCount = std::size_t(96) * 96 * 96;
+
+static std::uint32_t GramChar(unsigned char c) noexcept
+{
+    return c == '\t' ? 95u : static_cast<std::uint32_t>(c - 0x20);
+}
+
+static std::uint32_t GramAt(std::string_view s, std::size_t i) noexcept
+{
+    return (GramChar(s[i]) * 96 + GramChar(s[i + 1])) * 96 + GramChar(s[i + 2]);
+}
+
+// The longest run of literal characters every match of re must
+// contain, or "" when there is none worth filtering on. Only the
+// top level counts; anything under a quantifier or in a group may
+// be absent, and alternation gives up entirely.
+export std::string RequiredLiteral(std::string_view re)
+{
+    if (re.find('|') != std::string_view::npos)
+        return {};
+
+    std::string best, cur;
+    auto flush = [&]
+        {
+            if (cur.size() > best.size())
+                best = cur;
+            cur.clear();
+        };
+
+    int depth = 0;
+    for (std::size_t i = 0; i < re.size(); ++i)
+    {
+        const char c = re[i];
+        char literal{};
+
+        switch (c)
+        {
+        case '[':
+            flush();
+            while (++i < re.size() && re[i] != ']')
+            {
+                if (re[i] == '\\')
+                    ++i;
+            }
+            continue;
+        case '(':
+            ++depth;
+            flush();
+            continue;
+        case ')':
+            --depth;
+            flush();
+            continue;
+        case '*':
+        case '?':
+        case '{':
+            if (!cur.empty())
+                cur.pop_back();
+            flush();
+            if (c == '{')
+                i = std::min(re.find('}', i), re.size());
+            continue;
+        case '+':
+        case '.':
+        case '^':
+        case '$':
+            flush();
+            continue;
+        case '\\':
+            if (i + 1 < re.size() && !std::isalnum(static_cast<unsigned char>(re[i + 1])))
+            {
+                literal = re[++i];
+                break;
+            }
+
+            // A class (\d), an assertion (\b) or an escape with an
+            // operand (\x41, \u0041, \cA, a \12 back-reference):
+            // skip all of it, the operand is not text to look for.
+            if (++i < re.size())
+            {
+                std::size_t operand = 0;
+                if (re[i] == 'x')
+                    operand = 2;
+                else if (re[i] == 'u')
+                    operand = 4;
+                else if (re[i] == 'c')
+                    operand = 1;
+                else
+                {
+                    while (i + 1 < re.size() && std::isdigit(static_cast<unsigned char>(re[i + 1])))
+                        ++i;
+                }
+                i = (std::min)(i + operand, re.size() - 1);
+            }
+            flush();
+            continue;
+        default:
+            literal = c;
+            break;
+        }
+
+        if (depth == 0)
+            cur += literal;
+        else
+            flush();
+    }
+
+    flush();
+    return best;
+}
+
+// ------------------------------------------------------------
+// StringTable: every string of a file, deduplicated and sorted,
+// with a trigram index over the distinct texts so substring and
+// regex queries never go back to the file.
+// ------------------------------------------------------------
+
+export class StringTable
+{
+public:
+    static constexpr std::size_t kMinLength = 4;
+    static constexpr std::size_t kSlice = std::size_t(4) << 20;
+
+    [[nodiscard]] bool empty() const noexcept { return m_refs.empty(); }
+    [[nodiscard]] std::size_t size() const noexcept { return m_refs.size(); }
+    [[nodiscard]] std::size_t distinct() const noexcept { return m_textBegin.empty() ? 0 : m_textBegin.size() - 1; }
+
+    [[nodiscard]] std::span<const StringRef> all() const noexcept { return m_refs; }
+
+    [[nodiscard]] std::string_view text(std::uint32_t id) const noexcept
+    {
+        return std::string_view(m_pool).substr(m_textBegin[id], m_textBegin[id + 1] - m_textBegin[id]);
+    }
+
+    void clear() noexcept
+    {
+        m_refs.clear();
+        m_pool.clear();
+        m_textBegin.clear();
+        m_refStart.clear();
+        m_refIndex.clear();
+        m_gramStart.clear();
+        m_gramTexts.clear();
+    }
+
+    void build(std::span<const std::byte> data, const pe::Layout& layout)
+    {
+        clear();
+
+        // 1. Runs, one slice per task.
+        const std::size_t slices = (data.size() + kSlice - 1) / kSlice;
+        std::vector<std::vector<Run>> parts(slices);
+
+        GlobalPool().parallel_for(slices, [&](std::size_t k)
+            {
+                JobCheckpoint();
+
+                const std::size_t b = k * kSlice;
+                ScanSlice(data, b, std::min(b + kSlice, data.size()), kMinLength, parts[k]);
+                JobBytes(std::min(kSlice, data.size() - b));
+            });
+
+        std::vector<Run> runs;
+        std::size_t total = 0;
+        for (const auto& p : parts)
+            total += p.size();
+        runs.reserve(total);
+        for (const auto& p : parts)
+            runs.insert(runs.end(), p.begin(), p.end());
+        parts = {};
+
+        // 2. Text of each run: ASCII in place, UTF-16 narrowed into one
+        //    buffer (every character is in the ASCII range).
+        std::string narrowed;
+        std::size_t wide = 0;
+        for (const auto& r : runs)
+            wide += r.encoding == StringEncoding::Utf16 ? r.length : 0;
+        narrowed.reserve(wide);
+
+        std::vector<std::string_view> texts(runs.size());
+        std::vector<std::size_t> at(runs.size());
+        for (std::size_t i = 0; i < runs.size(); ++i)
+        {
+            const auto* p = reinterpret_cast<const char*>(data.data()) + runs[i].offset;
+            if (runs[i].encoding == StringEncoding::Ascii)
+            {
+                texts[i] = { p, runs[i].length };
+                continue;
+            }
+
+            at[i] = narrowed.size();
+            for (std::uint32_t c = 0; c < runs[i].length; ++c)
+                narrowed += p[c * 2];
+        }
+        for (std::size_t i = 0; i < runs.size(); ++i)
+        {
+            if (runs[i].encoding == StringEncoding::Utf16)
+                texts[i] = std::string_view(narrowed).substr(at[i], runs[i].length);
+        }
+
+        // 3. Distinct texts in sorted order, then occurrences by offset.
+        std::vector<std::uint32_t> order(runs.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = static_cast<std::uint32_t>(i);
+        std::sort(order.begin(), order.end(),
+            [&](std::uint32_t a, std::uint32_t b) { return texts[a] < texts[b]; });
+
+        std::vector<std::uint32_t> id(runs.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+        {
+            if (i == 0 || texts[order[i]] != texts[order[i - 1]])
+            {
+                m_textBegin.push_back(static_cast<std::uint32_t>(m_pool.size()));
+                m_pool += texts[order[i]];
+            }
+            id[order[i]] = static_cast<std::uint32_t>(m_textBegin.size() - 1);
+        }
+        m_textBegin.push_back(static_cast<std::uint32_t>(m_pool.size()));
+
+        std::vector<const pe::Section*> sections;
+        if (layout.valid)
+        {
+            for (const auto& s : layout.sections)
+                sections.push_back(&s);
+            std::sort(sections.begin(), sections.end(),
+                [](const pe::Section* a, const pe::Section* b) { return a->rawOffset < b->rawOffset; });
+        }
+
+        m_refs.resize(runs.size());
+        for (std::size_t i = 0; i < runs.size(); ++i)
+        {
+            StringRef& s = m_refs[i];
+            s.offset = runs[i].offset;
+            s.text = id[i];
+            s.length = runs[i].length;
+            s.encoding = runs[i].encoding;
+
+            auto it = std::upper_bound(sections.begin(), sections.end(), s.offset,
+                [](std::uint64_t v, const pe::Section* x) { return v < x->rawOffset; });
+            if (it != sections.begin())
+            {
+                const pe::Section* x = *(it - 1);
+                if (s.offset - x->rawOffset < x->rawSize)
+                    s.section = static_cast<std::uint16_t>(x - layout.sections.data());
+            }
+        }
+
+        // 4. Occurrences of each text, and the trigram postings.
+        m_refStart.assign(distinct() + 1, 0);
+        for (const auto& s : m_refs)
+            ++m_refStart[s.text + 1];
+        for (std::size_t t = 0; t < distinct(); ++t)
+            m_refStart[t + 1] += m_refStart[t];
+
+        m_refIndex.resize(m_refs.size());
+        std::vector<std::uint32_t> fill(m_refStart.begin(), m_refStart.end() - 1);
+        for (std::size_t i = 0; i < m_refs.size(); ++i)
+            m_refIndex[fill[m_refs[i].text]++] = static_cast<std::uint32_t>(i);
+
+        build_grams();
+    }
+
+    // Occurrences whose text contains needle, in offset order.
+    [[nodiscard]] std::vector<StringRef> find(std::string_view needle, std::size_t minLength = 0) const
+    {
+        std::vector<std::uint32_t> texts;
+        candidates(needle, texts);
+
+        std::erase_if(texts, [&](std::uint32_t t)
+            {
+                return text(t).size() < minLength || text(t).find(needle) == std::string_view::npos;
+            });
+        return occurrences(texts);
+    }
+
+    // Occurrences whose text re matches somewhere, in offset order.
+    [[nodiscard]] std::vector<StringRef> match(const std::regex& re, std::string_view literal,
+        std::size_t minLength = 0) const
+    {
+        std::vector<std::uint32_t> texts;
+        candidates(literal, texts);
+
+        std::erase_if(texts, [&](std::uint32_t t)
+            {
+                const auto s = text(t);
+                return s.size() < minLength || (!literal.empty() && s.find(literal) == std::string_view::npos) ||
+                    !std::regex_search(s.begin(), s.end(), re);
+            });
+        return occurrences(texts);
+    }
+
+private:
+    void build_grams()
+    {
+        m_gramStart.assign(kGramCount + 1, 0);
+
+        // Each text counts once per distinct trigram it holds.
+        std::vector<std::uint32_t> grams;
+        auto distinctGrams = [&](std::string_view s)
+            {
+                grams.clear();
+                for (std::size_t i = 0; i + 3 <= s.size(); ++i)
+                    grams.push_back(GramAt(s, i));
+                std::sort(grams.begin(), grams.end());
+                grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+            };
+
+        for (std::uint32_t t = 0; t < distinct(); ++t)
+        {
+            distinctGrams(text(t));
+            for (const auto g : grams)
+                ++m_gramStart[g + 1];
+        }
+        for (std::size_t g = 0; g < kGramCount; ++g)
+            m_gramStart[g + 1] += m_gramStart[g];
+
+        m_gramTexts.resize(m_gramStart.back());
+        std::vector<std::uint32_t> fill(m_gramStart.begin(), m_gramStart.end() - 1);
+        for (std::uint32_t t = 0; t < distinct(); ++t)
+        {
+            distinctGrams(text(t));
+            for (const auto g : grams)
+                m_gramTexts[fill[g]++] = t;
+        }
+    }
+
+    // Texts that may contain needle: the posting list of its rarest
+    // trigram, or every text when it is too short to have one.
+    void candidates(std::string_view needle, std::vector<std::uint32_t>& out) const
+    {
+        out.clear();
+
+        if (needle.size() < 3)
+        {
+            out.resize(distinct());
+            for (std::uint32_t t = 0; t < out.size(); ++t)
+                out[t] = t;
+            return;
+        }
+
+        if (!std::all_of(needle.begin(), needle.end(),
+            [](char c) { return Printable(static_cast<unsigned char>(c)); }))
+        {
+            return;
+        }
+
+        std::uint32_t rarest = GramAt(needle, 0);
+        for (std::size_t i = 1; i + 3 <= needle.size(); ++i)
+        {
+            const std::uint32_t g = GramAt(needle, i);
+            if (m_gramStart[g + 1] - m_gramStart[g] < m_gramStart[rarest + 1] - m_gramStart[rarest])
+                rarest = g;
+        }
+
+        out.assign(m_gramTexts.begin() + m_gramStart[rarest], m_gramTexts.begin() + m_gramStart[rarest + 1]);
+    }
+
+    std::vector<StringRef> occurrences(std::span<const std::uint32_t> texts) const
+    {
+        std::vector<std::uint32_t> refs;
+        for (const auto t : texts)
+            refs.insert(refs.end(), m_refIndex.begin() + m_refStart[t], m_refIndex.begin() + m_refStart[t + 1]);
+        std::sort(refs.begin(), refs.end());
+
+        std::vector<StringRef> out;
+        out.reserve(refs.size());
+        for (const auto i : refs)
+            out.push_back(m_refs[i]);
+        return out;
+    }
+
+    std::vector<StringRef>     m_refs;          // by offset
+    std::string                m_pool;          // distinct texts, sorted, back to back
+    std::vector<std::uint32_t> m_textBegin;     // text id → start in m_pool; one extra at the end
+    std::vector<std::uint32_t> m_refStart;      // text id → its occurrences in m_refIndex
+    std::vector<std::uint32_t> m_refIndex;
+    std::vector<std::uint32_t> m_gramStart;     // trigram → its texts in m_gramTexts
+    std::vector<std::uint32_t> m_gramTexts;
+};
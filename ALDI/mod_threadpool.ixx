@@ -0,0 +1,338 @@
+export module mod_threadpool;
+
+import <vector>;
+import <deque>;
+import <thread>;
+import <mutex>;
+import <condition_variable>;
+import <atomic>;
+import <functional>;
+import <memory>;
+import <exception>;
+import <chrono>;
+import <stop_token>;
+import <cstddef>;
+import <cstdint>;
+import <algorithm>;
+
+// ------------------------------------------------------------
+// Work-stealing thread pool
+//
+// Each worker owns a deque: it pushes and pops at the back and
+// steals from the front of the others when it runs dry. Threads
+// that wait in parallel_for run queued tasks themselves instead
+// of blocking, so nested parallel_for calls cannot deadlock.
+// ------------------------------------------------------------
+
+export class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency())
+    {
+        threads = (std::max)(threads, 1u);
+
+        for (unsigned i = 0; i < threads; ++i)
+            m_queues.push_back(std::make_unique<Queue>());
+
+        for (unsigned i = 0; i < threads; ++i)
+            m_threads.emplace_back([this, i] { worker(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lk(m_wakeMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+
+        for (auto& t : m_threads)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] unsigned size() const noexcept
+    {
+        return static_cast<unsigned>(m_threads.size());
+    }
+
+    void submit(Task task)
+    {
+        const std::size_t idx = (t_pool == this)
+            ? t_index
+            : m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+        // Count first so a fast thief never sees pending go negative.
+        m_pending.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard lk(m_queues[idx]->m);
+            m_queues[idx]->q.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lk(m_wakeMutex);
+        }
+        m_wake.notify_one();
+    }
+
+    // Run fn(i) for every i in [0, count) and wait for all of them.
+    // The first exception thrown by fn is rethrown here.
+    void parallel_for(std::size_t count, const std::function<void(std::size_t)>& fn)
+    {
+        if (count == 0)
+            return;
+
+        if (count == 1)
+        {
+            fn(0);
+            return;
+        }
+
+        std::atomic<std::size_t> left{ count };
+        std::mutex               doneMutex;
+        std::condition_variable  done;
+        std::exception_ptr       error;
+        std::mutex               errorMutex;
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            submit([&, i]
+                {
+                    try
+                    {
+                        fn(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard lk(errorMutex);
+                        if (!error)
+                            error = std::current_exception();
+                    }
+
+                    // Count down under the lock, so the caller cannot
+                    // see zero and unwind while this is still inside it.
+                    std::lock_guard lk(doneMutex);
+                    if (left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        done.notify_all();
+                });
+        }
+
+        while (left.load(std::memory_order_acquire) != 0)
+        {
+            Task t;
+            if (try_pop(t_pool == this ? t_index : m_queues.size(), t))
+            {
+                t();
+                continue;
+            }
+
+            std::unique_lock lk(doneMutex);
+            done.wait_for(lk, std::chrono::milliseconds(1),
+                [&] { return left.load(std::memory_order_acquire) == 0; });
+        }
+
+        // The last task may still be releasing doneMutex.
+        { std::lock_guard lk(doneMutex); }
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex       m;
+        std::deque<Task> q;
+    };
+
+    // self == m_queues.size() means "not a worker": steal only.
+    bool try_pop(std::size_t self, Task& out)
+    {
+        const std::size_t n = m_queues.size();
+
+        if (self < n)
+        {
+            auto& own = *m_queues[self];
+            std::lock_guard lk(own.m);
+            if (!own.q.empty())
+            {
+                out = std::move(own.q.back());
+                own.q.pop_back();
+                m_pending.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+        }
+
+        for (std::size_t k = 1; k <= n; ++k)
+        {
+            auto& victim = *m_queues[(self + k) % n];
+            std::lock_guard lk(victim.m);
+            if (!victim.q.empty())
+            {
+                out = std::move(victim.q.front());
+                victim.q.pop_front();
+                m_pending.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker(std::size_t index)
+    {
+        t_pool = this;
+        t_index = index;
+
+        for (;;)
+        {
+            Task t;
+            if (try_pop(index, t))
+            {
+                t();
+                continue;
+            }
+
+            std::unique_lock lk(m_wakeMutex);
+            m_wake.wait(lk, [this]
+                {
+                    return m_stop || m_pending.load(std::memory_order_acquire) > 0;
+                });
+
+            if (m_stop && m_pending.load(std::memory_order_acquire) == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread>            m_threads;
+
+    std::mutex                m_wakeMutex;
+    std::condition_variable   m_wake;
+    std::atomic<std::size_t>  m_pending{};
+    std::atomic<std::size_t>  m_next{};
+    bool                      m_stop{};
+
+    static inline thread_local ThreadPool* t_pool = nullptr;
+    static inline thread_local std::size_t t_index = 0;
+};
+
+// Process-wide pool sized to the machine.
+export ThreadPool& GlobalPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// ------------------------------------------------------------
+// Jobs: progress and cancellation for the command being run
+//
+// Long loops report finished work with JobBytes / JobInstructions
+// and call JobCheckpoint between pieces of it, which throws
+// JobCancelled once a stop was requested. The current job is one
+// process-wide slot rather than thread-local, so pool workers in a
+// parallel_for see the job of the thread that started it; only one
+// command runs at a time.
+// ------------------------------------------------------------
+
+export struct JobCancelled : std::exception
+{
+    const char* what() const noexcept override { return "cancelled"; }
+};
+
+export class Job
+{
+public:
+    // Called with the running totals, at most once per interval.
+    using ProgressFn = std::function<void(std::uint64_t bytes, std::uint64_t instructions)>;
+
+    static constexpr std::chrono::milliseconds kInterval{ 100 };
+
+    explicit Job(std::stop_token stop = {}, ProgressFn onProgress = {})
+        : m_stop(std::move(stop)), m_onProgress(std::move(onProgress)),
+        m_last(std::chrono::steady_clock::now().time_since_epoch().count())
+    {
+    }
+
+    Job(const Job&) = delete;
+    Job& operator=(const Job&) = delete;
+
+    [[nodiscard]] bool stop_requested() const noexcept { return m_stop.stop_requested(); }
+    [[nodiscard]] std::uint64_t bytes() const noexcept { return m_bytes.load(std::memory_order_relaxed); }
+    [[nodiscard]] std::uint64_t instructions() const noexcept { return m_instructions.load(std::memory_order_relaxed); }
+
+    void add(std::uint64_t bytes, std::uint64_t instructions)
+    {
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        m_instructions.fetch_add(instructions, std::memory_order_relaxed);
+
+        if (!m_onProgress)
+            return;
+
+        // Whoever moves m_last forward reports; the rest skip.
+        const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto last = m_last.load(std::memory_order_relaxed);
+        if (now - last >= std::chrono::steady_clock::duration(kInterval).count() &&
+            m_last.compare_exchange_strong(last, now, std::memory_order_relaxed))
+        {
+            m_onProgress(this->bytes(), this->instructions());
+        }
+    }
+
+private:
+    std::stop_token                     m_stop;
+    ProgressFn                          m_onProgress;
+    std::atomic<std::uint64_t>          m_bytes{};
+    std::atomic<std::uint64_t>          m_instructions{};
+    std::atomic<std::chrono::steady_clock::rep> m_last{};
+};
+
+static std::atomic<Job*> g_job{};
+
+// Makes job the current one for the lifetime of the scope.
+export class JobScope
+{
+public:
+    explicit JobScope(Job& job) noexcept
+        : m_prev(g_job.exchange(&job, std::memory_order_acq_rel))
+    {
+    }
+
+    ~JobScope()
+    {
+        g_job.store(m_prev, std::memory_order_release);
+    }
+
+    JobScope(const JobScope&) = delete;
+    JobScope& operator=(const JobScope&) = delete;
+
+private:
+    Job* m_prev;
+};
+
+export void JobBytes(std::uint64_t n)
+{
+    if (Job* j = g_job.load(std::memory_order_acquire))
+        j->add(n, 0);
+}
+
+export void JobInstructions(std::uint64_t n)
+{
+    if (Job* j = g_job.load(std::memory_order_acquire))
+        j->add(0, n);
+}
+
+export bool JobStopRequested() noexcept
+{
+    Job* j = g_job.load(std::memory_order_acquire);
+    return j && j->stop_requested();
+}
+
+export void JobCheckpoint()
+{
+    if (Job* j = g_job.load(std::memory_order_acquire); j && j->stop_requested())
+        throw JobCancelled{};
+}
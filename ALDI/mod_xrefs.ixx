@@ -0,0 +1,317 @@
+export module mod_xrefs;
+
+import mod_pe_utils;
+import mod_analysis;
+import mod_disasm;
+import mod_threadpool;
+
+import <vector>;
+import <span>;
+import <cstddef>;
+import <cstdint>;
+import <algorithm>;
+import <utility>;
+
+// Zydis include via vcpkg
+import "Zycore/Types.h";
+import "Zydis/Zydis.h";
+
+// ---------------------------------------------------------------------------
+// One reference from an instruction to an address, both as RVAs.
+// ---------------------------------------------------------------------------
+export enum class XrefKind : std::uint8_t
+{
+    Call,
+    Jump,
+    CondJump,
+    Read,       // [rip+disp] / [disp32] read
+    Write,      // [rip+disp] / [disp32] written
+    Address     // lea of either
+};
+
+export const wchar_t* XrefKindName(XrefKind k) noexcept
+{
+    switch (k)
+    {
+    case XrefKind::Call:     return L"call";
+    case XrefKind::Jump:     return L"jmp";
+    case XrefKind::CondJump: return L"jcc";
+    case XrefKind::Read:     return L"read";
+    case XrefKind::Write:    return L"write";
+    case XrefKind::Address:  return L"addr";
+    }
+    return L"?";
+}
+
+export struct Xref
+{
+    std::uint32_t from{};
+    std::uint32_t to{};
+    XrefKind      kind{};
+};
+
+// ---------------------------------------------------------------------------
+// XrefIndex: every reference found in a sweep index, kept twice —
+// sorted by source and sorted by destination — so both "what does
+// this instruction reference" and "who references this address" are
+// a binary search.
+// ---------------------------------------------------------------------------
+export class XrefIndex
+{
+public:
+    static constexpr std::size_t kChunk = std::size_t(1) << 16;
+
+    [[nodiscard]] std::size_t size() const noexcept { return m_byFrom.size(); }
+    [[nodiscard]] bool empty() const noexcept { return m_byFrom.empty(); }
+
+    void clear() noexcept
+    {
+        m_byFrom.clear();
+        m_byTo.clear();
+    }
+
+    // Index every instruction of code, in parallel slices.
+    void build(std::span<const std::byte> data,
+        const pe::Layout& layout,
+        const InstructionCache& code)
+    {
+        const std::size_t chunks = (code.size() + kChunk - 1) / kChunk;
+        std::vector<std::vector<Xref>> parts(chunks);
+
+        GlobalPool().parallel_for(chunks, [&](std::size_t k)
+            {
+                JobCheckpoint();
+
+                const std::size_t a = k * kChunk;
+                Collect(data, layout, code, a, std::min(a + kChunk, code.size()), parts[k]);
+            });
+
+        std::size_t total = 0;
+        for (const auto& p : parts)
+            total += p.size();
+
+        // Slices are in RVA order, so their concatenation is sorted by source.
+        m_byFrom.clear();
+        m_byFrom.reserve(total);
+        for (auto& p : parts)
+            m_byFrom.insert(m_byFrom.end(), p.begin(), p.end());
+
+        m_byTo = m_byFrom;
+        std::sort(m_byTo.begin(), m_byTo.end(), ByTo);
+    }
+
+    // Re-derive the references of instructions in [lo, hi) after code
+    // was updated there; everything else is left alone.
+    void update(std::span<const std::byte> data,
+        const pe::Layout& layout,
+        const InstructionCache& code,
+        std::uint32_t lo,
+        std::uint32_t hi)
+    {
+        auto a = std::lower_bound(m_byFrom.begin(), m_byFrom.end(), lo,
+            [](const Xref& x, std::uint32_t v) { return x.from < v; });
+        auto b = std::lower_bound(a, m_byFrom.end(), hi,
+            [](const Xref& x, std::uint32_t v) { return x.from < v; });
+
+        // The same references in the other order: each is found by a
+        // binary search, then the rest is closed up in one move.
+        std::vector<Xref> gone(a, b);
+        std::sort(gone.begin(), gone.end(), ByTo);
+
+        std::vector<std::pair<std::size_t, std::size_t>> holes;
+        for (const auto& x : gone)
+        {
+            const auto [p, q] = std::equal_range(m_byTo.begin(), m_byTo.end(), x, ByTo);
+            const std::size_t first = p - m_byTo.begin();
+            if (holes.empty() || holes.back().second <= first)
+                holes.emplace_back(first, q - m_byTo.begin());
+        }
+
+        if (!holes.empty())
+        {
+            auto out = m_byTo.begin() + holes.front().first;
+            for (std::size_t k = 0; k < holes.size(); ++k)
+            {
+                const std::size_t next = k + 1 < holes.size() ? holes[k + 1].first : m_byTo.size();
+                out = std::move(m_byTo.begin() + holes[k].second, m_byTo.begin() + next, out);
+            }
+            m_byTo.erase(out, m_byTo.end());
+        }
+
+        const auto at = m_byFrom.erase(a, b) - m_byFrom.begin();
+
+        std::vector<Xref> fresh;
+        Collect(data, layout, code, code.lower_bound(lo), code.lower_bound(hi), fresh);
+
+        m_byFrom.insert(m_byFrom.begin() + at, fresh.begin(), fresh.end());
+
+        std::sort(fresh.begin(), fresh.end(), ByTo);
+        const auto mid = m_byTo.insert(m_byTo.end(), fresh.begin(), fresh.end());
+        std::inplace_merge(m_byTo.begin(), mid, m_byTo.end(), ByTo);
+    }
+
+    // Both orders as stored, for saving the index whole.
+    [[nodiscard]] std::span<const Xref> by_from() const noexcept { return m_byFrom; }
+    [[nodiscard]] std::span<const Xref> by_to() const noexcept { return m_byTo; }
+
+    // Replace the index with one saved from by_from() / by_to().
+    void assign(std::span<const Xref> byFrom, std::span<const Xref> byTo)
+    {
+        m_byFrom.assign(byFrom.begin(), byFrom.end());
+        m_byTo.assign(byTo.begin(), byTo.end());
+    }
+
+    // References to rva.
+    [[nodiscard]] std::span<const Xref> to(std::uint32_t rva) const
+    {
+        auto [a, b] = std::equal_range(m_byTo.begin(), m_byTo.end(), Xref{ 0, rva, {} },
+            [](const Xref& x, const Xref& y) { return x.to < y.to; });
+        return { a, b };
+    }
+
+    // References made by the instruction at rva.
+    [[nodiscard]] std::span<const Xref> from(std::uint32_t rva) const
+    {
+        auto [a, b] = std::equal_range(m_byFrom.begin(), m_byFrom.end(), Xref{ rva, 0, {} },
+            [](const Xref& x, const Xref& y) { return x.from < y.from; });
+        return { a, b };
+    }
+
+private:
+    static bool ByTo(const Xref& x, const Xref& y) noexcept
+    {
+        return x.to != y.to ? x.to < y.to : x.from < y.from;
+    }
+
+    static std::uint64_t base_of(const pe::Layout& layout) noexcept
+    {
+        return layout.valid ? layout.imageBase : 0;
+    }
+
+    // Anything that lands inside a section (or the blob) counts.
+    static bool InImage(const pe::Layout& layout, std::size_t dataSize, std::uint64_t rva)
+    {
+        if (!layout.valid)
+            return rva < dataSize;
+
+        for (const auto& s : layout.sections)
+        {
+            const std::uint32_t span = std::max(s.virtualSize, s.rawSize);
+            if (rva >= s.virtualAddress && rva - s.virtualAddress < span)
+                return true;
+        }
+        return false;
+    }
+
+    // References of code instructions [first, last), appended in order.
+    static void Collect(std::span<const std::byte> data,
+        const pe::Layout& layout,
+        const InstructionCache& code,
+        std::size_t first,
+        std::size_t last,
+        std::vector<Xref>& out)
+    {
+        if (first >= last)
+            return;
+
+        // A sweep covers one section, so one delta maps all of it.
+        std::size_t base = code.rva(first);
+        if (layout.valid && !pe::rva_to_file(layout, code.rva(first), base))
+            return;
+        const std::ptrdiff_t delta = static_cast<std::ptrdiff_t>(base) - code.rva(first);
+
+        ZydisDecoder decoder{};
+        InitDecoder(decoder, layout);
+
+        for (std::size_t i = first; i < last; ++i)
+        {
+            const std::uint32_t rva = code.rva(i);
+
+            // Direct branches were resolved by the sweep already;
+            // indirect ones ("call [rip+x]") go on to their operand.
+            XrefKind branch = XrefKind::Read;
+            bool isBranch = false;
+
+            switch (code.flow(i))
+            {
+            case FlowKind::Call:
+            case FlowKind::Jump:
+            case FlowKind::CondJump:
+                branch = code.flow(i) == FlowKind::Call ? XrefKind::Call
+                    : code.flow(i) == FlowKind::Jump ? XrefKind::Jump
+                    : XrefKind::CondJump;
+                isBranch = true;
+
+                if (code.target(i) != InstructionCache::kNoTarget)
+                {
+                    if (InImage(layout, data.size(), code.target(i)))
+                        out.push_back({ rva, code.target(i), branch });
+                    continue;
+                }
+                break;
+            case FlowKind::Return:
+            case FlowKind::Stop:
+                continue;
+            default:
+                break;
+            }
+
+            const std::size_t off = static_cast<std::size_t>(rva + delta);
+            if (off >= data.size())
+                continue;
+
+            ZydisDecodedInstruction inst{};
+            ZydisDecodedOperand     ops[ZYDIS_MAX_OPERAND_COUNT]{};
+            if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder,
+                data.data() + off, data.size() - off, &inst, ops)))
+            {
+                continue;
+            }
+
+            for (std::uint8_t n = 0; n < inst.operand_count_visible; ++n)
+            {
+                const ZydisDecodedOperand& op = ops[n];
+                if (op.type != ZYDIS_OPERAND_TYPE_MEMORY)
+                    continue;
+
+                // [rip+disp] in x64; [disp32] is an absolute VA, which
+                // is how x86 code addresses its data and IAT.
+                const bool ripRel = op.mem.base == ZYDIS_REGISTER_RIP;
+                const bool absolute = op.mem.base == ZYDIS_REGISTER_NONE &&
+                    op.mem.index == ZYDIS_REGISTER_NONE && op.mem.disp.has_displacement;
+                if (!ripRel && !absolute)
+                    continue;
+
+                std::uint64_t abs{};
+                if (ripRel)
+                {
+                    ZyanU64 a{};
+                    if (!ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&inst, &op, rva, &a)))
+                        continue;
+                    abs = a;
+                }
+                else
+                {
+                    const auto va = static_cast<std::uint64_t>(op.mem.disp.value) &
+                        (Is64BitCode(layout) ? ~0ull : 0xFFFFFFFFull);
+                    if (va < base_of(layout))
+                        continue;
+                    abs = va - base_of(layout);
+                }
+
+                if (!InImage(layout, data.size(), abs))
+                    continue;
+
+                const XrefKind k = isBranch ? branch
+                    : op.mem.type == ZYDIS_MEMOP_TYPE_AGEN ? XrefKind::Address
+                    : (op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) ? XrefKind::Write
+                    : XrefKind::Read;
+
+                out.push_back({ rva, static_cast<std::uint32_t>(abs), k });
+            }
+        }
+    }
+
+    std::vector<Xref> m_byFrom;
+    std::vector<Xref> m_byTo;
+};
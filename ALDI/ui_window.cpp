@@ -2,19 +2,325 @@
 
 #include <commdlg.h>
 #include <string>
+#include <span>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cwchar>
+#include <memory>
+#include <thread>
+#include <stop_token>
 
 import mod_commands;
+import mod_binary_file;
+import mod_hex;
+import mod_threadpool;
 
 #pragma comment(lib, "Comctl32.lib")
 
 // Global UI instance
 static ALDI_UI g_ui;
 
+// Output area mode: hex view under a short status pane, or the
+// edit control alone for text results.
+static bool g_hexMode = false;
+
+// A command is running on the worker thread (see RunCommandAsync).
+static bool g_busy = false;
+
 ALDI_UI& ui_state()
 {
     return g_ui;
 }
 
+// ---------------------------------------------------------------------------
+// Virtual hex view
+//
+// Shows [base, base + length) of CoreBytes() but only formats the
+// rows inside the paint rect, so scrolling a 4 GB file or a huge
+// dump costs the same as scrolling a single page.
+// ---------------------------------------------------------------------------
+
+struct HexView
+{
+    std::size_t base{};
+    std::size_t length{};
+    std::size_t topRow{};
+
+    // Main view (not a dump): keep the commands' view offset in step.
+    bool followsFile{};
+
+    HFONT font{};
+    bool  ownsFont{};
+    int   rowHeight{ 16 };
+    int   wheelCarry{};
+
+    std::wstring row; // reused for every painted row
+};
+
+static HexView g_hex;
+
+// Scroll bars take ints; very tall views are scaled down.
+constexpr std::size_t kScrollRange = std::size_t(1) << 30;
+
+static std::size_t HexRows()
+{
+    return (g_hex.length + kHexRowBytes - 1) / kHexRowBytes;
+}
+
+static std::size_t HexVisibleRows(HWND hwnd)
+{
+    RECT rc{};
+    GetClientRect(hwnd, &rc);
+    return static_cast<std::size_t>((std::max)(1L, (rc.bottom - rc.top) / g_hex.rowHeight));
+}
+
+static std::size_t HexMaxTop(HWND hwnd)
+{
+    const std::size_t rows = HexRows();
+    const std::size_t vis = HexVisibleRows(hwnd);
+    return rows > vis ? rows - vis : 0;
+}
+
+static std::size_t HexScrollScale()
+{
+    const std::size_t rows = HexRows();
+    return rows > kScrollRange ? (rows + kScrollRange - 1) / kScrollRange : 1;
+}
+
+static void HexUpdateScrollBar(HWND hwnd)
+{
+    const std::size_t scale = HexScrollScale();
+    const std::size_t rows = HexRows();
+
+    SCROLLINFO si{};
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS | SIF_DISABLENOSCROLL;
+    si.nMin = 0;
+    si.nMax = rows ? static_cast<int>((rows - 1) / scale) : 0;
+    si.nPage = static_cast<UINT>(std::max<std::size_t>(1, HexVisibleRows(hwnd) / scale));
+    si.nPos = static_cast<int>(g_hex.topRow / scale);
+    SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+}
+
+static void HexScrollTo(HWND hwnd, std::size_t top)
+{
+    // Frozen while a command runs: scrolling the main view moves the
+    // view offset, which the command may be reading.
+    if (g_busy)
+        return;
+
+    top = (std::min)(top, HexMaxTop(hwnd));
+    if (top == g_hex.topRow)
+        return;
+
+    const long long delta = static_cast<long long>(top) - static_cast<long long>(g_hex.topRow);
+    g_hex.topRow = top;
+
+    // Move the pixels we already have; only uncovered rows repaint.
+    if (std::llabs(delta) < static_cast<long long>(HexVisibleRows(hwnd)))
+    {
+        ScrollWindowEx(hwnd, 0, static_cast<int>(-delta * g_hex.rowHeight),
+            nullptr, nullptr, nullptr, nullptr, SW_INVALIDATE);
+    }
+    else
+    {
+        InvalidateRect(hwnd, nullptr, FALSE);
+    }
+
+    HexUpdateScrollBar(hwnd);
+
+    if (g_hex.followsFile)
+        set_view_offset(g_hex.base + top * kHexRowBytes);
+}
+
+static void HexShow(std::size_t base, std::size_t length, std::size_t top, bool followsFile)
+{
+    HWND hwnd = g_ui.hHexView;
+
+    g_hex.base = base;
+    g_hex.length = length;
+    g_hex.followsFile = followsFile;
+    g_hex.topRow = (std::min)(top, HexMaxTop(hwnd));
+
+    HexUpdateScrollBar(hwnd);
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+static void HexPaint(HWND hwnd)
+{
+    PAINTSTRUCT ps{};
+    HDC dc = BeginPaint(hwnd, &ps);
+
+    FillRect(dc, &ps.rcPaint, reinterpret_cast<HBRUSH>(COLOR_WINDOW + 1));
+
+    HGDIOBJ oldFont = SelectObject(dc, g_hex.font);
+    SetBkMode(dc, TRANSPARENT);
+    SetTextColor(dc, GetSysColor(COLOR_WINDOWTEXT));
+
+    const auto bytes = CoreBytes();
+    const std::size_t end = (std::min)(g_hex.base + g_hex.length, bytes.size());
+    const std::size_t rows = HexRows();
+
+    const std::size_t first = g_hex.topRow + ps.rcPaint.top / g_hex.rowHeight;
+    const std::size_t last = (std::min)(rows,
+        g_hex.topRow + (ps.rcPaint.bottom + g_hex.rowHeight - 1) / g_hex.rowHeight);
+
+    for (std::size_t r = first; r < last; ++r)
+    {
+        const std::size_t off = g_hex.base + r * kHexRowBytes;
+        if (off >= end)
+            break;
+
+        g_hex.row.clear();
+        HexFormatRows(bytes.first(end), off, kHexRowBytes, g_hex.row);
+
+        int len = static_cast<int>(g_hex.row.size());
+        while (len > 0 && (g_hex.row[len - 1] == L'\r' || g_hex.row[len - 1] == L'\n'))
+            --len;
+
+        const int y = static_cast<int>(r - g_hex.topRow) * g_hex.rowHeight;
+        TextOutW(dc, 4, y, g_hex.row.c_str(), len);
+    }
+
+    SelectObject(dc, oldFont);
+    EndPaint(hwnd, &ps);
+}
+
+static LRESULT CALLBACK HexViewProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    switch (msg)
+    {
+    case WM_CREATE:
+    {
+        g_hex.font = CreateFontW(-14, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE,
+            DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+            CLEARTYPE_QUALITY, FIXED_PITCH | FF_MODERN, L"Consolas");
+        g_hex.ownsFont = g_hex.font != nullptr;
+        if (!g_hex.font)
+            g_hex.font = static_cast<HFONT>(GetStockObject(ANSI_FIXED_FONT));
+
+        HDC dc = GetDC(hwnd);
+        HGDIOBJ old = SelectObject(dc, g_hex.font);
+        TEXTMETRICW tm{};
+        GetTextMetricsW(dc, &tm);
+        SelectObject(dc, old);
+        ReleaseDC(hwnd, dc);
+
+        g_hex.rowHeight = (std::max)(1L, tm.tmHeight + tm.tmExternalLeading);
+        return 0;
+    }
+
+    case WM_SIZE:
+        HexScrollTo(hwnd, g_hex.topRow);
+        HexUpdateScrollBar(hwnd);
+        return 0;
+
+    case WM_ERASEBKGND:
+        return 1; // HexPaint fills the background
+
+    case WM_PAINT:
+        HexPaint(hwnd);
+        return 0;
+
+    case WM_VSCROLL:
+    {
+        const std::size_t page = HexVisibleRows(hwnd);
+        std::size_t top = g_hex.topRow;
+
+        switch (LOWORD(wParam))
+        {
+        case SB_LINEUP:   top = top ? top - 1 : 0; break;
+        case SB_LINEDOWN: top += 1; break;
+        case SB_PAGEUP:   top = top > page ? top - page : 0; break;
+        case SB_PAGEDOWN: top += page; break;
+        case SB_TOP:      top = 0; break;
+        case SB_BOTTOM:   top = HexMaxTop(hwnd); break;
+
+        case SB_THUMBTRACK:
+        case SB_THUMBPOSITION:
+        {
+            SCROLLINFO si{};
+            si.cbSize = sizeof(si);
+            si.fMask = SIF_TRACKPOS;
+            GetScrollInfo(hwnd, SB_VERT, &si);
+            top = static_cast<std::size_t>(si.nTrackPos) * HexScrollScale();
+            break;
+        }
+        }
+
+        HexScrollTo(hwnd, top);
+        return 0;
+    }
+
+    case WM_MOUSEWHEEL:
+    {
+        UINT lines = 3;
+        SystemParametersInfoW(SPI_GETWHEELSCROLLLINES, 0, &lines, 0);
+        if (lines == WHEEL_PAGESCROLL)
+            lines = static_cast<UINT>(HexVisibleRows(hwnd));
+
+        g_hex.wheelCarry += GET_WHEEL_DELTA_WPARAM(wParam);
+        const int notches = g_hex.wheelCarry / WHEEL_DELTA;
+        g_hex.wheelCarry %= WHEEL_DELTA;
+
+        const long long delta = -static_cast<long long>(notches) * lines;
+        const long long top = (std::max)(0LL, static_cast<long long>(g_hex.topRow) + delta);
+
+        HexScrollTo(hwnd, static_cast<std::size_t>(top));
+        return 0;
+    }
+
+    case WM_KEYDOWN:
+    {
+        int code = -1;
+        switch (wParam)
+        {
+        case VK_UP:    code = SB_LINEUP; break;
+        case VK_DOWN:  code = SB_LINEDOWN; break;
+        case VK_PRIOR: code = SB_PAGEUP; break;
+        case VK_NEXT:  code = SB_PAGEDOWN; break;
+        case VK_HOME:  code = SB_TOP; break;
+        case VK_END:   code = SB_BOTTOM; break;
+        }
+
+        if (code >= 0)
+        {
+            SendMessageW(hwnd, WM_VSCROLL, MAKEWPARAM(code, 0), 0);
+            return 0;
+        }
+        break;
+    }
+
+    case WM_LBUTTONDOWN:
+        SetFocus(hwnd);
+        return 0;
+
+    case WM_DESTROY:
+        if (g_hex.ownsFont)
+            DeleteObject(g_hex.font);
+        g_hex.font = nullptr;
+        return 0;
+    }
+
+    return DefWindowProcW(hwnd, msg, wParam, lParam);
+}
+
+static void RegisterHexViewClass()
+{
+    static bool registered = false;
+    if (registered)
+        return;
+
+    WNDCLASSW wc{};
+    wc.lpfnWndProc = HexViewProc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = L"ALDIHexView";
+    wc.hCursor = LoadCursorW(nullptr, IDC_IBEAM);
+
+    registered = RegisterClassW(&wc) != 0;
+}
+
 // ---------------------------------------------------------------------------
 // Layout
 // ---------------------------------------------------------------------------
@@ -56,14 +362,42 @@ static void LayoutControls(HWND hwnd)
         btnH,
         TRUE);
 
+    const int outY = margin + btnH + spacing;
+    const int outH = h - (margin * 3 + btnH);
+
+    if (!g_hexMode)
+    {
+        MoveWindow(g_ui.hEditOutput,
+            margin, outY,
+            w - margin * 2, outH,
+            TRUE);
+        return;
+    }
+
+    // Status pane on top, virtual hex view below.
+    const int statusH = (std::min)(110, outH / 3);
+
     MoveWindow(g_ui.hEditOutput,
-        margin,
-        margin + btnH + spacing,
-        w - margin * 2,
-        h - (margin * 3 + btnH),
+        margin, outY,
+        w - margin * 2, statusH,
+        TRUE);
+
+    MoveWindow(g_ui.hHexView,
+        margin, outY + statusH + spacing,
+        w - margin * 2, outH - statusH - spacing,
         TRUE);
 }
 
+static void SetHexMode(bool on)
+{
+    if (g_hexMode == on)
+        return;
+
+    g_hexMode = on;
+    ShowWindow(g_ui.hHexView, on ? SW_SHOW : SW_HIDE);
+    LayoutControls(g_ui.hMain);
+}
+
 // ---------------------------------------------------------------------------
 // File dialog helper
 // ---------------------------------------------------------------------------
@@ -100,17 +434,180 @@ static void ApplyCommandResult(const CommandResult& r)
 
     case CommandResultKind::RefreshView:
     {
-        const std::wstring text = render_main_view();
-        SetWindowTextW(g_ui.hEditOutput, text.c_str());
+        const std::wstring status = render_status();
+        SetWindowTextW(g_ui.hEditOutput, status.c_str());
+
+        SetHexMode(true);
+        HexShow(0, CoreSize(), view_offset() / kHexRowBytes, true);
         break;
     }
 
     case CommandResultKind::ReplaceTextW:
+        SetHexMode(false);
+        SetWindowTextW(g_ui.hEditOutput, r.text.c_str());
+        break;
+
+    case CommandResultKind::ShowBytes:
         SetWindowTextW(g_ui.hEditOutput, r.text.c_str());
+
+        SetHexMode(true);
+        HexShow(r.offset, r.size, 0, false);
         break;
+
+    case CommandResultKind::Instructions:
+    case CommandResultKind::Hits:
+    case CommandResultKind::Xrefs:
+    case CommandResultKind::VTable:
+    case CommandResultKind::Strings:
+    {
+        std::wstring text;
+        FormatResult(r, text);
+
+        SetHexMode(false);
+        SetWindowTextW(g_ui.hEditOutput, text.c_str());
+        break;
+    }
     }
 }
 
+// ---------------------------------------------------------------------------
+// Background command execution
+//
+// Commands run one at a time on a worker thread. The worker posts
+// progress while loops report it, text as FormatResult produces it,
+// and the finished result; all UI changes happen here on the window
+// thread. Esc in the command box requests a stop, which the scan and
+// decode loops notice at their next checkpoint.
+// ---------------------------------------------------------------------------
+
+constexpr UINT WM_APP_PROGRESS = WM_APP + 1; // wParam bytes, lParam instructions
+constexpr UINT WM_APP_TEXT     = WM_APP + 2; // lParam std::wstring*, owned by the receiver
+constexpr UINT WM_APP_DONE     = WM_APP + 3; // lParam CommandResult*, owned by the receiver
+
+static std::jthread g_worker;
+static bool         g_streamed = false; // the output pane holds this command's text
+
+static bool IsFormattedKind(CommandResultKind k)
+{
+    return k == CommandResultKind::Instructions || k == CommandResultKind::Hits ||
+        k == CommandResultKind::Xrefs || k == CommandResultKind::VTable ||
+        k == CommandResultKind::Strings;
+}
+
+static void SetBusy(bool busy)
+{
+    g_busy = busy;
+    EnableWindow(g_ui.hBtnOpen, !busy);
+    EnableWindow(g_ui.hBtnPrev, !busy);
+    EnableWindow(g_ui.hBtnNext, !busy);
+    EnableWindow(g_ui.hHexView, !busy);
+}
+
+static void RunCommandAsync(std::wstring line)
+{
+    SetBusy(true);
+    g_streamed = false;
+
+    const HWND hwnd = g_ui.hMain;
+
+    g_worker = std::jthread([hwnd, line = std::move(line)](std::stop_token stop)
+        {
+            Job job(stop, [hwnd](std::uint64_t bytes, std::uint64_t instructions)
+                {
+                    PostMessageW(hwnd, WM_APP_PROGRESS,
+                        static_cast<WPARAM>(bytes), static_cast<LPARAM>(instructions));
+                });
+            JobScope scope(job);
+
+            auto post = [hwnd](std::wstring& text)
+                {
+                    PostMessageW(hwnd, WM_APP_TEXT, 0,
+                        reinterpret_cast<LPARAM>(new std::wstring(std::move(text))));
+                };
+
+            auto r = std::make_unique<CommandResult>();
+            try
+            {
+                *r = ExecCommand(line);
+
+                // Typed results are formatted here and streamed in.
+                if (IsFormattedKind(r->kind))
+                {
+                    std::wstring text;
+                    FormatResult(*r, text, post);
+                    post(text);
+                }
+            }
+            catch (const JobCancelled&)
+            {
+                std::wstring text = L"\r\n(cancelled)\r\n";
+                post(text);
+            }
+            catch (...)
+            {
+                std::wstring text = L"\r\n(command error)\r\n";
+                post(text);
+            }
+
+            PostMessageW(hwnd, WM_APP_DONE, 0, reinterpret_cast<LPARAM>(r.release()));
+        });
+}
+
+// Commands that patch, map or switch files run here on the window
+// thread instead, so the hex view never paints bytes that are being
+// changed or unmapped.
+static void RunCommandNow(const std::wstring& line)
+{
+    CommandResult r;
+    try
+    {
+        r = ExecCommand(line);
+    }
+    catch (...)
+    {
+        r = { CommandResultKind::ReplaceTextW, L"(command error)\r\n" };
+    }
+
+    ApplyCommandResult(r);
+}
+
+static void OnCommandProgress(std::uint64_t bytes, std::uint64_t instructions)
+{
+    if (!g_busy || g_streamed)
+        return;
+
+    wchar_t buf[160];
+    swprintf_s(buf, L"Working… %llu MB scanned, %llu instructions decoded (Esc to cancel)",
+        static_cast<unsigned long long>(bytes >> 20),
+        static_cast<unsigned long long>(instructions));
+    SetWindowTextW(g_ui.hEditOutput, buf);
+}
+
+static void OnCommandText(std::unique_ptr<std::wstring> text)
+{
+    if (!g_streamed)
+    {
+        g_streamed = true;
+        SetHexMode(false);
+        SetWindowTextW(g_ui.hEditOutput, L"");
+    }
+
+    const int len = GetWindowTextLengthW(g_ui.hEditOutput);
+    SendMessageW(g_ui.hEditOutput, EM_SETSEL, len, len);
+    SendMessageW(g_ui.hEditOutput, EM_REPLACESEL, FALSE, reinterpret_cast<LPARAM>(text->c_str()));
+}
+
+static void OnCommandDone(std::unique_ptr<CommandResult> r)
+{
+    if (g_worker.joinable())
+        g_worker.join();
+
+    SetBusy(false);
+
+    if (!g_streamed)
+        ApplyCommandResult(*r);
+}
+
 // ---------------------------------------------------------------------------
 // Subclass for Enter key in command box
 // ---------------------------------------------------------------------------
@@ -121,19 +618,34 @@ static LRESULT CALLBACK CmdEditProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM l
 {
     if (msg == WM_KEYDOWN && wParam == VK_RETURN)
     {
+        if (g_busy)
+        {
+            MessageBeep(MB_OK);
+            return 0;
+        }
+
         wchar_t buf[1024]{};
         GetWindowTextW(hwnd, buf, 1023);
 
         if (buf[0] != L'\0')
         {
-            CommandResult r = ExecCommand(buf);
-            ApplyCommandResult(r);
+            if (ChangesFile(buf))
+                RunCommandNow(buf);
+            else
+                RunCommandAsync(buf);
         }
 
         SetWindowTextW(hwnd, L"");
         return 0;
     }
 
+    if (msg == WM_KEYDOWN && wParam == VK_ESCAPE)
+    {
+        if (g_busy)
+            g_worker.request_stop();
+        return 0;
+    }
+
     return CallWindowProcW(g_oldCmdProc, hwnd, msg, wParam, lParam);
 }
 
@@ -179,6 +691,13 @@ LRESULT CALLBACK ALDI_WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             0, 0, 0, 0,
             hwnd, nullptr, nullptr, nullptr);
 
+        RegisterHexViewClass();
+        g_ui.hHexView = CreateWindowW(
+            L"ALDIHexView", L"",
+            WS_CHILD | WS_BORDER | WS_VSCROLL,
+            0, 0, 0, 0,
+            hwnd, nullptr, GetModuleHandleW(nullptr), nullptr);
+
         LayoutControls(hwnd);
         return 0;
     }
@@ -189,6 +708,13 @@ LRESULT CALLBACK ALDI_WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
     case WM_MOUSEWHEEL:
     {
+        // The hex view scrolls by lines wherever the wheel starts.
+        if (g_hexMode)
+            return SendMessageW(g_ui.hHexView, WM_MOUSEWHEEL, wParam, lParam);
+
+        if (g_busy)
+            return 0;
+
         short delta = GET_WHEEL_DELTA_WPARAM(wParam);
         const int dir = (delta < 0) ? +1 : -1;
 
@@ -232,7 +758,26 @@ LRESULT CALLBACK ALDI_WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
         break;
     }
 
+    case WM_APP_PROGRESS:
+        OnCommandProgress(static_cast<std::uint64_t>(wParam), static_cast<std::uint64_t>(lParam));
+        return 0;
+
+    case WM_APP_TEXT:
+        OnCommandText(std::unique_ptr<std::wstring>(reinterpret_cast<std::wstring*>(lParam)));
+        return 0;
+
+    case WM_APP_DONE:
+        OnCommandDone(std::unique_ptr<CommandResult>(reinterpret_cast<CommandResult*>(lParam)));
+        return 0;
+
     case WM_DESTROY:
+        // Stop and wait; the worker only posts, so joining here
+        // cannot deadlock.
+        if (g_worker.joinable())
+        {
+            g_worker.request_stop();
+            g_worker.join();
+        }
         PostQuitMessage(0);
         return 0;
     }
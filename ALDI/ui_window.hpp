@@ -12,6 +12,7 @@ struct ALDI_UI
     HWND hBtnNext{};
     HWND hEditCommand{};
     HWND hEditOutput{};
+    HWND hHexView{};   // virtual hex view, rows drawn on demand
 };
 
 // Global UI accessor (implemented in ui_window.cpp)